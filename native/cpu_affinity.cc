@@ -0,0 +1,159 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cpu_affinity.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+#ifdef LID_HAVE_OPENBLAS
+extern "C" {
+void openblas_set_num_threads(int num_threads);
+int openblas_get_num_threads(void);
+}
+#endif
+
+#ifdef __linux__
+// Parses a sysfs CPU list like "0-3,8,10-11"
+static std::vector<int> ParseCpuList(const std::string &list)
+{
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string range = list.substr(pos, end - pos);
+        size_t dash = range.find('-');
+        if (!range.empty() && range[0] >= '0' && range[0] <= '9') {
+            int first = atoi(range.c_str());
+            int last = dash == std::string::npos ? first : atoi(range.c_str() + dash + 1);
+            for (int cpu = first; cpu <= last; cpu++)
+                cpus.push_back(cpu);
+        }
+        pos = end + 1;
+    }
+    return cpus;
+}
+#endif
+
+CpuTopology::CpuTopology()
+{
+#ifdef __linux__
+    // The mask of the process, not of the thread that happens to ask first
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(getpid(), sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &set))
+                cpus_.push_back(cpu);
+    }
+
+    std::vector<int> node_ids;
+    if (DIR *dir = opendir("/sys/devices/system/node")) {
+        while (struct dirent *entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.compare(0, 4, "node") == 0 && name.size() > 4 && name[4] >= '0' && name[4] <= '9')
+                node_ids.push_back(atoi(name.c_str() + 4));
+        }
+        closedir(dir);
+    }
+    std::sort(node_ids.begin(), node_ids.end());
+    for (int id : node_ids) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+        std::string list;
+        if (!std::getline(file, list))
+            continue;
+        // Only CPUs we may use, nodes without any (memory only) are skipped
+        std::vector<int> node_cpus;
+        for (int cpu : ParseCpuList(list))
+            if (std::binary_search(cpus_.begin(), cpus_.end(), cpu))
+                node_cpus.push_back(cpu);
+        if (!node_cpus.empty())
+            nodes_.push_back(node_cpus);
+    }
+#endif
+    if (cpus_.empty()) {
+        int num_cpus = std::max<int>(std::thread::hardware_concurrency(), 1);
+        for (int cpu = 0; cpu < num_cpus; cpu++)
+            cpus_.push_back(cpu);
+    }
+    if (nodes_.empty())
+        nodes_.push_back(cpus_);
+
+    cpu_nodes_.assign(cpus_.back() + 1, 0);
+    for (size_t node = 0; node < nodes_.size(); node++)
+        for (int cpu : nodes_[node])
+            cpu_nodes_[cpu] = node;
+}
+
+const CpuTopology &CpuTopology::Get()
+{
+    static const CpuTopology topology;
+    return topology;
+}
+
+int CpuTopology::NodeOfCpu(int cpu) const
+{
+    return cpu >= 0 && cpu < static_cast<int>(cpu_nodes_.size()) ? cpu_nodes_[cpu] : 0;
+}
+
+int CpuTopology::CurrentNode() const
+{
+    if (nodes_.size() == 1)
+        return 0;
+#ifdef __linux__
+    return NodeOfCpu(sched_getcpu());
+#else
+    return 0;
+#endif
+}
+
+bool PinCurrentThread(const std::vector<int> &cpus)
+{
+#ifdef __linux__
+    const std::vector<int> &allowed = cpus.empty() ? CpuTopology::Get().Cpus() : cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : allowed)
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+int SetBlasThreads(int num_threads)
+{
+#ifdef LID_HAVE_OPENBLAS
+    int previous = openblas_get_num_threads();
+    openblas_set_num_threads(std::max(num_threads, 1));
+    return previous;
+#else
+    (void)num_threads;
+    return 0;
+#endif
+}
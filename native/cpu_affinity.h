@@ -0,0 +1,53 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CPU_AFFINITY_H_
+#define CPU_AFFINITY_H_
+
+#include <vector>
+
+// The CPUs this process may run on, grouped by NUMA node. Read from sysfs
+// on Linux, elsewhere and without sysfs all CPUs form a single node.
+class CpuTopology {
+public:
+    // Detected once, the topology doesn't change while we run
+    static const CpuTopology &Get();
+
+    int NumNodes() const { return nodes_.size(); }
+    int NumCpus() const { return cpus_.size(); }
+    const std::vector<int> &Cpus() const { return cpus_; }
+    const std::vector<int> &NodeCpus(int node) const { return nodes_[node]; }
+    // Index of the node of a CPU in NodeCpus, 0 if unknown
+    int NodeOfCpu(int cpu) const;
+    // Node of the CPU the calling thread runs on right now
+    int CurrentNode() const;
+
+private:
+    CpuTopology();
+
+    std::vector<int> cpus_;
+    std::vector<std::vector<int> > nodes_;
+    std::vector<int> cpu_nodes_;
+};
+
+// Restricts the calling thread to the CPUs, false if that is not supported
+// or failed. An empty set allows all CPUs of the process again.
+bool PinCurrentThread(const std::vector<int> &cpus);
+
+// Threads of the BLAS library for a single matrix operation. Our own
+// requests already run in parallel, so 1 avoids oversubscription. Ignored
+// unless built with LID_HAVE_OPENBLAS. Returns the previous count, 0 if unknown.
+int SetBlasThreads(int num_threads);
+
+#endif /* CPU_AFFINITY_H_ */
@@ -0,0 +1,54 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef G711_H_
+#define G711_H_
+
+#include <array>
+
+// ITU-T G.711 decoders producing samples in the 16-bit PCM range, so that
+// decoded audio can be fed to the models like linear PCM
+
+static constexpr int G711UlawToLinear(unsigned char u) {
+    u = ~u;
+    int t = (((u & 0x0F) << 3) + 0x84) << ((u & 0x70) >> 4);
+    return (u & 0x80) ? (0x84 - t) : (t - 0x84);
+}
+
+static constexpr int G711AlawToLinear(unsigned char a) {
+    a ^= 0x55;
+    int t = (a & 0x0F) << 4;
+    int seg = (a & 0x70) >> 4;
+    if (seg == 0)
+        t += 8;
+    else
+        t = (t + 0x108) << (seg - 1);
+    return (a & 0x80) ? t : -t;
+}
+
+template <int (*Decode)(unsigned char)>
+static constexpr std::array<float, 256> G711Table() {
+    std::array<float, 256> table{};
+    for (int i = 0; i < 256; i++)
+        table[i] = Decode(static_cast<unsigned char>(i));
+    return table;
+}
+
+static constexpr std::array<float, 256> kUlawTable = G711Table<G711UlawToLinear>();
+static constexpr std::array<float, 256> kAlawTable = G711Table<G711AlawToLinear>();
+
+static_assert(kUlawTable[0x00] == -32124 && kUlawTable[0xFF] == 0, "Bad mu-law table");
+static_assert(kAlawTable[0xD5] == 8 && kAlawTable[0x2A] == -32256, "Bad A-law table");
+
+#endif /* G711_H_ */
@@ -17,6 +17,9 @@
 #include <initializer_list>
 #include <ostream>
 #include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <locale>
 
 namespace json {
 
@@ -371,8 +374,13 @@ class JSON
                 }
                 case Class::String:
                     return "\"" + json_escape( *Internal.String ) + "\"";
-                case Class::Floating:
-                    return std::to_string( Internal.Float );
+                case Class::Floating: {
+                    // std::to_string follows the C locale, which may use a decimal comma
+                    std::ostringstream ss;
+                    ss.imbue( std::locale::classic() );
+                    ss << std::fixed << std::setprecision( 6 ) << Internal.Float;
+                    return ss.str();
+                }
                 case Class::Integral:
                     return std::to_string( Internal.Int );
                 case Class::Boolean:
@@ -14,215 +14,238 @@
 
 #include "kaldi_recognizer.h"
 #include "json.h"
+#include "language_names.h"
+#include "g711.h"
+#include "wave_file.h"
 #include "fstext/fstext-utils.h"
 #include "lat/sausages.h"
 
+#include <condition_variable>
+#include <sstream>
+#include <thread>
+
 using namespace fst;
 using namespace kaldi::nnet3;
 
-// Computes an xvector from a chunk of speech features.
-static void RunNnetComputation(const MatrixBase <BaseFloat> &features,
-                               const nnet3::Nnet &nnet, nnet3::CachingOptimizingCompiler *compiler,
-                               Vector <BaseFloat> *xvector) {
-    nnet3::ComputationRequest request;
-    request.need_model_derivative = false;
-    request.store_component_stats = false;
-    request.inputs.push_back(
-            nnet3::IoSpecification("input", 0, features.NumRows()));
-    nnet3::IoSpecification output_spec;
-    output_spec.name = "output";
-    output_spec.has_deriv = false;
-    output_spec.indexes.resize(1);
-    request.outputs.resize(1);
-    request.outputs[0].Swap(&output_spec);
-    std::shared_ptr<const nnet3::NnetComputation> computation = compiler->Compile(request);
-    nnet3::Nnet *nnet_to_update = NULL;  // we're not doing any update.
-    nnet3::NnetComputer computer(nnet3::NnetComputeOptions(), *computation,
-                                 nnet, nnet_to_update);
-    CuMatrix <BaseFloat> input_feats_cu(features);
-    computer.AcceptInput("input", &input_feats_cu);
-    computer.Run();
-    CuMatrix <BaseFloat> cu_output;
-    computer.GetOutputDestructive("output", &cu_output);
-    xvector->Resize(cu_output.NumCols());
-    xvector->CopyFromVec(cu_output.Row(0));
-}
+#define MIN_LANG_FEATS 50
+#define RESAMPLE_NUM_ZEROS 6
+#define XVECTOR_CHUNK_SIZE 10000
+// Chunks of results with a deadline, short enough that the network can
+// stop between them
+#define DEADLINE_CHUNK_SIZE 1000
+#define BUDGET_SEGMENT_SIZE 300
+#define WAVE_BLOCK_SIZE 4096
+#define SNAPSHOT_VERSION 2
+
+// Asynchronous results in flight, shared with their tasks so that a task
+// can finish after a callback freed the recognizer
+struct KaldiRecognizer::AsyncState {
+    AsyncState() : pending(0) {}
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    int pending;
+    // Thread running a result callback, which may free the recognizer
+    std::thread::id callback_thread;
+};
 
 KaldiRecognizer::KaldiRecognizer(LidModel *lid_model, float sample_frequency) : lid_model_(lid_model),
-                                                                                sample_frequency_(sample_frequency) {
+                                                                                max_results_(0),
+                                                                                language_names_(false),
+                                                                                frame_budget_(lid_model->frame_budget),
+                                                                                sample_frequency_(sample_frequency),
+                                                                                configured_frequency_(sample_frequency),
+                                                                                resampler_(NULL),
+                                                                                use_cache_(false),
+                                                                                cache_key_(0),
+                                                                                feature_bytes_copied_(0),
+                                                                                features_stopped_(false),
+                                                                                feature_tail_size_(0),
+                                                                                feature_samples_(0),
+                                                                                speech_gate_(NULL),
+                                                                                cascade_model_(NULL),
+                                                                                cascade_margin_(0),
+                                                                                escalated_(false),
+                                                                                async_(new AsyncState()) {
     lid_model_->Ref();
     lid_feature_ = new OnlineMfcc(lid_model_->mfcc_opts);
+    feature_tail_.Resize(lid_model_->mfcc_opts.frame_opts.WindowSize(), kUndefined);
+    SetSampleFrequency(sample_frequency);
+    SetSpeechGate(lid_model_->speech_gate);
 }
 
 KaldiRecognizer::~KaldiRecognizer() {
 
-    if (lid_model_) {
-        delete lid_feature_;
+    // The worker still uses the recognizer until the callback returns
+    {
+        std::unique_lock<std::mutex> lock(async_->mutex);
+        async_->finished.wait(lock, [this] {
+            return async_->pending == 0 || async_->callback_thread == std::this_thread::get_id();
+        });
     }
+    delete lid_feature_;
+    delete resampler_;
+    delete speech_gate_;
+    // The model is freed here if it was replaced or released meanwhile
+    lid_model_->Unref();
+    if (cascade_model_)
+        cascade_model_->Unref();
 }
 
-#define MIN_LANG_FEATS 50
+void KaldiRecognizer::SetSampleFrequency(float sample_frequency) {
+    delete resampler_;
+    resampler_ = NULL;
+    sample_frequency_ = sample_frequency;
+
+    // Audio at other rates is converted to the model rate as it arrives
+    BaseFloat model_frequency = lid_model_->mfcc_opts.frame_opts.samp_freq;
+    if (sample_frequency_ != model_frequency) {
+        BaseFloat cutoff = 0.99 * 0.5 * std::min<BaseFloat>(sample_frequency_, model_frequency);
+        resampler_ = new LinearResample(sample_frequency_, model_frequency, cutoff, RESAMPLE_NUM_ZEROS);
+    }
+}
+
+void KaldiRecognizer::Reset() {
+    delete lid_feature_;
+    lid_feature_ = new OnlineMfcc(lid_model_->mfcc_opts);
+    if (resampler_)
+        resampler_->Reset();
+    if (speech_gate_)
+        speech_gate_->Reset();
+    audio_hasher_.Reset();
+    xvector_result.Resize(0);
+    escalated_ = false;
+    restored_feats_.Resize(0, 0);
+    feature_tail_size_ = 0;
+    feature_samples_ = 0;
+}
 
 void KaldiRecognizer::PldaScoring() {
+    LidModel *model = escalated_ ? cascade_model_ : lid_model_;
+    model->ScoreXvector(xvector_result, allowed_languages_, &scores_);
+}
 
-    int64 num_train_ivectors = 0, num_train_errs = 0, num_test_ivectors = 0;
-    double tot_test_renorm_scale = 0.0, tot_train_renorm_scale = 0.0;
-    HashType test_ivectors;
-    KALDI_LOG << "Reading test iVectors";
-    std::string utt = "default";
-    if (test_ivectors.count(utt) != 0) {
-        KALDI_ERR << "Duplicate test iVector found for utterance " << utt;
-    }
-
-    xvector_result.AddVec(-1.0, lid_model_->mean);
-    const Vector <BaseFloat> &vec(xvector_result);
-    int32 transform_rows = lid_model_->transform.NumRows();
-    int32 transform_cols = lid_model_->transform.NumCols();
-    int32 vec_dim = vec.Dim();
-    Vector <BaseFloat> vec_out(transform_rows);
-    if (transform_cols == vec_dim) {
-        vec_out.AddMatVec(1.0, lid_model_->transform, kNoTrans, vec, 0.0);
-    } else {
-        if (transform_cols != vec_dim + 1) {
-            KALDI_ERR << "Dimension mismatch: input vector has dimension "
-                      << vec.Dim() << " and transform has " << transform_cols
-                      << " columns.";
+bool KaldiRecognizer::NeedsEscalation() {
+    if (!cascade_model_ || escalated_ || xvector_result.Dim() == 0)
+        return false;
+
+    // The scores are kept for the result if the small model is trusted
+    PldaScoring();
+    BaseFloat best = -INFINITY, second = -INFINITY;
+    for (auto const &score : scores_) {
+        if (score.second > best) {
+            second = best;
+            best = score.second;
+        } else if (score.second > second) {
+            second = score.second;
         }
-        vec_out.CopyColFromMat(lid_model_->transform, vec_dim);
-        vec_out.AddMatVec(1.0, lid_model_->transform.Range(0, lid_model_->transform.NumRows(),
-                                                           0, vec_dim), kNoTrans, vec, 1.0);
-    }
-
-    int32 num_examples = 1;   // this value is always used for test (affects the
-                           // length normalization in the TransformIvector
-                           // function).
-    Plda plda(lid_model_->plda);
-
-    int32 plda_dim = plda.Dim();
-    Vector <BaseFloat> *transformed_ivector = new Vector<BaseFloat>(plda_dim);
-    tot_test_renorm_scale += plda.TransformIvector(lid_model_->plda_config, vec_out,
-                                                   num_examples,
-                                                   transformed_ivector);
-    test_ivectors[utt] = transformed_ivector;
-    bool binary = false;
-
-    double sums = 0.0, sumsq = 0.0;
-    typedef unordered_map<string, Vector < BaseFloat>*, StringHasher > HashType;
-    std::map <std::string, int32> langs = lid_model_->num_utts;
-    for (auto const &x : langs) {
-        std::string key1 = x.first;
-        if (lid_model_->train_ivectors.count(key1) == 0) {
-            KALDI_WARN << "Key " << key1 << " not present in training iVectors.";
-            continue;
+    }
+    bool escalate = scores_.size() >= 2 && best - second < cascade_margin_;
+    lid_model_->cascade_requests++;
+    if (escalate)
+        lid_model_->cascade_escalations++;
+    return escalate;
+}
+
+void KaldiRecognizer::SetEscalatedXvector(const VectorBase<BaseFloat> &xvector) {
+    xvector_result = xvector;
+    escalated_ = true;
+    scores_.clear();
+}
+
+// Picks segments of voiced frames spread evenly over the utterance so that
+// their total length fits into the frame budget. Segment positions only
+// depend on the number of frames, so the selection is deterministic.
+static void SelectBudgetSegments(const std::vector<int32> &voiced_rows, int32 frame_budget,
+                                 int32 segment_size, std::vector<int32> *selected) {
+    int32 num_rows = voiced_rows.size();
+    int32 this_segment_size = std::min(segment_size, frame_budget);
+    int32 num_segments = frame_budget / this_segment_size;
+    selected->clear();
+    selected->reserve(num_segments * this_segment_size);
+    for (int32 i = 0; i < num_segments; i++) {
+        int32 start = (num_segments == 1) ? (num_rows - this_segment_size) / 2 :
+                      static_cast<int64>(i) * (num_rows - this_segment_size) / (num_segments - 1);
+        selected->insert(selected->end(), voiced_rows.begin() + start,
+                         voiced_rows.begin() + start + this_segment_size);
+    }
+}
+
+// The window sums are kept in double like Kaldi does, but without converting
+// the whole matrix to double and back
+void SlidingWindowCmnRows(const SlidingWindowCmnOptions &opts, const MatrixBase<BaseFloat> &features,
+                                 const std::vector<int32> &rows, MatrixBase<BaseFloat> *output) {
+    opts.Check();
+    int32 num_frames = features.NumRows(), dim = features.NumCols();
+    int32 last_window_start = -1, last_window_end = -1;
+    Vector<double> cur_sum(dim), cur_sumsq(dim);
+    double *sum = cur_sum.Data(), *sumsq = cur_sumsq.Data();
+    size_t next = 0;
+    for (int32 t = 0; t < num_frames && next < rows.size(); t++) {
+        int32 window_start, window_end;
+        if (opts.center) {
+            window_start = t - (opts.cmn_window / 2);
+            window_end = window_start + opts.cmn_window;
+        } else {
+            window_start = t - opts.cmn_window;
+            window_end = t + 1;
         }
-        if (test_ivectors.count(utt) == 0) {
-            KALDI_WARN << "Key " << utt << " not present in test iVectors.";
-            continue;
+        if (window_start < 0) {
+            window_end -= window_start;
+            window_start = 0;
+        }
+        if (!opts.center && window_end > t)
+            window_end = std::max(t + 1, opts.min_window);
+        if (window_end > num_frames) {
+            window_start -= window_end - num_frames;
+            window_end = num_frames;
+            if (window_start < 0)
+                window_start = 0;
         }
-        const Vector <BaseFloat> *train_ivector = lid_model_->train_ivectors[key1];
-        const Vector <BaseFloat> *test_ivector = test_ivectors[utt];
-
-        Vector<double> train_ivector_dbl(*train_ivector),
-                test_ivector_dbl(*test_ivector);
-
-        int32 num_train_examples;
-        num_train_examples = lid_model_->num_utts[key1];
-
-        BaseFloat score = plda.LogLikelihoodRatio(train_ivector_dbl,
-                                                  num_train_examples,
-                                                  test_ivector_dbl);
-        sums += score;
-        sumsq += score * score;
-
-        scores_.insert(std::pair<std::string, BaseFloat>(key1, score));
-    }
-
-//    for (HashType::iterator iter = lid_model_->train_ivectors.begin();
-//         iter != lid_model_->train_ivectors.end(); ++iter)
-//        delete iter->second;
-    for (HashType::iterator iter = test_ivectors.begin();
-         iter != test_ivectors.end(); ++iter)
-        delete iter->second;
-}
-
-void KaldiRecognizer::Nnet3XvectorCompute(Matrix <BaseFloat> voiced_feat) {
-
-    std::string use_gpu = "no";
-    std::string cached_compiler_in;
-    std::string cached_compiler_out;
-    int32 chunk_size = 10000,
-            min_chunk_size = 25;
-    bool pad_input = true;
-    CachingOptimizingCompilerOptions compiler_config;
-    compiler_config.cache_capacity = 64;
-    lid_model_->opts_nnet3.acoustic_scale = 1.0;
-    CachingOptimizingCompiler compiler(lid_model_->lid_nnet, lid_model_->opts_nnet3.optimize_config, compiler_config);
-
-    int32 xvector_dim = lid_model_->lid_nnet.OutputDim("output");
-
-    int32 num_rows = voiced_feat.NumRows(),
-            feat_dim = voiced_feat.NumCols(),
-            this_chunk_size = chunk_size;
-    if (!pad_input && num_rows < min_chunk_size) {
-        KALDI_WARN << "Minimum chunk size of " << min_chunk_size
-                   << " is greater than the number of rows "
-                   << "in utterance: default";
-    } else if (num_rows < chunk_size) {
-        KALDI_LOG << "Chunk size of " << chunk_size << " is greater than "
-                  << "the number of rows in utterance: default"
-                  << ", using chunk size  of " << num_rows;
-        this_chunk_size = num_rows;
-    } else if (chunk_size == -1) {
-        this_chunk_size = num_rows;
-    }
-
-    int32 num_chunks = ceil(
-            num_rows / static_cast<BaseFloat>(this_chunk_size));
-    Vector <BaseFloat> xvector_avg(xvector_dim, kSetZero);
-    BaseFloat tot_weight = 0.0;
-    int32 num_utts = 0;
-    int64 frame_count = 0;
-    // Iterate over the feature chunks.
-    for (int32 chunk_indx = 0; chunk_indx < num_chunks; chunk_indx++) {
-        // If we're nearing the end of the input, we may need to shift the
-        // offset back so that we can get this_chunk_size frames of input to
-        // the nnet.
-        int32 offset = std::min(
-                this_chunk_size, num_rows - chunk_indx * this_chunk_size);
-        if (!pad_input && offset < min_chunk_size)
+
+        // The window moves by at most one frame on each side per step
+        if (last_window_start != -1 && window_start > last_window_start) {
+            const BaseFloat *frame = features.RowData(last_window_start);
+            for (int32 d = 0; d < dim; d++)
+                sum[d] -= frame[d];
+            if (opts.normalize_variance)
+                for (int32 d = 0; d < dim; d++)
+                    sumsq[d] -= static_cast<double>(frame[d]) * frame[d];
+        }
+        int32 add_begin = last_window_start == -1 ? window_start : last_window_end;
+        for (int32 r = add_begin; r < window_end; r++) {
+            const BaseFloat *frame = features.RowData(r);
+            for (int32 d = 0; d < dim; d++)
+                sum[d] += frame[d];
+            if (opts.normalize_variance)
+                for (int32 d = 0; d < dim; d++)
+                    sumsq[d] += static_cast<double>(frame[d]) * frame[d];
+        }
+        last_window_start = window_start;
+        last_window_end = window_end;
+        if (rows[next] != t)
             continue;
-        SubMatrix <BaseFloat> sub_features(
-                voiced_feat, chunk_indx * this_chunk_size, offset, 0, feat_dim);
-        Vector <BaseFloat> xvector;
-        tot_weight += offset;
-
-        // Pad input if the offset is less than the minimum chunk size
-        if (pad_input && offset < min_chunk_size) {
-            Matrix <BaseFloat> padded_features(min_chunk_size, feat_dim);
-            int32 left_context = (min_chunk_size - offset) / 2;
-            int32 right_context = min_chunk_size - offset - left_context;
-            for (int32 i = 0; i < left_context; i++) {
-                padded_features.Row(i).CopyFromVec(sub_features.Row(0));
-            }
-            for (int32 i = 0; i < right_context; i++) {
-                padded_features.Row(min_chunk_size - i - 1).CopyFromVec(sub_features.Row(offset - 1));
+
+        int32 window_frames = window_end - window_start;
+        const BaseFloat *frame = features.RowData(t);
+        BaseFloat *out = output->RowData(next++);
+        double mean_scale = -1.0 / window_frames;
+        // Kaldi has no variance of a single frame and outputs zeros
+        if (opts.normalize_variance && window_frames == 1) {
+            std::fill(out, out + dim, 0.0f);
+            continue;
+        }
+        for (int32 d = 0; d < dim; d++) {
+            double value = frame[d] + mean_scale * sum[d];
+            if (opts.normalize_variance) {
+                double variance = sumsq[d] / window_frames -
+                                  sum[d] * sum[d] / (static_cast<double>(window_frames) * window_frames);
+                value /= sqrt(std::max(variance, 1.0e-10));
             }
-            padded_features.Range(left_context, offset, 0, feat_dim).CopyFromMat(sub_features);
-            RunNnetComputation(padded_features, lid_model_->lid_nnet, &compiler, &xvector);
-        } else {
-            RunNnetComputation(sub_features, lid_model_->lid_nnet, &compiler, &xvector);
+            out[d] = static_cast<BaseFloat>(value);
         }
-        xvector_result = xvector;
-        xvector_avg.AddVec(offset, xvector);
     }
-
-    xvector_avg.Scale(1.0 / tot_weight);
-
-    frame_count += voiced_feat.NumRows();
-
-    if (num_utts % 10 == 0)
-        KALDI_LOG << "Processed " << num_utts << " utterances";
-    KALDI_VLOG(2) << "Processed features for key default";
+    KALDI_ASSERT(next == rows.size());
 }
 
 void KaldiRecognizer::AcceptWaveform(const char *data, int len)
@@ -252,236 +275,715 @@ void KaldiRecognizer::AcceptWaveform(const float *fdata, int len)
     AcceptWaveform(wave);
 }
 
+// G.711 bytes are decoded with a table lookup straight into the float buffer
+void KaldiRecognizer::AcceptWaveformUlaw(const unsigned char *data, int len)
+{
+    Vector<BaseFloat> wave;
+    wave.Resize(len, kUndefined);
+    BaseFloat *wave_data = wave.Data();
+    for (int i = 0; i < len; i++)
+        wave_data[i] = kUlawTable[data[i]];
+    AcceptWaveform(wave);
+}
+
+void KaldiRecognizer::AcceptWaveformAlaw(const unsigned char *data, int len)
+{
+    Vector<BaseFloat> wave;
+    wave.Resize(len, kUndefined);
+    BaseFloat *wave_data = wave.Data();
+    for (int i = 0; i < len; i++)
+        wave_data[i] = kAlawTable[data[i]];
+    AcceptWaveform(wave);
+}
+
 void KaldiRecognizer::AcceptWaveform(Vector<BaseFloat> &wdata)
 {
-    lid_feature_->AcceptWaveform(sample_frequency_, wdata);
+    AcceptWaveform(configured_frequency_, wdata);
 }
 
-int KaldiRecognizer::Calculate() {
-    frame_offset_ = 0;
+void KaldiRecognizer::AcceptAudio(Vector<BaseFloat> &wdata)
+{
+    audio_hasher_.Update(wdata);
+    if (!speech_gate_) {
+        AcceptFeatureAudio(wdata);
+        return;
+    }
 
-    int num_frames = lid_feature_->NumFramesReady() - frame_offset_ * 3;
-    Matrix <BaseFloat> features(num_frames, lid_feature_->Dim());
+    // Silence and noise never reach the resampler and the MFCC
+    int32 num_speech = speech_gate_->Process(sample_frequency_, wdata, &gate_buffer_);
+    int64 blocks, rejected;
+    speech_gate_->TakeCounts(&blocks, &rejected);
+    lid_model_->gate_blocks += blocks;
+    lid_model_->gate_rejected += rejected;
+    if (num_speech > 0)
+        AcceptFeatureAudio(SubVector<BaseFloat>(gate_buffer_, 0, num_speech));
+}
 
-    for (int i = 0; i < num_frames; ++i) {
-        Vector <BaseFloat> feat(lid_feature_->Dim());
-        lid_feature_->GetFrame(i + frame_offset_ * 3, &feat);
-        features.CopyRowFromVec(feat, i);
+void KaldiRecognizer::AcceptFeatureAudio(const VectorBase<BaseFloat> &wdata)
+{
+    if (resampler_) {
+        Vector<BaseFloat> resampled;
+        resampler_->Resample(wdata, false, &resampled);
+        lid_feature_->AcceptWaveform(resampler_->GetOutputSamplingRate(), resampled);
+        KeepFeatureTail(resampled);
+    } else {
+        lid_feature_->AcceptWaveform(sample_frequency_, wdata);
+        KeepFeatureTail(wdata);
+    }
+}
+
+// Snapshots need the samples of the frame in progress, which are always
+// less than a window, so only the last window is kept
+void KaldiRecognizer::KeepFeatureTail(const VectorBase<BaseFloat> &samples)
+{
+    int32 window = feature_tail_.Dim();
+    int32 num_samples = samples.Dim();
+    BaseFloat *tail = feature_tail_.Data();
+    feature_samples_ += num_samples;
+    if (num_samples >= window) {
+        memcpy(tail, samples.Data() + num_samples - window, window * sizeof(BaseFloat));
+        feature_tail_size_ = window;
+        return;
+    }
+    int32 keep = std::min(feature_tail_size_, window - num_samples);
+    memmove(tail, tail + feature_tail_size_ - keep, keep * sizeof(BaseFloat));
+    memcpy(tail + keep, samples.Data(), num_samples * sizeof(BaseFloat));
+    feature_tail_size_ = keep + num_samples;
+}
+
+bool KaldiRecognizer::AcceptWaveform(BaseFloat sample_frequency, Vector<BaseFloat> &wdata)
+{
+    // The resampler, the speech gate and the features hold audio of the
+    // current rate, so the rate only changes between utterances
+    if (sample_frequency != sample_frequency_) {
+        if (audio_hasher_.NumSamples() > 0) {
+            KALDI_WARN << "Audio at " << sample_frequency << " Hz in an utterance at "
+                       << sample_frequency_ << " Hz, reset the recognizer first";
+            return false;
+        }
+        SetSampleFrequency(sample_frequency);
+    }
+    AcceptAudio(wdata);
+    return true;
+}
+
+bool KaldiRecognizer::AcceptFile(const char *path)
+{
+    WaveFile wave_file;
+    if (!wave_file.Open(path))
+        return false;
+    if (wave_file.NumChannels() != 1)
+        KALDI_WARN << path << " has " << wave_file.NumChannels() << " channels, using the first one";
+
+    // Blocks small enough to stay in cache on the way to the features
+    Vector<BaseFloat> block;
+    for (int64 frame = 0; frame < wave_file.NumFrames(); frame += WAVE_BLOCK_SIZE) {
+        wave_file.Decode(frame, WAVE_BLOCK_SIZE, 0, &block);
+        if (!AcceptWaveform(wave_file.SampleFrequency(), block))
+            return false;
+    }
+    return true;
+}
+
+const char *KaldiRecognizer::RecognizeFiles(const char **paths, int num_paths)
+{
+    std::string results = "[";
+    for (int i = 0; i < num_paths; i++) {
+        Reset();
+        json::JSON file(paths[i]);
+        results += (i > 0 ? ",{\"file\":" : "{\"file\":") + file.dump() + ",\"result\":";
+        results += AcceptFile(paths[i]) ? LangResult() : "null";
+        results += "}";
+    }
+    results += "]";
+    Reset();
+    lang_result_.swap(results);
+    return lang_result_.c_str();
+}
+
+bool KaldiRecognizer::SetLanguages(const char *languages)
+{
+    std::vector<std::string> codes;
+    if (languages != NULL)
+        SplitStringToVector(languages, ", ", true, &codes);
+
+    std::vector<int32> allowed;
+    for (auto const &code : codes) {
+        int32 lang = lid_model_->LanguageIndex(code);
+        if (lang < 0) {
+            KALDI_WARN << "Language " << code << " is not supported by the model";
+            continue;
+        }
+        allowed.push_back(lang);
+    }
+    // An empty list means all languages, so it must not come from a typo
+    if (!codes.empty() && allowed.empty())
+        return false;
+    SortAndUniq(&allowed);
+    allowed_languages_.swap(allowed);
+    return true;
+}
+
+void KaldiRecognizer::SetMaxResults(int max_results)
+{
+    max_results_ = max_results;
+}
+
+void KaldiRecognizer::SetFrameBudget(int frame_budget)
+{
+    frame_budget_ = frame_budget < 0 ? lid_model_->frame_budget : frame_budget;
+}
+
+bool KaldiRecognizer::SetCascade(LidModel *large_model, BaseFloat margin)
+{
+    if (large_model && !lid_model_->CascadesWith(*large_model)) {
+        KALDI_WARN << "The cascade models differ in features or languages";
+        return false;
     }
+    if (large_model)
+        large_model->Ref();
+    if (cascade_model_)
+        cascade_model_->Unref();
+    cascade_model_ = large_model;
+    cascade_margin_ = margin;
+    return true;
+}
 
-    int32 compression_method_in = 1;
-    CompressionMethod compression_method = static_cast<CompressionMethod>(
-            compression_method_in);
-    Matrix <BaseFloat> compressedMatrix;
-    const CompressedMatrix &matrix = CompressedMatrix(features, compression_method);
-    compressedMatrix.Resize(matrix.NumRows(), matrix.NumCols());
-    matrix.CopyToMat(&compressedMatrix, kNoTrans);
+void KaldiRecognizer::SetSpeechGate(bool enabled)
+{
+    if (enabled == (speech_gate_ != NULL))
+        return;
+    delete speech_gate_;
+    speech_gate_ = enabled ? new SpeechGate(SpeechGateOptions()) : NULL;
+}
 
-    Matrix <BaseFloat> cmvn_feat(compressedMatrix.NumRows(),
-                                 compressedMatrix.NumCols(), kUndefined);
+void KaldiRecognizer::SetLanguageNames(bool language_names)
+{
+    language_names_ = language_names;
+}
 
-    SlidingWindowCmn(lid_model_->sliding_opts, compressedMatrix, &cmvn_feat);
+int KaldiRecognizer::GetXvector(float *xvector, int max_dim)
+{
+    int32 dim = xvector_result.Dim();
+    for (int32 i = 0; i < dim && i < max_dim; i++)
+        xvector[i] = xvector_result(i);
+    return dim;
+}
 
-    int32 num_done = 0, num_err = 0;
-    int32 num_unvoiced = 0;
-    double tot_length = 0.0, tot_decision = 0.0;
-    bool omit_unvoiced_utts = false;
+bool KaldiRecognizer::PrepareFeatures(Matrix<BaseFloat> *nnet_feat, int32 *chunk_size,
+                                      const Deadline *deadline) {
+    frame_offset_ = 0;
+    feature_bytes_copied_ = 0;
+    features_stopped_ = false;
+    xvector_result.Resize(0);
+    escalated_ = false;
+    scores_.clear();
 
-    Vector <BaseFloat> vad_result(compressedMatrix.NumRows());
+    // Repeated audio reuses the x-vector computed the first time. Cascades
+    // need the features for the large model, so they don't use the cache.
+    XvectorCache &cache = lid_model_->xvector_cache;
+    use_cache_ = cache.Enabled() && !cascade_model_;
+    if (use_cache_) {
+        cache_key_ = audio_hasher_.Key(static_cast<uint64>(sample_frequency_) ^
+                                       (static_cast<uint64>(frame_budget_) << 32) ^
+                                       (speech_gate_ ? 1ULL << 63 : 0));
+        if (cache.Lookup(cache_key_, &xvector_result))
+            return false;
+    }
 
-    ComputeVadEnergy(lid_model_->opts, compressedMatrix, &vad_result);
+    // Too few frames to find MIN_LANG_FEATS voiced ones, typically because
+    // the speech gate dropped the audio, so CMN and VAD are skipped
+    int num_restored = restored_feats_.NumRows();
+    int num_frames = lid_feature_->NumFramesReady() - frame_offset_ * 3;
+    if (num_restored + num_frames < MIN_LANG_FEATS) {
+        SetXvector(xvector_result);
+        return false;
+    }
+    // Every stage works on one feature matrix, and only the normalized
+    // voiced frames that go through the network are written to nnet_feat
+    Matrix<BaseFloat> features(num_restored + num_frames, lid_feature_->Dim(), kUndefined);
+    if (num_restored > 0)
+        features.RowRange(0, num_restored).CopyFromMat(restored_feats_);
+    for (int i = 0; i < num_frames; ++i) {
+        SubVector<BaseFloat> row(features, num_restored + i);
+        lid_feature_->GetFrame(i + frame_offset_ * 3, &row);
+    }
+    int64 frame_bytes = features.NumCols() * sizeof(BaseFloat);
+    feature_bytes_copied_ = features.NumRows() * frame_bytes;
+
+    // The network was trained on compressed features, so the frames get the
+    // same rounding, in place
+    CompressedMatrix(features, kAutomaticMethod).CopyToMat(&features);
+    feature_bytes_copied_ += features.NumRows() * frame_bytes;
+    if (deadline != NULL && deadline->Expired()) {
+        features_stopped_ = true;
+        return false;
+    }
+
+    Vector<BaseFloat> vad_result(features.NumRows(), kUndefined);
+    ComputeVadEnergy(lid_model_->opts, features, &vad_result);
+    if (deadline != NULL && deadline->Expired()) {
+        features_stopped_ = true;
+        return false;
+    }
 
-    double sum = vad_result.Sum();
-    if (sum == 0.0) {
+    std::vector<int32> rows;
+    rows.reserve(features.NumRows());
+    for (int32 i = 0; i < vad_result.Dim(); i++) {
+        if (vad_result(i) != 0.0) {
+            KALDI_ASSERT(vad_result(i) == 1.0); // should be zero or one.
+            rows.push_back(i);
+        }
+    }
+    if (rows.empty())
         KALDI_WARN << "No frames were judged voiced for utterance default";
-        num_unvoiced++;
+    if (rows.size() < MIN_LANG_FEATS) {
+        SetXvector(xvector_result);
+        return false;
+    }
+
+    // Long recordings only push the frame budget through the network
+    if (frame_budget_ > 0 && rows.size() > static_cast<size_t>(frame_budget_)) {
+        std::vector<int32> selected_rows;
+        SelectBudgetSegments(rows, frame_budget_, BUDGET_SEGMENT_SIZE, &selected_rows);
+        KALDI_VLOG(1) << "Using " << selected_rows.size() << " of "
+                      << rows.size() << " voiced frames";
+        rows.swap(selected_rows);
+        *chunk_size = std::min(BUDGET_SEGMENT_SIZE, frame_budget_);
     } else {
-        num_done++;
+        *chunk_size = XVECTOR_CHUNK_SIZE;
+    }
+    // The x-vector of shorter chunks differs from the one without a
+    // deadline, so it must not be cached for the audio
+    if (deadline != NULL && *chunk_size > DEADLINE_CHUNK_SIZE) {
+        *chunk_size = DEADLINE_CHUNK_SIZE;
+        if (rows.size() > DEADLINE_CHUNK_SIZE)
+            use_cache_ = false;
     }
-    tot_decision += vad_result.Sum();
-    tot_length += vad_result.Dim();
 
-    const Vector <BaseFloat> &voiced = vad_result;
+    nnet_feat->Resize(rows.size(), features.NumCols(), kUndefined);
+    SlidingWindowCmnRows(lid_model_->sliding_opts, features, rows, nnet_feat);
+    feature_bytes_copied_ += nnet_feat->NumRows() * frame_bytes;
+    features_stopped_ = deadline != NULL && deadline->Expired();
+    return !features_stopped_;
+}
 
-    if (cmvn_feat.NumRows() != voiced.Dim()) {
-        KALDI_WARN << "Mismatch in number for frames " << cmvn_feat.NumRows()
-                   << " for features and VAD " << voiced.Dim()
-                   << ", for utterance default ";
-        num_err++;
+int64 KaldiRecognizer::FeatureBytesCopied() const {
+    return feature_bytes_copied_;
+}
+
+void KaldiRecognizer::SetXvector(const VectorBase<BaseFloat> &xvector) {
+    xvector_result = xvector;
+    if (use_cache_)
+        lid_model_->xvector_cache.Insert(cache_key_, xvector_result);
+}
+
+void KaldiRecognizer::ComputeXvector() {
+
+    std::vector<XvectorInput> inputs(1);
+    Matrix<BaseFloat> nnet_feat;
+    if (PrepareFeatures(&nnet_feat, &inputs[0].chunk_size)) {
+        inputs[0].features = &nnet_feat;
+        // A cascade may need the features again for the large model
+        if (!cascade_model_)
+            inputs[0].movable_features = &nnet_feat;
+        lid_model_->ComputeXvectors(&inputs);
+        feature_bytes_copied_ += inputs[0].bytes_copied;
+        SetXvector(inputs[0].xvector);
+        if (NeedsEscalation()) {
+            cascade_model_->ComputeXvectors(&inputs);
+            feature_bytes_copied_ += inputs[0].bytes_copied;
+            SetEscalatedXvector(inputs[0].xvector);
+        }
     }
-    if (voiced.Sum() == 0.0) {
-        KALDI_WARN << "No features were judged as voiced for utterance default";
-        num_err++;
+}
+
+const char *KaldiRecognizer::LangResult() {
+
+    ComputeXvector();
+    return ScoredResult();
+}
+
+int KaldiRecognizer::LangScores(float *scores, int max_scores) {
+
+    ComputeXvector();
+    if (xvector_result.Dim() == 0)
+        return 0;
+
+    int num_languages = lid_model_->NumLanguages();
+    PldaScoring();
+    std::fill(scores, scores + std::min(num_languages, max_scores), -INFINITY);
+    for (auto const &score : scores_)
+        if (score.first < max_scores)
+            scores[score.first] = score.second;
+    scores_.clear();
+    return num_languages;
+}
+
+const char *KaldiRecognizer::LangResult(const Deadline &deadline, LidStatus *status) {
+
+    *status = kLidOk;
+    std::vector<XvectorInput> inputs(1);
+    Matrix<BaseFloat> nnet_feat;
+    if (deadline.Expired()) {
+        *status = deadline.Status();
+        xvector_result.Resize(0);
+    } else if (PrepareFeatures(&nnet_feat, &inputs[0].chunk_size, &deadline)) {
+        int32 num_rows = nnet_feat.NumRows();
+        inputs[0].features = &nnet_feat;
+        // A cascade may need the features again for the large model
+        if (!cascade_model_)
+            inputs[0].movable_features = &nnet_feat;
+        bool complete = lid_model_->ComputeXvectors(&inputs, &deadline);
+        if (!complete) {
+            *status = deadline.Status();
+            // A partial x-vector must not be returned for the whole audio later
+            use_cache_ = false;
+            KALDI_VLOG(1) << "Result stopped after " << inputs[0].frames_used << " of "
+                          << num_rows << " frames";
+        }
+        feature_bytes_copied_ += inputs[0].bytes_copied;
+        SetXvector(inputs[0].xvector);
+
+        // The large model only runs with time left, and if it doesn't finish
+        // the complete result of the small model stands
+        if (complete && NeedsEscalation()) {
+            if (deadline.Expired()) {
+                *status = deadline.Status();
+            } else {
+                bool escalated = cascade_model_->ComputeXvectors(&inputs, &deadline);
+                feature_bytes_copied_ += inputs[0].bytes_copied;
+                if (escalated)
+                    SetEscalatedXvector(inputs[0].xvector);
+                else
+                    *status = deadline.Status();
+            }
+        }
+    } else if (features_stopped_) {
+        // Not for too little speech, that result is complete
+        *status = deadline.Status();
     }
-    int32 dim = 0;
-    for (int32 i = 0; i < voiced.Dim(); i++)
-        if (voiced(i) != 0.0)
-            dim++;
+    return ScoredResult();
+}
+
+bool KaldiRecognizer::LangResultAsync(std::function<void(const char *)> done) {
 
-    if (dim < MIN_LANG_FEATS) {
-        return 1;
+    std::shared_ptr<AsyncState> state = async_;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->pending++;
     }
+    bool queued = lid_model_->TrySubmit([this, state, done] {
+        const char *result = NULL;
+        try {
+            result = LangResult();
+        } catch (const std::exception &e) {
+            KALDI_WARN << "Failed to compute the result: " << e.what();
+        }
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->callback_thread = std::this_thread::get_id();
+        }
+        // The recognizer may be gone after this, only the state is left
+        done(result);
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->callback_thread = std::thread::id();
+        state->pending--;
+        state->finished.notify_all();
+    });
+    if (!queued) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->pending--;
+    }
+    return queued;
+}
 
-    Matrix <BaseFloat> voiced_feat(dim, cmvn_feat.NumCols());
-    int32 index = 0;
-    for (int32 i = 0; i < cmvn_feat.NumRows(); i++) {
-        if (voiced(i) != 0.0) {
-            KALDI_ASSERT(voiced(i) == 1.0); // should be zero or one.
-            voiced_feat.Row(index).CopyFromVec(cmvn_feat.Row(i));
-            index++;
+void KaldiRecognizer::LangResults(KaldiRecognizer *const *recognizers, int num_recognizers,
+                                  const char **results) {
+
+    std::vector<Matrix<BaseFloat> > features(num_recognizers);
+    std::vector<XvectorInput> inputs;
+    std::vector<int> input_recognizers;
+    for (int r = 0; r < num_recognizers; r++) {
+        XvectorInput input;
+        if (recognizers[r]->PrepareFeatures(&features[r], &input.chunk_size)) {
+            input.features = &features[r];
+            if (!recognizers[r]->cascade_model_)
+                input.movable_features = &features[r];
+            inputs.push_back(input);
+            input_recognizers.push_back(r);
         }
     }
-    KALDI_ASSERT(index == dim);
 
-    Nnet3XvectorCompute(voiced_feat);
+    // One network pass per model for the recognizers that need an
+    // x-vector. Recognizers from a ModelStore may hold different
+    // generations of the model.
+    std::map<LidModel *, std::vector<size_t> > models;
+    for (size_t i = 0; i < inputs.size(); i++)
+        models[recognizers[input_recognizers[i]]->lid_model_].push_back(i);
+    for (auto const &model : models) {
+        std::vector<XvectorInput> model_inputs;
+        for (size_t i : model.second)
+            model_inputs.push_back(inputs[i]);
+        model.first->ComputeXvectors(&model_inputs);
+        for (size_t j = 0; j < model.second.size(); j++)
+            inputs[model.second[j]] = model_inputs[j];
+    }
+    for (size_t i = 0; i < inputs.size(); i++) {
+        KaldiRecognizer *recognizer = recognizers[input_recognizers[i]];
+        recognizer->feature_bytes_copied_ += inputs[i].bytes_copied;
+        recognizer->SetXvector(inputs[i].xvector);
+    }
 
-    PldaScoring();
+    // Uncertain results of cascades go through their large model together
+    std::map<LidModel *, std::vector<size_t> > escalations;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        KaldiRecognizer *recognizer = recognizers[input_recognizers[i]];
+        if (recognizer->NeedsEscalation())
+            escalations[recognizer->cascade_model_].push_back(i);
+    }
+    for (auto const &escalation : escalations) {
+        std::vector<XvectorInput> large_inputs;
+        for (size_t i : escalation.second)
+            large_inputs.push_back(inputs[i]);
+        escalation.first->ComputeXvectors(&large_inputs);
+        for (size_t j = 0; j < escalation.second.size(); j++) {
+            KaldiRecognizer *recognizer = recognizers[input_recognizers[escalation.second[j]]];
+            recognizer->feature_bytes_copied_ += large_inputs[j].bytes_copied;
+            recognizer->SetEscalatedXvector(large_inputs[j].xvector);
+        }
+    }
 
-    return 0;
+    for (int r = 0; r < num_recognizers; r++)
+        results[r] = recognizers[r]->ScoredResult();
 }
 
-const char *KaldiRecognizer::LangResult() {
+void KaldiRecognizer::LangResultBatch(KaldiRecognizer *const *recognizers, int num_recognizers,
+                                      const char **results) {
+
+    if (num_recognizers <= 0)
+        return;
+    std::shared_ptr<WorkerPool> pool = recognizers[0]->lid_model_->Workers();
+    int num_groups = std::min(num_recognizers, pool->NumThreads());
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    int remaining = num_groups;
+    for (int g = 0; g < num_groups; g++) {
+        int begin = static_cast<int64>(num_recognizers) * g / num_groups;
+        int end = static_cast<int64>(num_recognizers) * (g + 1) / num_groups;
+        pool->Submit([&, begin, end] {
+            try {
+                LangResults(recognizers + begin, end - begin, results + begin);
+            } catch (const std::exception &e) {
+                KALDI_WARN << "Failed to compute the results: " << e.what();
+                std::fill(results + begin, results + end, static_cast<const char *>(NULL));
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--remaining == 0)
+                finished.notify_one();
+        });
+    }
 
-    int res = Calculate();
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&] { return remaining == 0; });
+}
+
+const char *KaldiRecognizer::ScoredResult() {
 
-    if (res != 0) {
+    // A trusted cascade result already has the scores of the small model
+    if (xvector_result.Dim() != 0 && scores_.empty())
+        PldaScoring();
+    if (scores_.empty()) {
+        result_scores_.clear();
         lang_result_ = "[]";
         return lang_result_.c_str();
     }
+
+    // Only the best max_results_ scores are reported, best first. All of
+    // them keep the order by language code that results always had.
     using pair_type = decltype(scores_)::value_type;
-    auto pr = std::max_element
-    (
-        std::begin(scores_), std::end(scores_), [] (const pair_type & p1, const pair_type & p2) {
-            return p1.second < p2.second;
+    size_t num_results = scores_.size();
+    if (max_results_ > 0 && static_cast<size_t>(max_results_) < num_results)
+        num_results = max_results_;
+    std::partial_sort(scores_.begin(), scores_.begin() + num_results, scores_.end(),
+        [] (const pair_type & p1, const pair_type & p2) {
+            return p1.second > p2.second;
         }
     );
 
-    KALDI_LOG << "key " << GetLanguage(pr -> first) << " value " << pr -> second;
+    const char *best = lid_model_->languages[scores_[0].first].c_str();
+    const char *best_name = GetLanguageName(best);
+    KALDI_LOG << "key " << (best_name ? best_name : best) << " value " << scores_[0].second;
+    result_scores_.assign(scores_.begin(), scores_.begin() + num_results);
+    if (max_results_ == 0) {
+        const std::vector<std::string> &languages = lid_model_->languages;
+        std::sort(scores_.begin(), scores_.end(), [&languages] (const pair_type &p1, const pair_type &p2) {
+            return languages[p1.first] < languages[p2.first];
+        });
+    }
 
-    json::JSON obj;
-    for (auto const &x : scores_) {
+    json::JSON obj = json::Array();
+    for (size_t i = 0; i < num_results; i++) {
         json::JSON res;
-        res["language"] = x.first;
-        res["score"] = x.second;
+        const std::string &language = lid_model_->languages[scores_[i].first];
+        res["language"] = language;
+        if (language_names_) {
+            const char *name = GetLanguageName(language.c_str());
+            res["name"] = name ? name : language;
+        }
+        res["score"] = scores_[i].second;
         obj.append(res);
     }
 
     scores_.clear();
     lang_result_ = obj.dump();
     return lang_result_.c_str();
+}
 
+bool KaldiRecognizer::Snapshot(std::ostream &os) const {
+
+    const FrameExtractionOptions &frame_opts = lid_model_->mfcc_opts.frame_opts;
+    if (!frame_opts.snip_edges) {
+        KALDI_WARN << "Snapshots need features with snip-edges=true";
+        return false;
+    }
+
+    // The next frame starts after the shifts of the frames so far, the
+    // audio from there on is fed to the restored features again
+    int32 num_restored = restored_feats_.NumRows();
+    int32 num_frames = lid_feature_->NumFramesReady();
+    int64 tail_size = feature_samples_ - static_cast<int64>(num_frames) * frame_opts.WindowShift();
+    KALDI_ASSERT(tail_size >= 0 && tail_size <= feature_tail_size_);
+
+    Matrix<BaseFloat> features(num_restored + num_frames, lid_feature_->Dim(), kUndefined);
+    if (num_restored > 0)
+        features.RowRange(0, num_restored).CopyFromMat(restored_feats_);
+    for (int32 i = 0; i < num_frames; i++) {
+        SubVector<BaseFloat> row(features, num_restored + i);
+        lid_feature_->GetFrame(i, &row);
+    }
+    Vector<BaseFloat> tail(SubVector<BaseFloat>(feature_tail_, feature_tail_size_ - tail_size, tail_size));
+
+    bool binary = true;
+    WriteToken(os, binary, "<LidSnapshot>");
+    WriteToken(os, binary, "<Version>");
+    WriteBasicType(os, binary, static_cast<int32>(SNAPSHOT_VERSION));
+    WriteToken(os, binary, "<ModelFrequency>");
+    WriteBasicType(os, binary, frame_opts.samp_freq);
+    WriteToken(os, binary, "<SampleFrequency>");
+    WriteBasicType(os, binary, static_cast<BaseFloat>(sample_frequency_));
+    WriteToken(os, binary, "<MaxResults>");
+    WriteBasicType(os, binary, static_cast<int32>(max_results_));
+    WriteToken(os, binary, "<LanguageNames>");
+    WriteBasicType(os, binary, language_names_);
+    WriteToken(os, binary, "<FrameBudget>");
+    WriteBasicType(os, binary, frame_budget_);
+    // Language codes rather than indices, which belong to the model
+    WriteToken(os, binary, "<Languages>");
+    WriteBasicType(os, binary, static_cast<int32>(allowed_languages_.size()));
+    for (int32 lang : allowed_languages_)
+        WriteToken(os, binary, lid_model_->languages[lang]);
+    WriteToken(os, binary, "<Features>");
+    features.Write(os, binary);
+    WriteToken(os, binary, "<Tail>");
+    tail.Write(os, binary);
+    WriteToken(os, binary, "<Audio>");
+    audio_hasher_.Write(os, binary);
+    WriteToken(os, binary, "<SpeechGate>");
+    WriteBasicType(os, binary, speech_gate_ != NULL);
+    if (speech_gate_)
+        speech_gate_->Write(os, binary);
+    WriteToken(os, binary, "</LidSnapshot>");
+    return os.good();
+}
+
+const char *KaldiRecognizer::Snapshot(int *length) {
+
+    std::ostringstream os;
+    if (!Snapshot(os))
+        return NULL;
+    snapshot_ = os.str();
+    *length = snapshot_.size();
+    return snapshot_.data();
 }
 
-std::string KaldiRecognizer::GetLanguage(std::string lg) {
-    std::map<std::string,std::string> languages = {
-                {"ab","Abkhazian"},
-                {"af","Afrikaans"},
-                {"am","Amharic"},
-                {"ar","Arabic"},
-                {"as","Assamese"},
-                {"az","Azerbaijani"},
-                {"ba","Bashkir"},
-                {"be","Belarusian"},
-                {"bg","Bulgarian"},
-                {"bn","Bengali"},
-                {"bo","Tibetan"},
-                {"br","Breton"},
-                {"bs","Bosnian"},
-                {"ca","Catalan"},
-                {"ceb","Cebuano"},
-                {"cs","Czech"},
-                {"cy","Welsh"},
-                {"da","Danish"},
-                {"de","German"},
-                {"el","Greek"},
-                {"en","English"},
-                {"eo","Esperanto"},
-                {"es","Spanish"},
-                {"et","Estonian"},
-                {"eu","Basque"},
-                {"fa","Persian"},
-                {"fi","Finnish"},
-                {"fo","Faroese"},
-                {"fr","French"},
-                {"gl","Galician"},
-                {"gn","Guarani"},
-                {"gu","Gujarati"},
-                {"gv","Manx"},
-                {"ha","Hausa"},
-                {"haw","Hawaiian"},
-                {"hi","Hindi"},
-                {"hr","Croatian"},
-                {"ht","Haitian"},
-                {"hu","Hungarian"},
-                {"hy","Armenian"},
-                {"ia","Interlingua"},
-                {"id","Indonesian"},
-                {"is","Icelandic"},
-                {"it","Italian"},
-                {"iw","Hebrew"},
-                {"ja","Japanese"},
-                {"jw","Javanese"},
-                {"ka","Georgian"},
-                {"kk","Kazakh"},
-                {"km","Central Khmer"},
-                {"kn","Kannada"},
-                {"ko","Korean"},
-                {"la","Latin"},
-                {"lb","Luxembourgish"},
-                {"ln","Lingala"},
-                {"lo","Lao"},
-                {"lt","Lithuanian"},
-                {"lv","Latvian"},
-                {"mg","Malagasy"},
-                {"mi","Maori"},
-                {"mk","Macedonian"},
-                {"ml","Malayalam"},
-                {"mn","Mongolian"},
-                {"mr","Marathi"},
-                {"ms","Malay"},
-                {"mt","Maltese"},
-                {"my","Burmese"},
-                {"ne","Nepali"},
-                {"nl","Dutch"},
-                {"nn","Norwegian Nynorsk"},
-                {"no","Norwegian"},
-                {"oc","Occitan"},
-                {"pa","Panjabi"},
-                {"pl","Polish"},
-                {"ps","Pushto"},
-                {"pt","Portuguese"},
-                {"ro","Romanian"},
-                {"ru","Russian"},
-                {"sa","Sanskrit"},
-                {"sco","Scots"},
-                {"sd","Sindhi"},
-                {"si","Sinhala"},
-                {"sk","Slovak"},
-                {"sl","Slovenian"},
-                {"sn","Shona"},
-                {"so","Somali"},
-                {"sq","Albanian"},
-                {"sr","Serbian"},
-                {"su","Sundanese"},
-                {"sv","Swedish"},
-                {"sw","Swahili"},
-                {"ta","Tamil"},
-                {"te","Telugu"},
-                {"tg","Tajik"},
-                {"th","Thai"},
-                {"tk","Turkmen"},
-                {"tl","Tagalog"},
-                {"tr","Turkish"},
-                {"tt","Tatar"},
-                {"uk","Ukrainian"},
-                {"ur","Urdu"},
-                {"uz","Uzbek"},
-                {"vi","Vietnamese"},
-                {"war","Waray"},
-                {"yi","Yiddish"},
-                {"yo","Yoruba"},
-                {"zh","Chinese"}
-    };
-
-    return languages[lg];
-}
\ No newline at end of file
+bool KaldiRecognizer::Restore(std::istream &is) {
+
+    Reset();
+    BaseFloat model_frequency, sample_frequency;
+    int32 max_results, frame_budget;
+    bool language_names;
+    std::string languages;
+    Matrix<BaseFloat> features;
+    Vector<BaseFloat> tail;
+    AudioHasher audio_hasher;
+    bool speech_gate = speech_gate_ != NULL;
+    SpeechGate gate_state((SpeechGateOptions()));
+    try {
+        bool binary = true;
+        int32 version, num_languages;
+        ExpectToken(is, binary, "<LidSnapshot>");
+        ExpectToken(is, binary, "<Version>");
+        ReadBasicType(is, binary, &version);
+        // Version 1 snapshots are from before the speech gate
+        if (version < 1 || version > SNAPSHOT_VERSION)
+            KALDI_ERR << "Unsupported snapshot version " << version;
+        ExpectToken(is, binary, "<ModelFrequency>");
+        ReadBasicType(is, binary, &model_frequency);
+        if (model_frequency != lid_model_->mfcc_opts.frame_opts.samp_freq)
+            KALDI_ERR << "Snapshot of a model at " << model_frequency << " Hz";
+        ExpectToken(is, binary, "<SampleFrequency>");
+        ReadBasicType(is, binary, &sample_frequency);
+        ExpectToken(is, binary, "<MaxResults>");
+        ReadBasicType(is, binary, &max_results);
+        ExpectToken(is, binary, "<LanguageNames>");
+        ReadBasicType(is, binary, &language_names);
+        ExpectToken(is, binary, "<FrameBudget>");
+        ReadBasicType(is, binary, &frame_budget);
+        ExpectToken(is, binary, "<Languages>");
+        ReadBasicType(is, binary, &num_languages);
+        for (int32 i = 0; i < num_languages; i++) {
+            std::string code;
+            ReadToken(is, binary, &code);
+            languages += (i > 0 ? "," : "") + code;
+        }
+        ExpectToken(is, binary, "<Features>");
+        features.Read(is, binary);
+        if (features.NumRows() > 0 && features.NumCols() != lid_feature_->Dim())
+            KALDI_ERR << "Snapshot features of dimension " << features.NumCols();
+        ExpectToken(is, binary, "<Tail>");
+        tail.Read(is, binary);
+        if (tail.Dim() > feature_tail_.Dim())
+            KALDI_ERR << "Snapshot audio tail of " << tail.Dim() << " samples";
+        ExpectToken(is, binary, "<Audio>");
+        audio_hasher.Read(is, binary);
+        if (version >= 2) {
+            ExpectToken(is, binary, "<SpeechGate>");
+            ReadBasicType(is, binary, &speech_gate);
+            if (speech_gate)
+                gate_state.Read(is, binary);
+        }
+        ExpectToken(is, binary, "</LidSnapshot>");
+    } catch (const std::exception &e) {
+        KALDI_WARN << "Invalid snapshot: " << e.what();
+        Reset();
+        return false;
+    }
+
+    // The resampler starts over, which only affects the few samples of its
+    // filter history
+    SetSampleFrequency(sample_frequency);
+    configured_frequency_ = sample_frequency;
+    max_results_ = max_results;
+    language_names_ = language_names;
+    frame_budget_ = frame_budget;
+    SetLanguages(languages.c_str());
+    restored_feats_.Swap(&features);
+    lid_feature_->AcceptWaveform(model_frequency, tail);
+    KeepFeatureTail(tail);
+    audio_hasher_ = audio_hasher;
+    delete speech_gate_;
+    speech_gate_ = speech_gate ? new SpeechGate(gate_state) : NULL;
+    return true;
+}
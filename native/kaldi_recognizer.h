@@ -12,12 +12,16 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#ifndef KALDI_RECOGNIZER_H_
+#define KALDI_RECOGNIZER_H_
+
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
 #include "fstext/fstext-lib.h"
 #include "fstext/fstext-utils.h"
 #include "decoder/lattice-faster-decoder.h"
 #include "feat/feature-mfcc.h"
+#include "feat/resample.h"
 #include "lat/kaldi-lattice.h"
 #include "lat/word-align-lattice.h"
 #include "nnet3/am-nnet-simple.h"
@@ -25,6 +29,7 @@
 #include "nnet3/nnet-utils.h"
 
 #include "lid_model.h"
+#include "speech_gate.h"
 
 using namespace kaldi;
 
@@ -33,22 +38,154 @@ class KaldiRecognizer {
         KaldiRecognizer(LidModel *lid_model, float sample_frequency);
         ~KaldiRecognizer();
         const char* LangResult();
+        // Stops at the first expired check of the deadline, between the
+        // feature stages and between the network passes, with a result from the chunks
+        // computed so far ("[]" if none) and the reason in status. A cascade
+        // escalates only with time left, and keeps the small model's result
+        // if the large model doesn't finish in time.
+        const char* LangResult(const Deadline &deadline, LidStatus *status);
+        // Computes the result on the worker pool of the model and passes it
+        // to done on a worker thread, NULL if the computation failed. Returns
+        // false without queuing if the pool queue is full. The destructor
+        // waits for the result and its callback, unless done destroys the
+        // recognizer itself.
+        bool LangResultAsync(std::function<void(const char *)> done);
+
+        // Results of several recognizers on the calling thread, with one
+        // network pass for all of those sharing a model
+        static void LangResults(KaldiRecognizer *const *recognizers, int num_recognizers,
+                                const char **results);
+        // Like LangResults, but split into groups that run in parallel on the
+        // worker pool of the model. Blocks until all results are ready, so it
+        // must not be called from a worker thread. A failed group gets NULL
+        // results.
+        static void LangResultBatch(KaldiRecognizer *const *recognizers, int num_recognizers,
+                                    const char **results);
         void AcceptWaveform(const char *data, int len);
         void AcceptWaveform(const short *sdata, int len);
         void AcceptWaveform(const float *fdata, int len);
+        void AcceptWaveformUlaw(const unsigned char *data, int len);
+        void AcceptWaveformAlaw(const unsigned char *data, int len);
+        void AcceptWaveform(Vector<BaseFloat> &wdata);
+        // Audio at its own rate, for files. The rate can only change between
+        // utterances, so audio at another rate than the utterance so far is
+        // rejected with a warning and false.
+        bool AcceptWaveform(BaseFloat sample_frequency, Vector<BaseFloat> &wdata);
+        bool AcceptFile(const char *path);
+        const char *RecognizeFiles(const char **paths, int num_paths);
+        void Reset();
+        // Restricts scoring to the listed codes, NULL or an empty list for
+        // all languages. Returns false and keeps the previous list if none
+        // of the codes is known to the model.
+        bool SetLanguages(const char *languages);
+        void SetMaxResults(int max_results);
+        void SetLanguageNames(bool language_names);
+        void SetFrameBudget(int frame_budget);
+        // Overrides the speech gate setting of the model, see SpeechGate
+        void SetSpeechGate(bool enabled);
+        // Binds a large model that computes the result again from the same
+        // features when the PLDA margin between the two best languages of
+        // this model is below margin. NULL removes it. Returns false if the
+        // models don't share the features and languages.
+        bool SetCascade(LidModel *large_model, BaseFloat margin);
+        int GetXvector(float *xvector, int max_dim);
+        // Computes the result as scores indexed like the model languages,
+        // without formatting it. Languages excluded by SetLanguages get
+        // -infinity. Returns the number of languages, 0 for too little speech.
+        int LangScores(float *scores, int max_scores);
+
+        // The stages of LangResult, for callers that batch the network
+        // computation of several recognizers. PrepareFeatures returns true
+        // if nnet_feat has to be turned into an x-vector with chunks of
+        // chunk_size frames and passed to SetXvector, false if the x-vector
+        // is already known (from the cache, or empty for too little speech).
+        // ScoredResult then scores the x-vector and formats the result.
+        // With a deadline that expires on the way it returns false without
+        // an x-vector. With a deadline the chunks are at most 10 seconds of
+        // speech, so that the network pass can be stopped between them.
+        bool PrepareFeatures(Matrix<BaseFloat> *nnet_feat, int32 *chunk_size,
+                             const Deadline *deadline = NULL);
+        void SetXvector(const VectorBase<BaseFloat> &xvector);
+        const char *ScoredResult();
+        // (language index, score) pairs of the last result, best first, also
+        // when its JSON is ordered by language code
+        const std::vector<std::pair<int32, BaseFloat> > &ResultScores() const { return result_scores_; }
+        // Bytes of feature frames copied for the last result, from the MFCC
+        // frames to the network input
+        int64 FeatureBytesCopied() const;
+
+        // Writes what is needed to continue the stream elsewhere: the
+        // settings, the MFCC frames so far, the audio of the frame in
+        // progress, the speech gate state and the audio hash, in Kaldi
+        // binary format. Returns false if the feature framing can't be
+        // continued (snip-edges=false).
+        bool Snapshot(std::ostream &os) const;
+        // The snapshot as a buffer of length bytes, NULL on failure
+        const char *Snapshot(int *length);
+        // Replaces the whole state by a snapshot of a recognizer of the same
+        // model. Returns false with a warning and resets the recognizer if
+        // the snapshot is invalid.
+        bool Restore(std::istream &is);
 
     private:
+        void SetSampleFrequency(float sample_frequency);
+        // Passes audio at sample_frequency_ through the speech gate
+        void AcceptAudio(Vector<BaseFloat> &wdata);
+        // Passes audio at sample_frequency_ on to the features
+        void AcceptFeatureAudio(const VectorBase<BaseFloat> &wdata);
+        void KeepFeatureTail(const VectorBase<BaseFloat> &samples);
+        void ComputeXvector();
         void PldaScoring();
-        void Nnet3XvectorCompute(Matrix <BaseFloat> voiced_feat);
-        int Calculate();
+        // Scores the x-vector of the small model of a cascade and tells if
+        // the large model has to take over
+        bool NeedsEscalation();
+        void SetEscalatedXvector(const VectorBase<BaseFloat> &xvector);
         LidModel *lid_model_;
         OnlineBaseFeature *lid_feature_;
-        std::string GetLanguage(std::string lg);
-        void AcceptWaveform(Vector<BaseFloat> &wdata);
-        std::map<std::string, BaseFloat> scores_;
+        std::vector<std::pair<int32, BaseFloat> > scores_;
+        std::vector<std::pair<int32, BaseFloat> > result_scores_;
+        std::vector<int32> allowed_languages_;
+        int max_results_;
+        bool language_names_;
+        int32 frame_budget_;
+        // Rate of the audio so far, and the rate of the recognizer that
+        // audio without a rate of its own has
         float sample_frequency_;
+        float configured_frequency_;
+        LinearResample *resampler_;
         int32 frame_offset_;
         string lang_result_;
         Vector <BaseFloat> voiced;
         Vector <BaseFloat> xvector_result;
+        AudioHasher audio_hasher_;
+        bool use_cache_;
+        uint64 cache_key_;
+        int64 feature_bytes_copied_;
+        // PrepareFeatures stopped at the deadline, not for lack of speech
+        bool features_stopped_;
+        // Frames of a restored snapshot, followed by those of lid_feature_
+        Matrix<BaseFloat> restored_feats_;
+        // The last feature_tail_size_ samples given to lid_feature_, at most
+        // a window, and the number of samples given since it was created
+        Vector<BaseFloat> feature_tail_;
+        int32 feature_tail_size_;
+        int64 feature_samples_;
+        string snapshot_;
+        // NULL unless the gate is enabled
+        SpeechGate *speech_gate_;
+        Vector<BaseFloat> gate_buffer_;
+        LidModel *cascade_model_;
+        BaseFloat cascade_margin_;
+        // The x-vector is from cascade_model_
+        bool escalated_;
+        struct AsyncState;
+        std::shared_ptr<AsyncState> async_;
 };
+
+// SlidingWindowCmn of Kaldi for the given rows of features only, written in
+// their order to output, which must have one row for each. The rows must
+// be ascending.
+void SlidingWindowCmnRows(const SlidingWindowCmnOptions &opts, const MatrixBase<BaseFloat> &features,
+                          const std::vector<int32> &rows, MatrixBase<BaseFloat> *output);
+
+#endif /* KALDI_RECOGNIZER_H_ */
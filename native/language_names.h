@@ -0,0 +1,173 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef LANGUAGE_NAMES_H_
+#define LANGUAGE_NAMES_H_
+
+#include <cstddef>
+#include <cstring>
+
+struct LanguageName {
+    const char *code;
+    const char *name;
+};
+
+// Sorted by code so that lookups can use binary search, checked below
+static constexpr LanguageName kLanguageNames[] = {
+    {"ab", "Abkhazian"},
+    {"af", "Afrikaans"},
+    {"am", "Amharic"},
+    {"ar", "Arabic"},
+    {"as", "Assamese"},
+    {"az", "Azerbaijani"},
+    {"ba", "Bashkir"},
+    {"be", "Belarusian"},
+    {"bg", "Bulgarian"},
+    {"bn", "Bengali"},
+    {"bo", "Tibetan"},
+    {"br", "Breton"},
+    {"bs", "Bosnian"},
+    {"ca", "Catalan"},
+    {"ceb", "Cebuano"},
+    {"cs", "Czech"},
+    {"cy", "Welsh"},
+    {"da", "Danish"},
+    {"de", "German"},
+    {"el", "Greek"},
+    {"en", "English"},
+    {"eo", "Esperanto"},
+    {"es", "Spanish"},
+    {"et", "Estonian"},
+    {"eu", "Basque"},
+    {"fa", "Persian"},
+    {"fi", "Finnish"},
+    {"fo", "Faroese"},
+    {"fr", "French"},
+    {"gl", "Galician"},
+    {"gn", "Guarani"},
+    {"gu", "Gujarati"},
+    {"gv", "Manx"},
+    {"ha", "Hausa"},
+    {"haw", "Hawaiian"},
+    {"hi", "Hindi"},
+    {"hr", "Croatian"},
+    {"ht", "Haitian"},
+    {"hu", "Hungarian"},
+    {"hy", "Armenian"},
+    {"ia", "Interlingua"},
+    {"id", "Indonesian"},
+    {"is", "Icelandic"},
+    {"it", "Italian"},
+    {"iw", "Hebrew"},
+    {"ja", "Japanese"},
+    {"jw", "Javanese"},
+    {"ka", "Georgian"},
+    {"kk", "Kazakh"},
+    {"km", "Central Khmer"},
+    {"kn", "Kannada"},
+    {"ko", "Korean"},
+    {"la", "Latin"},
+    {"lb", "Luxembourgish"},
+    {"ln", "Lingala"},
+    {"lo", "Lao"},
+    {"lt", "Lithuanian"},
+    {"lv", "Latvian"},
+    {"mg", "Malagasy"},
+    {"mi", "Maori"},
+    {"mk", "Macedonian"},
+    {"ml", "Malayalam"},
+    {"mn", "Mongolian"},
+    {"mr", "Marathi"},
+    {"ms", "Malay"},
+    {"mt", "Maltese"},
+    {"my", "Burmese"},
+    {"ne", "Nepali"},
+    {"nl", "Dutch"},
+    {"nn", "Norwegian Nynorsk"},
+    {"no", "Norwegian"},
+    {"oc", "Occitan"},
+    {"pa", "Panjabi"},
+    {"pl", "Polish"},
+    {"ps", "Pushto"},
+    {"pt", "Portuguese"},
+    {"ro", "Romanian"},
+    {"ru", "Russian"},
+    {"sa", "Sanskrit"},
+    {"sco", "Scots"},
+    {"sd", "Sindhi"},
+    {"si", "Sinhala"},
+    {"sk", "Slovak"},
+    {"sl", "Slovenian"},
+    {"sn", "Shona"},
+    {"so", "Somali"},
+    {"sq", "Albanian"},
+    {"sr", "Serbian"},
+    {"su", "Sundanese"},
+    {"sv", "Swedish"},
+    {"sw", "Swahili"},
+    {"ta", "Tamil"},
+    {"te", "Telugu"},
+    {"tg", "Tajik"},
+    {"th", "Thai"},
+    {"tk", "Turkmen"},
+    {"tl", "Tagalog"},
+    {"tr", "Turkish"},
+    {"tt", "Tatar"},
+    {"uk", "Ukrainian"},
+    {"ur", "Urdu"},
+    {"uz", "Uzbek"},
+    {"vi", "Vietnamese"},
+    {"war", "Waray"},
+    {"yi", "Yiddish"},
+    {"yo", "Yoruba"},
+    {"zh", "Chinese"},
+};
+
+static constexpr size_t kNumLanguageNames = sizeof(kLanguageNames) / sizeof(kLanguageNames[0]);
+
+static constexpr int CompareLanguageCodes(const char *a, const char *b) {
+    while (*a != '\0' && *a == *b) {
+        a++;
+        b++;
+    }
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+static constexpr bool LanguageNamesSorted() {
+    for (size_t i = 1; i < kNumLanguageNames; i++) {
+        if (CompareLanguageCodes(kLanguageNames[i - 1].code, kLanguageNames[i].code) >= 0)
+            return false;
+    }
+    return true;
+}
+
+static_assert(LanguageNamesSorted(), "kLanguageNames must be sorted by code");
+
+// Returns the English name of the language code or NULL if it is unknown
+inline const char *GetLanguageName(const char *code) {
+    size_t lo = 0, hi = kNumLanguageNames;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int cmp = std::strcmp(kLanguageNames[mid].code, code);
+        if (cmp == 0)
+            return kLanguageNames[mid].name;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+#endif /* LANGUAGE_NAMES_H_ */
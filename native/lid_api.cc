@@ -14,7 +14,13 @@
 
 #include "lid_api.h"
 #include "kaldi_recognizer.h"
+#include "multi_recognizer.h"
+#include "model_store.h"
 #include "lid_model.h"
+#include "language_names.h"
+#include "cpu_affinity.h"
+
+#include <sstream>
 
 #include <string.h>
 
@@ -30,6 +36,105 @@ void l2m_lid_model_free(L2mLidModel *model)
     ((LidModel *)model)->Unref();
 }
 
+int l2m_lid_model_num_languages(L2mLidModel *model)
+{
+    return ((LidModel *)model)->NumLanguages();
+}
+
+const char *l2m_lid_model_language(L2mLidModel *model, int index)
+{
+    LidModel *lid_model = (LidModel *)model;
+    if (index < 0 || index >= lid_model->NumLanguages())
+        return NULL;
+    return lid_model->Language(index).c_str();
+}
+
+int l2m_lid_model_xvector_dim(L2mLidModel *model)
+{
+    return ((LidModel *)model)->XvectorDim();
+}
+
+int l2m_lid_model_score_xvector(L2mLidModel *model, const float *xvector, int dim,
+                                float *scores, int num_scores)
+{
+    LidModel *lid_model = (LidModel *)model;
+    if (dim != lid_model->XvectorDim())
+        return -1;
+
+    Vector<BaseFloat> vec(dim, kUndefined);
+    for (int i = 0; i < dim; i++)
+        vec(i) = xvector[i];
+    std::vector<std::pair<int32, BaseFloat> > lang_scores;
+    lid_model->ScoreXvector(vec, std::vector<int32>(), &lang_scores);
+    for (auto const &x : lang_scores) {
+        if (x.first < num_scores)
+            scores[x.first] = x.second;
+    }
+    return lang_scores.size();
+}
+
+void l2m_lid_model_set_cache_size(L2mLidModel *model, long long max_bytes)
+{
+    ((LidModel *)model)->SetCacheSize(max_bytes > 0 ? max_bytes : 0);
+}
+
+void l2m_lid_model_get_cache_stats(L2mLidModel *model, long long *hits, long long *misses, long long *bytes)
+{
+    int64 cache_hits, cache_misses, cache_bytes;
+    ((LidModel *)model)->GetCacheStats(&cache_hits, &cache_misses, &cache_bytes);
+    if (hits)
+        *hits = cache_hits;
+    if (misses)
+        *misses = cache_misses;
+    if (bytes)
+        *bytes = cache_bytes;
+}
+
+void l2m_lid_model_get_cascade_stats(L2mLidModel *model, long long *requests, long long *escalations)
+{
+    int64 cascade_requests, cascade_escalations;
+    ((LidModel *)model)->GetCascadeStats(&cascade_requests, &cascade_escalations);
+    if (requests)
+        *requests = cascade_requests;
+    if (escalations)
+        *escalations = cascade_escalations;
+}
+
+void l2m_lid_model_set_worker_affinity(L2mLidModel *model, L2mAffinity affinity)
+{
+    ((LidModel *)model)->SetWorkerAffinity(static_cast<LidAffinity>(affinity));
+}
+
+void l2m_lid_model_set_speech_gate(L2mLidModel *model, int enabled)
+{
+    ((LidModel *)model)->SetSpeechGate(enabled != 0);
+}
+
+void l2m_lid_model_get_speech_gate_stats(L2mLidModel *model, long long *blocks, long long *rejected)
+{
+    int64 gate_blocks, gate_rejected;
+    ((LidModel *)model)->GetSpeechGateStats(&gate_blocks, &gate_rejected);
+    if (blocks)
+        *blocks = gate_blocks;
+    if (rejected)
+        *rejected = gate_rejected;
+}
+
+void l2m_lid_model_set_workers(L2mLidModel *model, int num_threads, int queue_size)
+{
+    ((LidModel *)model)->SetWorkers(num_threads, queue_size);
+}
+
+int l2m_lid_model_set_frame_subsampling(L2mLidModel *model, int factor)
+{
+    return ((LidModel *)model)->SetFrameSubsampling(factor) ? 0 : -1;
+}
+
+void l2m_lid_model_set_frame_budget(L2mLidModel *model, int max_frames)
+{
+    ((LidModel *)model)->SetFrameBudget(max_frames > 0 ? max_frames : 0);
+}
+
 L2mRecognizer *l2m_recognizer_new_lid(L2mLidModel *lid_model, float sample_rate)
 {
     return (L2mRecognizer *)new KaldiRecognizer((LidModel *)lid_model, sample_rate);
@@ -50,17 +155,217 @@ void l2m_recognizer_accept_waveform_f(L2mRecognizer *recognizer, const float *da
     ((KaldiRecognizer *)(recognizer))->AcceptWaveform(data, length);
 }
 
+void l2m_recognizer_accept_waveform_ulaw(L2mRecognizer *recognizer, const char *data, int length)
+{
+    ((KaldiRecognizer *)(recognizer))->AcceptWaveformUlaw((const unsigned char *)data, length);
+}
+
+void l2m_recognizer_accept_waveform_alaw(L2mRecognizer *recognizer, const char *data, int length)
+{
+    ((KaldiRecognizer *)(recognizer))->AcceptWaveformAlaw((const unsigned char *)data, length);
+}
+
+int l2m_recognizer_accept_file(L2mRecognizer *recognizer, const char *path)
+{
+    return ((KaldiRecognizer *)(recognizer))->AcceptFile(path) ? 0 : -1;
+}
+
+const char *l2m_recognizer_recognize_files(L2mRecognizer *recognizer, const char **paths, int num_paths)
+{
+    return ((KaldiRecognizer *)(recognizer))->RecognizeFiles(paths, num_paths);
+}
+
+void l2m_recognizer_reset(L2mRecognizer *recognizer)
+{
+    ((KaldiRecognizer *)(recognizer))->Reset();
+}
+
+int l2m_recognizer_set_languages(L2mRecognizer *recognizer, const char *languages)
+{
+    return ((KaldiRecognizer *)(recognizer))->SetLanguages(languages) ? 0 : -1;
+}
+
+void l2m_recognizer_set_max_results(L2mRecognizer *recognizer, int max_results)
+{
+    ((KaldiRecognizer *)(recognizer))->SetMaxResults(max_results);
+}
+
+void l2m_recognizer_set_frame_budget(L2mRecognizer *recognizer, int max_frames)
+{
+    ((KaldiRecognizer *)(recognizer))->SetFrameBudget(max_frames);
+}
+
+void l2m_recognizer_set_speech_gate(L2mRecognizer *recognizer, int enabled)
+{
+    ((KaldiRecognizer *)(recognizer))->SetSpeechGate(enabled != 0);
+}
+
+int l2m_recognizer_set_cascade(L2mRecognizer *recognizer, L2mLidModel *large_model, float margin)
+{
+    return ((KaldiRecognizer *)(recognizer))->SetCascade((LidModel *)large_model, margin) ? 0 : -1;
+}
+
+void l2m_recognizer_set_language_names(L2mRecognizer *recognizer, int language_names)
+{
+    ((KaldiRecognizer *)(recognizer))->SetLanguageNames(language_names != 0);
+}
+
 const char *l2m_recognizer_lang_result(L2mRecognizer *recognizer)
 {
     return ((KaldiRecognizer *)recognizer)->LangResult();
 }
 
+const char *l2m_recognizer_lang_result_deadline(L2mRecognizer *recognizer, int timeout_ms,
+                                                const int *cancel, L2mStatus *status)
+{
+    Deadline deadline(timeout_ms, cancel);
+    LidStatus lid_status;
+    const char *result = ((KaldiRecognizer *)recognizer)->LangResult(deadline, &lid_status);
+    if (status)
+        *status = static_cast<L2mStatus>(lid_status);
+    return result;
+}
+
+int l2m_recognizer_lang_scores(L2mRecognizer *recognizer, float *scores, int max_scores)
+{
+    return ((KaldiRecognizer *)recognizer)->LangScores(scores, max_scores);
+}
+
+L2mStatus l2m_recognizer_lang_result_async(L2mRecognizer *recognizer,
+                                           L2mResultCallback callback, void *user_data)
+{
+    bool queued = ((KaldiRecognizer *)recognizer)->LangResultAsync([callback, user_data] (const char *result) {
+        callback(user_data, result);
+    });
+    return queued ? L2M_STATUS_OK : L2M_STATUS_BUSY;
+}
+
+void l2m_recognizer_lang_result_batch(L2mRecognizer **recognizers, int num_recognizers,
+                                      const char **results)
+{
+    KaldiRecognizer::LangResultBatch((KaldiRecognizer *const *)recognizers, num_recognizers, results);
+}
+
+int l2m_recognizer_get_xvector(L2mRecognizer *recognizer, float *xvector, int max_dim)
+{
+    return ((KaldiRecognizer *)recognizer)->GetXvector(xvector, max_dim);
+}
+
+const char *l2m_recognizer_snapshot(L2mRecognizer *recognizer, int *length)
+{
+    return ((KaldiRecognizer *)recognizer)->Snapshot(length);
+}
+
+int l2m_recognizer_restore(L2mRecognizer *recognizer, const char *data, int length)
+{
+    std::istringstream is(std::string(data, length));
+    return ((KaldiRecognizer *)recognizer)->Restore(is) ? 0 : -1;
+}
+
 void l2m_recognizer_free(L2mRecognizer *recognizer)
 {
     delete (KaldiRecognizer *)(recognizer);
 }
 
+L2mMultiRecognizer *l2m_multi_recognizer_new(L2mLidModel *lid_model, float sample_rate, int num_channels)
+{
+    if (num_channels < 1)
+        return NULL;
+    return (L2mMultiRecognizer *)new MultiChannelRecognizer((LidModel *)lid_model, sample_rate, num_channels);
+}
+
+void l2m_multi_recognizer_accept_waveform(L2mMultiRecognizer *recognizer, const char *data, int length)
+{
+    ((MultiChannelRecognizer *)(recognizer))->AcceptWaveform(data, length);
+}
+
+void l2m_multi_recognizer_accept_waveform_s(L2mMultiRecognizer *recognizer, const short *data, int length)
+{
+    ((MultiChannelRecognizer *)(recognizer))->AcceptWaveform(data, length);
+}
+
+void l2m_multi_recognizer_accept_waveform_f(L2mMultiRecognizer *recognizer, const float *data, int length)
+{
+    ((MultiChannelRecognizer *)(recognizer))->AcceptWaveform(data, length);
+}
+
+int l2m_multi_recognizer_accept_file(L2mMultiRecognizer *recognizer, const char *path)
+{
+    return ((MultiChannelRecognizer *)(recognizer))->AcceptFile(path) ? 0 : -1;
+}
+
+L2mRecognizer *l2m_multi_recognizer_channel(L2mMultiRecognizer *recognizer, int channel)
+{
+    MultiChannelRecognizer *multi = (MultiChannelRecognizer *)recognizer;
+    if (channel < 0 || channel >= multi->NumChannels())
+        return NULL;
+    return (L2mRecognizer *)multi->Channel(channel);
+}
+
+const char *l2m_multi_recognizer_lang_result(L2mMultiRecognizer *recognizer)
+{
+    return ((MultiChannelRecognizer *)recognizer)->LangResult();
+}
+
+void l2m_multi_recognizer_free(L2mMultiRecognizer *recognizer)
+{
+    delete (MultiChannelRecognizer *)(recognizer);
+}
+
+L2mModelStore *l2m_model_store_new(L2mLidModel *model)
+{
+    return (L2mModelStore *)new ModelStore((LidModel *)model);
+}
+
+L2mLidModel *l2m_model_store_acquire(L2mModelStore *store)
+{
+    return (L2mLidModel *)((ModelStore *)store)->Acquire();
+}
+
+L2mRecognizer *l2m_model_store_new_recognizer(L2mModelStore *store, float sample_rate)
+{
+    LidModel *model = ((ModelStore *)store)->Acquire();
+    KaldiRecognizer *recognizer = new KaldiRecognizer(model, sample_rate);
+    model->Unref();
+    return (L2mRecognizer *)recognizer;
+}
+
+int l2m_model_store_load(L2mModelStore *store, const char *model_path)
+{
+    return ((ModelStore *)store)->Load(model_path) ? 0 : -1;
+}
+
+L2mStatus l2m_model_store_load_async(L2mModelStore *store, const char *model_path,
+                                     L2mLoadCallback callback, void *user_data)
+{
+    bool started = ((ModelStore *)store)->LoadAsync(model_path, [callback, user_data] (bool loaded) {
+        if (callback)
+            callback(user_data, loaded ? 1 : 0);
+    });
+    return started ? L2M_STATUS_OK : L2M_STATUS_BUSY;
+}
+
+long long l2m_model_store_generation(L2mModelStore *store)
+{
+    return ((ModelStore *)store)->Generation();
+}
+
+void l2m_model_store_free(L2mModelStore *store)
+{
+    delete (ModelStore *)store;
+}
+
 void lid_set_log_level(int log_level)
 {
     SetVerboseLevel(log_level);
-}
\ No newline at end of file
+}
+
+int l2m_set_blas_threads(int num_threads)
+{
+    return SetBlasThreads(num_threads);
+}
+
+const char *l2m_language_name(const char *code)
+{
+    return GetLanguageName(code);
+}
@@ -7,17 +7,290 @@ extern "C" {
 
 typedef struct L2mLidModel L2mLidModel;
 typedef struct L2mRecognizer L2mRecognizer;
+typedef struct L2mMultiRecognizer L2mMultiRecognizer;
+typedef struct L2mModelStore L2mModelStore;
+
+/** Status of a result computation that can be cut short */
+typedef enum L2mStatus {
+    L2M_STATUS_OK = 0,
+    /** The timeout expired, the result covers only part of the audio */
+    L2M_STATUS_DEADLINE_EXCEEDED = 1,
+    /** The cancel flag was set, the result covers only part of the audio */
+    L2M_STATUS_CANCELLED = 2,
+    /** The worker queue is full, the request was not accepted */
+    L2M_STATUS_BUSY = 3
+} L2mStatus;
+
+/** Placement of the worker threads of a model */
+typedef enum L2mAffinity {
+    /** Threads run wherever the system puts them */
+    L2M_AFFINITY_NONE = 0,
+    /** Every thread is pinned to one CPU */
+    L2M_AFFINITY_CORES = 1,
+    /** Threads are spread over the NUMA nodes and pinned to the CPUs of
+     *  their node, which gets its own copy of the network */
+    L2M_AFFINITY_NUMA = 2
+} L2mAffinity;
+
+/** Receives an asynchronous result on a worker thread. The result string is
+ *  only valid during the call and is NULL if the computation failed. */
+typedef void (*L2mResultCallback)(void *user_data, const char *result);
+
+/** Receives the outcome of a background model load, 1 if the new model
+ *  was published and 0 if loading failed and the old model stays */
+typedef void (*L2mLoadCallback)(void *user_data, int success);
 
 L2mLidModel *l2m_lid_model_new(const char *model_path);
+/** Releases the reference of the caller. Recognizers hold their own
+ *  reference, so the model is freed after the last of them too. */
 void l2m_lid_model_free(L2mLidModel *model);
 
+/** Number of languages the model scores, language indices are 0..n-1 */
+int l2m_lid_model_num_languages(L2mLidModel *model);
+
+/** Language code of the language index, NULL if out of range */
+const char *l2m_lid_model_language(L2mLidModel *model, int index);
+
+/** Dimension of the x-vectors produced by the model */
+int l2m_lid_model_xvector_dim(L2mLidModel *model);
+
+/** Scores a stored x-vector against all languages of the model. scores
+ *  receives up to num_scores values in language index order. Returns the
+ *  number of languages or -1 if dim does not match the model. The model is
+ *  not modified, so this can be called from several threads at once. */
+int l2m_lid_model_score_xvector(L2mLidModel *model, const float *xvector, int dim,
+                                float *scores, int num_scores);
+
+/** Enables a shared LRU cache of x-vectors keyed by a hash of the accepted
+ *  audio, so repeated recordings skip feature extraction and the network.
+ *  max_bytes limits the cache memory, 0 disables it and drops all entries. */
+void l2m_lid_model_set_cache_size(L2mLidModel *model, long long max_bytes);
+
+/** Reports cache lookups that were hits and misses and the memory used */
+void l2m_lid_model_get_cache_stats(L2mLidModel *model, long long *hits, long long *misses, long long *bytes);
+
+/** Reports how many results of cascades with this model as the small one
+ *  were computed and how many of them needed the large model */
+void l2m_lid_model_get_cascade_stats(L2mLidModel *model, long long *requests, long long *escalations);
+
+/** Sets the worker threads (0 for one per core) and the queue length (0 for
+ *  four requests per thread) of the pool running asynchronous requests.
+ *  Requests already queued finish on the old pool. */
+void l2m_lid_model_set_workers(L2mLidModel *model, int num_threads, int queue_size);
+
+/** Pins the worker threads of the model, see L2mAffinity. With pinning, 0
+ *  threads in l2m_lid_model_set_workers means one per usable CPU. Requests
+ *  already queued finish on the old pool. */
+void l2m_lid_model_set_worker_affinity(L2mLidModel *model, L2mAffinity affinity);
+
+/** Enables a cheap gate for recognizers created afterwards that drops 10 ms
+ *  blocks of raw audio with a low level, a noise-like zero-crossing rate or
+ *  the energy in telephone signalling tones (DTMF, dial, ringback, busy)
+ *  before any features are computed, so silence, hiss, line noise and tones
+ *  cost almost nothing. Off by default. */
+void l2m_lid_model_set_speech_gate(L2mLidModel *model, int enabled);
+
+/** Reports the blocks seen by the speech gates of all recognizers of the
+ *  model and how many of them were dropped */
+void l2m_lid_model_get_speech_gate_stats(L2mLidModel *model, long long *blocks, long long *rejected);
+
+/** Caps the number of voiced frames (10 ms each) that go through the network
+ *  for recognizers created afterwards. Longer recordings use evenly spread
+ *  segments of speech that fit into the budget. 0 means no limit.
+ *  Every segment is a chunk of its own for the network, and the x-vector
+ *  is the length-weighted average of all chunks. Earlier versions used the
+ *  x-vector of the last chunk only, so scores of recordings longer than
+ *  one chunk (10000 frames, or one segment with a budget) have changed. */
+void l2m_lid_model_set_frame_budget(L2mLidModel *model, int max_frames);
+
+/** Runs the network at the frame rate divided by factor, which is faster
+ *  but less accurate. Only the frames read by the statistics pooling of
+ *  the x-vector network, and what their context needs, are evaluated.
+ *  Must be called before the first result of the model. Returns -1 if
+ *  the model was already used or the factor is below 1. */
+int l2m_lid_model_set_frame_subsampling(L2mLidModel *model, int factor);
+
+/** Creates a recognizer for audio at sample_rate. Audio that does not match
+ *  the model rate (8 kHz for the released models) is resampled internally. */
 L2mRecognizer *l2m_recognizer_new_lid(L2mLidModel *lid_model, float sample_rate);
 void l2m_recognizer_accept_waveform(L2mRecognizer *recognizer, const char *data, int length);
 void l2m_recognizer_accept_waveform_s(L2mRecognizer *recognizer, const short *data, int length);
 void l2m_recognizer_accept_waveform_f(L2mRecognizer *recognizer, const float *data, int length);
+
+/** Accepts G.711 mu-law or A-law encoded audio, one byte per sample */
+void l2m_recognizer_accept_waveform_ulaw(L2mRecognizer *recognizer, const char *data, int length);
+void l2m_recognizer_accept_waveform_alaw(L2mRecognizer *recognizer, const char *data, int length);
+
+/** Reads a RIFF/WAVE file through a memory mapping and streams its audio
+ *  into the recognizer. PCM16, float32, A-law and mu-law data are supported
+ *  at any sample rate. The rate applies to this utterance only, audio at
+ *  another rate needs l2m_recognizer_reset first. Returns 0 on success, -1
+ *  if the file can not be read or its rate differs from the audio so far. */
+int l2m_recognizer_accept_file(L2mRecognizer *recognizer, const char *path);
+
+/** Recognizes each file separately with the settings of the recognizer and
+ *  returns a JSON array of {"file": path, "result": [...]} objects, the
+ *  result is null for files that can not be read. The recognizer is reset
+ *  before and after every file. */
+const char *l2m_recognizer_recognize_files(L2mRecognizer *recognizer, const char **paths, int num_paths);
+
+/** Drops all accepted audio so that the recognizer can be reused */
+void l2m_recognizer_reset(L2mRecognizer *recognizer);
+
+/** Restricts scoring to a comma or space separated list of language codes,
+ *  for example "en,ru,de". Unknown codes are ignored, NULL or an empty
+ *  list scores all languages of the model. Returns -1 and keeps the
+ *  previous list if none of the codes is known, 0 otherwise. */
+int l2m_recognizer_set_languages(L2mRecognizer *recognizer, const char *languages);
+
+/** Returns only the max_results best languages, ordered by descending
+ *  score. 0, the default, returns all languages ordered by language code,
+ *  as results always were. */
+void l2m_recognizer_set_max_results(L2mRecognizer *recognizer, int max_results);
+
+/** Overrides the frame budget of the model for this recognizer, 0 means no
+ *  limit and -1 restores the model default */
+void l2m_recognizer_set_frame_budget(L2mRecognizer *recognizer, int max_frames);
+
+/** Makes the recognizer a cascade of its model and large_model. The large
+ *  model computes the result again from the same features only when the
+ *  PLDA score margin between the two best languages of the recognizer
+ *  model is below margin. The x-vector cache is not used by cascades.
+ *  NULL removes the large model. Returns 0 on success and -1 if the models
+ *  differ in features or languages. */
+int l2m_recognizer_set_cascade(L2mRecognizer *recognizer, L2mLidModel *large_model, float margin);
+
+/** Overrides the speech gate setting of the model for this recognizer */
+void l2m_recognizer_set_speech_gate(L2mRecognizer *recognizer, int enabled);
+
+/** Adds the English language name to every result entry as "name" */
+void l2m_recognizer_set_language_names(L2mRecognizer *recognizer, int language_names);
+
 const char *l2m_recognizer_lang_result(L2mRecognizer *recognizer);
+
+/** Like l2m_recognizer_lang_result, but gives up once timeout_ms
+ *  milliseconds have passed (no limit if negative) or once *cancel becomes
+ *  non-zero (cancel may be NULL and may be set from another thread). The
+ *  check happens between the feature stages and between network passes of
+ *  up to 10 seconds of speech. For that the speech is cut into chunks of 10
+ *  seconds instead of 100, so results of longer speech can differ slightly
+ *  from l2m_recognizer_lang_result. An interrupted call returns the result
+ *  of the speech processed so far, "[]" if none, and the reason in *status.
+ *  Too little speech is a complete result with L2M_STATUS_OK.
+ *  A cascade that runs out of time in the large model returns the result
+ *  of the small one. */
+const char *l2m_recognizer_lang_result_deadline(L2mRecognizer *recognizer, int timeout_ms,
+                                                const int *cancel, L2mStatus *status);
+
+/** Computes the result as raw scores instead of JSON. scores[i] receives
+ *  the score of language i of l2m_lid_model_language, -infinity for
+ *  languages excluded by l2m_recognizer_set_languages. Returns the number
+ *  of languages, or 0 if there was too little speech. */
+int l2m_recognizer_lang_scores(L2mRecognizer *recognizer, float *scores, int max_scores);
+
+/** Queues the result computation on the worker pool of the model and
+ *  returns immediately. The callback gets the result on a worker thread;
+ *  the recognizer must not be used until then, except that
+ *  l2m_recognizer_free waits for the callback to return, and may be called
+ *  from the callback itself. Returns L2M_STATUS_BUSY
+ *  without queuing if the pool queue is full, so that callers can shed
+ *  load or retry later. */
+L2mStatus l2m_recognizer_lang_result_async(L2mRecognizer *recognizer,
+                                           L2mResultCallback callback, void *user_data);
+
+/** Computes the results of several recognizers at once, in parallel on
+ *  the worker pool of the first one with one network pass per worker and
+ *  model. Recognizers of different models, like generations of a model
+ *  store, may be mixed. Blocks
+ *  until results[i] holds the result of recognizers[i] (NULL on failure),
+ *  valid until that recognizer is used again. Must not be called from a
+ *  result callback. */
+void l2m_recognizer_lang_result_batch(L2mRecognizer **recognizers, int num_recognizers,
+                                      const char **results);
+
+/** Copies up to max_dim values of the x-vector computed by the last
+ *  l2m_recognizer_lang_result call. Returns the x-vector dimension or 0 if
+ *  the last result had too little speech to compute one. */
+int l2m_recognizer_get_xvector(L2mRecognizer *recognizer, float *xvector, int max_dim);
+
+/** Serializes the stream state so that another recognizer of the same model,
+ *  also in another process, continues the stream with l2m_recognizer_restore
+ *  without the audio so far. The state holds the settings and the feature
+ *  frames, about 10 KB per second of audio. Returns a buffer of *length
+ *  bytes valid until the next call, NULL if the features of the model can
+ *  not be continued. */
+const char *l2m_recognizer_snapshot(L2mRecognizer *recognizer, int *length);
+
+/** Replaces the state of the recognizer by a snapshot. Returns 0 on success
+ *  and -1 if the snapshot is invalid or of a model with other features, in
+ *  which case the recognizer is reset. */
+int l2m_recognizer_restore(L2mRecognizer *recognizer, const char *data, int length);
+
 void l2m_recognizer_free(L2mRecognizer *recognizer);
+/** Creates a recognizer for interleaved audio with num_channels channels,
+ *  for example stereo call recordings. Every channel gets its own result.
+ *  Returns NULL if num_channels is less than 1. */
+L2mMultiRecognizer *l2m_multi_recognizer_new(L2mLidModel *lid_model, float sample_rate, int num_channels);
+
+/** Accept interleaved audio, length counts bytes, shorts or floats over all
+ *  channels like for the single channel functions. A buffer may end in the
+ *  middle of a frame, the next one continues it. */
+void l2m_multi_recognizer_accept_waveform(L2mMultiRecognizer *recognizer, const char *data, int length);
+void l2m_multi_recognizer_accept_waveform_s(L2mMultiRecognizer *recognizer, const short *data, int length);
+void l2m_multi_recognizer_accept_waveform_f(L2mMultiRecognizer *recognizer, const float *data, int length);
+
+/** Reads a WAVE file with the same number of channels, see l2m_recognizer_accept_file */
+int l2m_multi_recognizer_accept_file(L2mMultiRecognizer *recognizer, const char *path);
+
+/** The recognizer of one channel, owned by the multi-channel recognizer. Use
+ *  it to change per channel settings or read the channel x-vector. */
+L2mRecognizer *l2m_multi_recognizer_channel(L2mMultiRecognizer *recognizer, int channel);
+
+/** Returns a JSON array with the result of every channel, in channel order.
+ *  The x-vectors of all channels are computed in one network pass. */
+const char *l2m_multi_recognizer_lang_result(L2mMultiRecognizer *recognizer);
+void l2m_multi_recognizer_free(L2mMultiRecognizer *recognizer);
+
+/** Creates a store that serves the model to new recognizers and can
+ *  replace it while they run. The store takes over the model reference. */
+L2mModelStore *l2m_model_store_new(L2mLidModel *model);
+
+/** Returns the current model with a new reference, to be released with
+ *  l2m_lid_model_free */
+L2mLidModel *l2m_model_store_acquire(L2mModelStore *store);
+
+/** Creates a recognizer for the current model of the store */
+L2mRecognizer *l2m_model_store_new_recognizer(L2mModelStore *store, float sample_rate);
+
+/** Loads the model at model_path on the calling thread and publishes it for
+ *  new recognizers, with the settings of the current model. Existing
+ *  recognizers keep the model they were created with. Returns 0 on success
+ *  and -1 if loading failed, in which case the current model stays. */
+int l2m_model_store_load(L2mModelStore *store, const char *model_path);
+
+/** Like l2m_model_store_load, but loads on a background thread and calls
+ *  callback (may be NULL) when done. Returns L2M_STATUS_BUSY if a load is
+ *  already running. */
+L2mStatus l2m_model_store_load_async(L2mModelStore *store, const char *model_path,
+                                     L2mLoadCallback callback, void *user_data);
+
+/** Number of models published by the store, 1 before the first reload */
+long long l2m_model_store_generation(L2mModelStore *store);
+
+/** Waits for a running load and releases the store reference of the
+ *  current model. Must not be called from the load callback. */
+void l2m_model_store_free(L2mModelStore *store);
+
 void lid_set_log_level(int log_level);
+
+/** Sets the threads OpenBLAS uses for a single matrix operation in the
+ *  whole process. Requests already run in parallel on the worker threads,
+ *  so 1 avoids oversubscribing the CPUs. Returns the previous count, 0 if
+ *  the library was built without OpenBLAS. */
+int l2m_set_blas_threads(int num_threads);
+
+/** Returns the English name of an ISO 639 language code, NULL if unknown */
+const char *l2m_language_name(const char *code);
 #ifdef __cplusplus
 }
 #endif
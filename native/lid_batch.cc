@@ -0,0 +1,387 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Batch language identification of many files. Every file goes through a
+// pipeline of stages connected by bounded queues, each stage with its own
+// threads, so that reading, feature extraction and the network overlap:
+//
+//   read + decode + MFCC -> CMN + VAD -> x-vector network -> scoring + output
+//
+// The network stage groups up to --batch-size files into one computation.
+// All stages share a single model.
+
+#include "kaldi_recognizer.h"
+#include "lid_model.h"
+#include "wave_file.h"
+#include "bounded_queue.h"
+#include "json.h"
+
+#include <atomic>
+#include <ctime>
+#include <fstream>
+#include <thread>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define WAVE_BLOCK_SIZE 4096
+
+struct BatchOptions {
+    int32 io_threads;
+    int32 feature_threads;
+    int32 nnet_threads;
+    int32 batch_size;
+    int32 queue_size;
+    int32 max_results;
+    int32 frame_budget;
+    bool language_names;
+    std::string languages;
+
+    BatchOptions() : io_threads(2), feature_threads(1), nnet_threads(0),
+                     batch_size(8), queue_size(16), max_results(0),
+                     frame_budget(-1), language_names(false) {}
+
+    void Register(ParseOptions *po) {
+        po->Register("io-threads", &io_threads, "Threads reading and decoding files into MFCC features");
+        po->Register("feature-threads", &feature_threads, "Threads applying CMN and VAD");
+        po->Register("nnet-threads", &nnet_threads, "Threads running the x-vector network, 0 for the remaining cores");
+        po->Register("batch-size", &batch_size, "Maximum number of files in one network computation");
+        po->Register("queue-size", &queue_size, "Capacity of the queues between the stages");
+        po->Register("max-results", &max_results, "Number of languages in each result, 0 for all");
+        po->Register("frame-budget", &frame_budget, "Maximum number of frames through the network per file, 0 for no limit, -1 for the model default");
+        po->Register("language-names", &language_names, "Add the language names to the results");
+        po->Register("languages", &languages, "Comma separated codes of the languages to consider, empty for all");
+    }
+};
+
+// One file on its way through the pipeline
+struct BatchJob {
+    std::string path;
+    KaldiRecognizer *recognizer;
+    Matrix<BaseFloat> features;
+    int32 chunk_size;
+    bool needs_xvector;
+    bool failed;
+    double duration;
+    double decode_time;
+    double feature_time;
+    double nnet_time;
+    double score_time;
+    Timer timer;
+
+    BatchJob() : recognizer(NULL), chunk_size(0), needs_xvector(false), failed(false),
+                 duration(0), decode_time(0), feature_time(0), nnet_time(0), score_time(0) {}
+    ~BatchJob() { delete recognizer; }
+};
+
+typedef BoundedQueue<BatchJob *> JobQueue;
+
+static bool HasWaveExtension(const std::string &name)
+{
+    if (name.size() < 4)
+        return false;
+    std::string ext = name.substr(name.size() - 4);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == ".wav";
+}
+
+// Collects the .wav files below a directory, sorted for a stable order
+static void ListWaveFiles(const std::string &dir, std::vector<std::string> *paths)
+{
+    DIR *d = opendir(dir.c_str());
+    if (!d) {
+        KALDI_WARN << "Can't open directory " << dir;
+        return;
+    }
+    std::vector<std::string> entries;
+    for (struct dirent *entry = readdir(d); entry != NULL; entry = readdir(d)) {
+        std::string name = entry->d_name;
+        if (name != "." && name != "..")
+            entries.push_back(name);
+    }
+    closedir(d);
+    std::sort(entries.begin(), entries.end());
+
+    for (auto const &name : entries) {
+        std::string path = dir + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            ListWaveFiles(path, paths);
+        else if (HasWaveExtension(name))
+            paths->push_back(path);
+    }
+}
+
+// The input is either a directory or a list with one path per line,
+// "-" reads the list from the standard input
+static void ReadInputPaths(const std::string &input, std::vector<std::string> *paths)
+{
+    struct stat st;
+    if (input != "-" && stat(input.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+        ListWaveFiles(input, paths);
+        return;
+    }
+
+    std::ifstream list_file;
+    if (input != "-") {
+        list_file.open(input.c_str());
+        if (!list_file)
+            KALDI_ERR << "Can't open file list " << input;
+    }
+    std::istream &list = input == "-" ? std::cin : list_file;
+    std::string line;
+    while (std::getline(list, line)) {
+        Trim(&line);
+        if (!line.empty())
+            paths->push_back(line);
+    }
+}
+
+static void ReadStage(LidModel *model, const BatchOptions &opts,
+                      const std::vector<std::string> &paths, std::atomic<size_t> *next_path,
+                      JobQueue *output)
+{
+    for (size_t i = (*next_path)++; i < paths.size(); i = (*next_path)++) {
+        BatchJob *job = new BatchJob();
+        job->path = paths[i];
+        job->recognizer = new KaldiRecognizer(model, model->SampleFrequency());
+        job->recognizer->SetMaxResults(opts.max_results);
+        job->recognizer->SetLanguageNames(opts.language_names);
+        job->recognizer->SetFrameBudget(opts.frame_budget);
+        if (!opts.languages.empty())
+            job->recognizer->SetLanguages(opts.languages.c_str());
+
+        // A file that makes Kaldi throw fails on its own, the run goes on
+        WaveFile wave_file;
+        if (wave_file.Open(job->path.c_str())) {
+            if (wave_file.NumChannels() != 1)
+                KALDI_WARN << job->path << " has " << wave_file.NumChannels() << " channels, using the first one";
+            try {
+                Vector<BaseFloat> block;
+                for (int64 frame = 0; frame < wave_file.NumFrames(); frame += WAVE_BLOCK_SIZE) {
+                    wave_file.Decode(frame, WAVE_BLOCK_SIZE, 0, &block);
+                    job->recognizer->AcceptWaveform(wave_file.SampleFrequency(), block);
+                }
+                job->duration = wave_file.NumFrames() / wave_file.SampleFrequency();
+            } catch (const std::exception &e) {
+                KALDI_WARN << "Failed to read " << job->path << ": " << e.what();
+                job->failed = true;
+            }
+        } else {
+            job->failed = true;
+        }
+        job->decode_time = job->timer.Elapsed();
+        output->Push(job);
+    }
+}
+
+static void FeatureStage(JobQueue *input, JobQueue *output)
+{
+    BatchJob *job;
+    while (input->Pop(&job)) {
+        if (!job->failed) {
+            double start = job->timer.Elapsed();
+            try {
+                job->needs_xvector = job->recognizer->PrepareFeatures(&job->features, &job->chunk_size);
+            } catch (const std::exception &e) {
+                KALDI_WARN << "Failed to compute the features of " << job->path << ": " << e.what();
+                job->failed = true;
+            }
+            job->feature_time = job->timer.Elapsed() - start;
+        }
+        output->Push(job);
+    }
+}
+
+static void NnetStage(LidModel *model, int32 batch_size, JobQueue *input, JobQueue *output)
+{
+    BatchJob *job;
+    while (input->Pop(&job)) {
+        // Whatever is already waiting joins the batch, we never wait for more
+        std::vector<BatchJob *> batch(1, job);
+        while (batch.size() < static_cast<size_t>(batch_size) && input->TryPop(&job))
+            batch.push_back(job);
+
+        std::vector<XvectorInput> inputs;
+        std::vector<BatchJob *> computed;
+        for (auto *b : batch) {
+            if (b->failed || !b->needs_xvector)
+                continue;
+            XvectorInput xvector_input;
+            xvector_input.features = &b->features;
+            xvector_input.movable_features = &b->features;
+            xvector_input.chunk_size = b->chunk_size;
+            inputs.push_back(xvector_input);
+            computed.push_back(b);
+        }
+
+        if (!inputs.empty()) {
+            Timer timer;
+            bool computed_ok = true;
+            try {
+                model->ComputeXvectors(&inputs);
+            } catch (const std::exception &e) {
+                KALDI_WARN << "Failed to compute the x-vectors of " << computed.size() << " files: " << e.what();
+                computed_ok = false;
+            }
+            double elapsed = timer.Elapsed();
+            for (size_t i = 0; i < computed.size(); i++) {
+                if (computed_ok)
+                    computed[i]->recognizer->SetXvector(inputs[i].xvector);
+                computed[i]->failed = !computed_ok;
+                computed[i]->features.Resize(0, 0);
+                computed[i]->nnet_time = elapsed;
+            }
+        }
+
+        for (auto *b : batch)
+            output->Push(b);
+    }
+}
+
+static void JoinAll(std::vector<std::thread> *threads)
+{
+    for (auto &thread : *threads)
+        thread.join();
+    threads->clear();
+}
+
+int main(int argc, char *argv[])
+{
+    const char *usage =
+        "Identifies the language of many audio files with a pipelined thread pool.\n"
+        "Writes one JSON line per file with the result and the time spent in\n"
+        "each stage, and prints the throughput at the end.\n"
+        "\n"
+        "Usage: lid-batch [options] <model-dir> <wav-dir|file-list|-> [<output>]\n"
+        "e.g.: lid-batch --nnet-threads=4 model wavs results.jsonl\n";
+
+    ParseOptions po(usage);
+    BatchOptions opts;
+    opts.Register(&po);
+    po.Read(argc, argv);
+
+    if (po.NumArgs() < 2 || po.NumArgs() > 3) {
+        po.PrintUsage();
+        return 1;
+    }
+
+    std::string model_dir = po.GetArg(1);
+    std::string input = po.GetArg(2);
+    std::string output_path = po.GetOptArg(3);
+
+    int32 cores = std::max<int32>(std::thread::hardware_concurrency(), 1);
+    if (opts.nnet_threads <= 0)
+        opts.nnet_threads = std::max(cores - opts.io_threads - opts.feature_threads, 1);
+    opts.io_threads = std::max(opts.io_threads, 1);
+    opts.feature_threads = std::max(opts.feature_threads, 1);
+    opts.batch_size = std::max(opts.batch_size, 1);
+    opts.queue_size = std::max(opts.queue_size, 1);
+
+    std::vector<std::string> paths;
+    ReadInputPaths(input, &paths);
+    if (paths.empty()) {
+        KALDI_WARN << "No files to process in " << input;
+        return 1;
+    }
+
+    std::ofstream output_file;
+    if (!output_path.empty() && output_path != "-") {
+        output_file.open(output_path.c_str());
+        if (!output_file)
+            KALDI_ERR << "Can't open " << output_path << " for writing";
+    }
+    std::ostream &output = output_file.is_open() ? output_file : std::cout;
+
+    LidModel *model = new LidModel(model_dir.c_str());
+    if (!opts.languages.empty()) {
+        KaldiRecognizer recognizer(model, model->SampleFrequency());
+        if (!recognizer.SetLanguages(opts.languages.c_str()))
+            KALDI_ERR << "None of the languages " << opts.languages << " is supported by the model";
+    }
+
+    Timer wall_timer;
+    std::clock_t cpu_start = std::clock();
+
+    JobQueue decoded(opts.queue_size);
+    JobQueue prepared(opts.queue_size * opts.batch_size);
+    JobQueue scored(opts.queue_size);
+    std::atomic<size_t> next_path(0);
+
+    std::vector<std::thread> readers, featurers, nnets;
+    for (int32 i = 0; i < opts.io_threads; i++)
+        readers.emplace_back(ReadStage, model, std::cref(opts), std::cref(paths), &next_path, &decoded);
+    for (int32 i = 0; i < opts.feature_threads; i++)
+        featurers.emplace_back(FeatureStage, &decoded, &prepared);
+    for (int32 i = 0; i < opts.nnet_threads; i++)
+        nnets.emplace_back(NnetStage, model, opts.batch_size, &prepared, &scored);
+
+    // Each queue is closed once every thread feeding it is done
+    std::thread closer([&] {
+        JoinAll(&readers);
+        decoded.Close();
+        JoinAll(&featurers);
+        prepared.Close();
+        JoinAll(&nnets);
+        scored.Close();
+    });
+
+    // Scoring is cheap, so the writer does it and keeps the output in one thread
+    int32 num_done = 0, num_failed = 0;
+    double total_duration = 0;
+    BatchJob *job;
+    while (scored.Pop(&job)) {
+        double start = job->timer.Elapsed();
+        const char *result = "null";
+        if (!job->failed) {
+            try {
+                result = job->recognizer->ScoredResult();
+            } catch (const std::exception &e) {
+                KALDI_WARN << "Failed to score " << job->path << ": " << e.what();
+                job->failed = true;
+            }
+        }
+        job->score_time = job->timer.Elapsed() - start;
+
+        char timing[256];
+        snprintf(timing, sizeof(timing),
+                 ",\"duration\":%.3f,\"decode\":%.4f,\"features\":%.4f,\"nnet\":%.4f,\"score\":%.4f,\"latency\":%.4f}",
+                 job->duration, job->decode_time, job->feature_time, job->nnet_time,
+                 job->score_time, job->timer.Elapsed());
+        output << "{\"file\":" << json::JSON(job->path).dump() << ",\"result\":" << result << timing << "\n";
+
+        num_done++;
+        if (job->failed)
+            num_failed++;
+        total_duration += job->duration;
+        delete job;
+    }
+    closer.join();
+    output.flush();
+
+    double wall_time = wall_timer.Elapsed();
+    double cpu_time = static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+    fprintf(stderr, "Processed %d files (%d failed), %.1f s of audio in %.2f s with %d/%d/%d threads\n",
+            num_done, num_failed, total_duration, wall_time,
+            opts.io_threads, opts.feature_threads, opts.nnet_threads);
+    fprintf(stderr, "%.2f files/s, RTF %.5f, CPU RTF %.5f\n",
+            num_done / wall_time,
+            total_duration > 0 ? wall_time / total_duration : 0.0,
+            total_duration > 0 ? cpu_time / total_duration : 0.0);
+
+    model->Unref();
+    return num_failed == num_done ? 1 : 0;
+}
@@ -0,0 +1,742 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks of every stage of the pipeline and of the whole recognizer.
+// Each benchmark is written as one JSON line so that runs can be collected
+// and compared over time.
+
+#include "kaldi_recognizer.h"
+#include "lid_model.h"
+#include "cpu_affinity.h"
+#include "wave_file.h"
+#include "json.h"
+
+#include <condition_variable>
+#include <ctime>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#define XVECTOR_CHUNK_SIZE 10000
+
+class LidBench {
+public:
+    LidBench(LidModel *model, BaseFloat min_time, int32 min_iterations)
+        : model_(model), min_time_(min_time), min_iterations_(min_iterations) {}
+
+    void WriteHeader(const std::string &model_dir, int32 blas_threads) const;
+    void BenchFeatures(BaseFloat seconds);
+    void BenchXvector(BaseFloat seconds);
+    void BenchScoring();
+    // Time from the MFCC frames to the network input and the bytes of
+    // feature frames copied on the way, also as copies of the MFCC matrix
+    void BenchFeatureCopies(BaseFloat seconds);
+    void BenchSynthetic(BaseFloat seconds, BaseFloat sample_frequency);
+    void BenchFile(const std::string &path);
+    // The whole recognizer with the speech gate off and on, for noise alone
+    // and for the synthetic speech between stretches of noise
+    void BenchSpeechGate(BaseFloat seconds);
+    // CPU per request of the model alone, large_model alone and cascades of
+    // both at each margin, with the share of requests that escalated
+    void BenchCascade(LidModel *large_model, const std::vector<BaseFloat> &margins,
+                      const std::vector<std::string> &paths);
+    // Two 10 second requests per worker thread on the worker pool of the
+    // model at each thread count, with the workers placed by affinity.
+    // Perfect scaling keeps the iteration time and halves the rtf for twice
+    // the threads.
+    void BenchScaling(LidAffinity affinity, const std::vector<int32> &thread_counts);
+    // Accuracy against speed of the model loaded again with each frame
+    // subsampling factor, over (language, wav file) pairs. The language may
+    // be empty, then only the agreement with the best language found at the
+    // first factor is reported.
+    void BenchFrameSubsampling(const std::string &model_dir, const std::vector<int32> &factors,
+                               const std::vector<std::pair<std::string, std::string> > &references);
+
+private:
+    // Runs fn until both min_iterations_ and min_time_ are reached, after one
+    // warmup call, and writes the statistics of the iteration times
+    template <typename F>
+    void Measure(const std::string &name, const std::string &param,
+                 double audio_seconds, F fn);
+
+    // Voiced harmonic signal with a syllable-like envelope, short pauses and
+    // some noise, at the level of 16-bit audio. Deterministic for a length.
+    void SyntheticAudio(BaseFloat seconds, BaseFloat sample_frequency,
+                        Vector<BaseFloat> *audio) const;
+    // White noise with an RMS level of level_db, which is hiss for the gate
+    void NoiseAudio(BaseFloat seconds, BaseFloat sample_frequency, BaseFloat level_db,
+                    Vector<BaseFloat> *audio) const;
+    // Loud telephone signalling: cycles of on_ms of the tone pairs in turn,
+    // one pair per cycle, followed by off_ms of silence
+    void ToneAudio(BaseFloat seconds, BaseFloat sample_frequency,
+                   const std::vector<std::pair<BaseFloat, BaseFloat> > &pairs,
+                   int32 on_ms, int32 off_ms, Vector<BaseFloat> *audio) const;
+    void ComputeMfcc(const VectorBase<BaseFloat> &audio, Matrix<BaseFloat> *features) const;
+
+    LidModel *model_;
+    BaseFloat min_time_;
+    int32 min_iterations_;
+};
+
+static std::string DurationParam(BaseFloat seconds)
+{
+    char param[32];
+    snprintf(param, sizeof(param), "%gs", seconds);
+    return param;
+}
+
+template <typename F>
+void LidBench::Measure(const std::string &name, const std::string &param,
+                       double audio_seconds, F fn)
+{
+    fn();
+
+    std::vector<double> times;
+    Timer total;
+    std::clock_t cpu_start = std::clock();
+    while (times.size() < static_cast<size_t>(min_iterations_) || total.Elapsed() < min_time_) {
+        Timer timer;
+        fn();
+        times.push_back(timer.Elapsed());
+    }
+    double cpu_time = static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+
+    std::sort(times.begin(), times.end());
+    double sum = 0;
+    for (double t : times)
+        sum += t;
+    double mean = sum / times.size();
+    double median = times[times.size() / 2];
+
+    char stats[256];
+    snprintf(stats, sizeof(stats),
+             ",\"iterations\":%d,\"mean_ms\":%.4f,\"median_ms\":%.4f,\"min_ms\":%.4f,\"max_ms\":%.4f,\"cpu_ms\":%.4f",
+             static_cast<int>(times.size()), mean * 1000, median * 1000, times.front() * 1000,
+             times.back() * 1000, cpu_time * 1000 / times.size());
+    std::cout << "{\"name\":" << json::JSON(name).dump() << ",\"param\":" << json::JSON(param).dump() << stats;
+    if (audio_seconds > 0) {
+        char rtf[64];
+        snprintf(rtf, sizeof(rtf), ",\"audio_s\":%.3f,\"rtf\":%.6f", audio_seconds, median / audio_seconds);
+        std::cout << rtf;
+    }
+    std::cout << "}" << std::endl;
+}
+
+void LidBench::WriteHeader(const std::string &model_dir, int32 blas_threads) const
+{
+    char buf[64];
+    std::time_t now = std::time(NULL);
+    std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    std::cout << "{\"bench\":\"lid\",\"date\":\"" << buf << "\",\"model\":" << json::JSON(model_dir).dump()
+              << ",\"languages\":" << model_->NumLanguages()
+              << ",\"sample_frequency\":" << model_->SampleFrequency()
+              << ",\"hardware_threads\":" << std::thread::hardware_concurrency()
+              << ",\"usable_cpus\":" << CpuTopology::Get().NumCpus()
+              << ",\"numa_nodes\":" << CpuTopology::Get().NumNodes()
+              << ",\"blas_threads\":" << blas_threads
+              << ",\"min_time\":" << min_time_ << "}" << std::endl;
+}
+
+void LidBench::SyntheticAudio(BaseFloat seconds, BaseFloat sample_frequency,
+                              Vector<BaseFloat> *audio) const
+{
+    int32 num_samples = static_cast<int32>(seconds * sample_frequency);
+    audio->Resize(num_samples, kUndefined);
+    uint32 seed = 12345;
+    double phase = 0;
+    for (int32 i = 0; i < num_samples; i++) {
+        double t = i / sample_frequency;
+        // Pitch glides between 120 and 220 Hz, syllables at 4 Hz,
+        // and 300 ms of silence every 2 seconds
+        double f0 = 170 + 50 * sin(2 * M_PI * 0.7 * t);
+        phase += 2 * M_PI * f0 / sample_frequency;
+        double envelope = fmod(t, 2.0) < 1.7 ? 0.55 + 0.45 * sin(2 * M_PI * 4 * t) : 0;
+        double voiced = 0;
+        for (int32 k = 1; k <= 12; k++)
+            voiced += sin(k * phase) / k;
+        seed = seed * 1664525 + 1013904223;
+        double noise = (static_cast<int32>(seed >> 16) - 32768) / 32768.0;
+        (*audio)(i) = static_cast<BaseFloat>(3000 * envelope * voiced + 30 * noise);
+    }
+}
+
+void LidBench::NoiseAudio(BaseFloat seconds, BaseFloat sample_frequency, BaseFloat level_db,
+                          Vector<BaseFloat> *audio) const
+{
+    int32 num_samples = static_cast<int32>(seconds * sample_frequency);
+    audio->Resize(num_samples, kUndefined);
+    // Uniform noise in [-a, a] has an RMS of a / sqrt(3)
+    double amplitude = pow(10.0, level_db / 20) * sqrt(3.0);
+    uint32 seed = 54321;
+    for (int32 i = 0; i < num_samples; i++) {
+        seed = seed * 1664525 + 1013904223;
+        (*audio)(i) = static_cast<BaseFloat>(amplitude * (static_cast<int32>(seed >> 16) - 32768) / 32768.0);
+    }
+}
+
+void LidBench::ToneAudio(BaseFloat seconds, BaseFloat sample_frequency,
+                         const std::vector<std::pair<BaseFloat, BaseFloat> > &pairs,
+                         int32 on_ms, int32 off_ms, Vector<BaseFloat> *audio) const
+{
+    int32 num_samples = static_cast<int32>(seconds * sample_frequency);
+    audio->Resize(num_samples);
+    int32 on = static_cast<int32>(sample_frequency * on_ms / 1000);
+    int32 cycle = on + static_cast<int32>(sample_frequency * off_ms / 1000);
+    for (int32 i = 0; i < num_samples; i++) {
+        if (i % cycle >= on)
+            continue;
+        const std::pair<BaseFloat, BaseFloat> &pair = pairs[(i / cycle) % pairs.size()];
+        double t = i / sample_frequency;
+        (*audio)(i) = static_cast<BaseFloat>(3000 * (sin(2 * M_PI * pair.first * t) +
+                                                     sin(2 * M_PI * pair.second * t)));
+    }
+}
+
+void LidBench::ComputeMfcc(const VectorBase<BaseFloat> &audio, Matrix<BaseFloat> *features) const
+{
+    OnlineMfcc mfcc(model_->mfcc_opts);
+    mfcc.AcceptWaveform(model_->SampleFrequency(), audio);
+    mfcc.InputFinished();
+    features->Resize(mfcc.NumFramesReady(), mfcc.Dim(), kUndefined);
+    for (int32 i = 0; i < features->NumRows(); i++) {
+        SubVector<BaseFloat> row(*features, i);
+        mfcc.GetFrame(i, &row);
+    }
+}
+
+void LidBench::BenchFeatures(BaseFloat seconds)
+{
+    std::string param = DurationParam(seconds);
+    Vector<BaseFloat> audio;
+    SyntheticAudio(seconds, model_->SampleFrequency(), &audio);
+
+    Matrix<BaseFloat> features;
+    Measure("mfcc", param, seconds, [&] { ComputeMfcc(audio, &features); });
+
+    // The normalization of the recognizer, here over all frames instead of
+    // only the voiced ones
+    Matrix<BaseFloat> cmvn_feat(features.NumRows(), features.NumCols(), kUndefined);
+    std::vector<int32> rows(features.NumRows());
+    for (int32 i = 0; i < features.NumRows(); i++)
+        rows[i] = i;
+    Measure("cmn", param, seconds, [&] {
+        SlidingWindowCmnRows(model_->sliding_opts, features, rows, &cmvn_feat);
+    });
+
+    Vector<BaseFloat> vad_result;
+    Measure("vad", param, seconds, [&] {
+        ComputeVadEnergy(model_->opts, features, &vad_result);
+    });
+}
+
+void LidBench::BenchXvector(BaseFloat seconds)
+{
+    Vector<BaseFloat> audio;
+    SyntheticAudio(seconds, model_->SampleFrequency(), &audio);
+    Matrix<BaseFloat> features;
+    ComputeMfcc(audio, &features);
+    Matrix<BaseFloat> cmvn_feat(features.NumRows(), features.NumCols(), kUndefined);
+    SlidingWindowCmn(model_->sliding_opts, features, &cmvn_feat);
+
+    std::vector<XvectorInput> inputs(1);
+    inputs[0].features = &cmvn_feat;
+    inputs[0].chunk_size = XVECTOR_CHUNK_SIZE;
+    Measure("xvector", DurationParam(seconds), seconds, [&] { model_->ComputeXvectors(&inputs); });
+}
+
+void LidBench::BenchScoring()
+{
+    Vector<BaseFloat> audio;
+    SyntheticAudio(10, model_->SampleFrequency(), &audio);
+    Matrix<BaseFloat> features;
+    ComputeMfcc(audio, &features);
+    Matrix<BaseFloat> cmvn_feat(features.NumRows(), features.NumCols(), kUndefined);
+    SlidingWindowCmn(model_->sliding_opts, features, &cmvn_feat);
+    std::vector<XvectorInput> inputs(1);
+    inputs[0].features = &cmvn_feat;
+    inputs[0].chunk_size = XVECTOR_CHUNK_SIZE;
+    model_->ComputeXvectors(&inputs);
+    const Vector<BaseFloat> &xvector = inputs[0].xvector;
+
+    std::vector<int32> all_languages;
+    std::vector<std::pair<int32, BaseFloat> > scores;
+    Measure("plda", "all", 0, [&] { model_->ScoreXvector(xvector, all_languages, &scores); });
+
+    // PLDA scoring followed by sorting and JSON formatting of the result
+    KaldiRecognizer recognizer(model_, model_->SampleFrequency());
+    Measure("result_json", "all", 0, [&] {
+        recognizer.SetXvector(xvector);
+        recognizer.ScoredResult();
+    });
+    recognizer.SetMaxResults(3);
+    recognizer.SetLanguageNames(true);
+    Measure("result_json", "top3_names", 0, [&] {
+        recognizer.SetXvector(xvector);
+        recognizer.ScoredResult();
+    });
+}
+
+void LidBench::BenchFeatureCopies(BaseFloat seconds)
+{
+    std::string param = DurationParam(seconds);
+    BaseFloat sample_frequency = model_->SampleFrequency();
+    Vector<BaseFloat> audio;
+    SyntheticAudio(seconds, sample_frequency, &audio);
+    Matrix<BaseFloat> features;
+    ComputeMfcc(audio, &features);
+
+    KaldiRecognizer recognizer(model_, sample_frequency);
+    Vector<BaseFloat> wdata(audio);
+    recognizer.AcceptWaveform(wdata);
+    Measure("prepare_features", param, seconds, [&] {
+        Matrix<BaseFloat> nnet_feat;
+        int32 chunk_size;
+        recognizer.PrepareFeatures(&nnet_feat, &chunk_size);
+    });
+
+    recognizer.LangResult();
+    int64 bytes_copied = recognizer.FeatureBytesCopied();
+    int64 mfcc_bytes = static_cast<int64>(features.NumRows()) * features.NumCols() * sizeof(BaseFloat);
+    char stats[128];
+    snprintf(stats, sizeof(stats), ",\"bytes_copied\":%lld,\"mfcc_bytes\":%lld,\"copies\":%.3f",
+             static_cast<long long>(bytes_copied), static_cast<long long>(mfcc_bytes),
+             mfcc_bytes > 0 ? static_cast<double>(bytes_copied) / mfcc_bytes : 0.0);
+    std::cout << "{\"name\":\"feature_copies\",\"param\":" << json::JSON(param).dump() << stats << "}" << std::endl;
+}
+
+void LidBench::BenchSynthetic(BaseFloat seconds, BaseFloat sample_frequency)
+{
+    Vector<BaseFloat> audio;
+    SyntheticAudio(seconds, sample_frequency, &audio);
+    char param[64];
+    snprintf(param, sizeof(param), "synthetic_%gs_%gHz", seconds, sample_frequency);
+    Measure("end_to_end", param, seconds, [&] {
+        KaldiRecognizer recognizer(model_, sample_frequency);
+        Vector<BaseFloat> wdata(audio);
+        recognizer.AcceptWaveform(wdata);
+        recognizer.LangResult();
+    });
+}
+
+void LidBench::BenchFile(const std::string &path)
+{
+    WaveFile wave_file;
+    if (!wave_file.Open(path.c_str()))
+        return;
+    double seconds = wave_file.NumFrames() / wave_file.SampleFrequency();
+    wave_file.Close();
+
+    Measure("end_to_end", path, seconds, [&] {
+        KaldiRecognizer recognizer(model_, model_->SampleFrequency());
+        recognizer.AcceptFile(path.c_str());
+        recognizer.LangResult();
+    });
+}
+
+void LidBench::BenchSpeechGate(BaseFloat seconds)
+{
+    BaseFloat sample_frequency = model_->SampleFrequency();
+    Vector<BaseFloat> noise, speech;
+    NoiseAudio(seconds, sample_frequency, 45, &noise);
+    SyntheticAudio(seconds, sample_frequency, &speech);
+    Vector<BaseFloat> padded(3 * noise.Dim());
+    padded.Range(0, noise.Dim()).CopyFromVec(noise);
+    padded.Range(noise.Dim(), speech.Dim()).AddVec(1.0, speech);
+    padded.Range(noise.Dim(), noise.Dim()).AddVec(1.0, noise);
+    padded.Range(2 * noise.Dim(), noise.Dim()).CopyFromVec(noise);
+
+    // Dialled digits 1 to 0 of 100 ms with 100 ms pauses, and the North
+    // American ringback of 2 s with 4 s pauses
+    Vector<BaseFloat> dtmf, ringback;
+    ToneAudio(seconds, sample_frequency,
+              {{697, 1209}, {697, 1336}, {697, 1477}, {770, 1209}, {770, 1336},
+               {770, 1477}, {852, 1209}, {852, 1336}, {852, 1477}, {941, 1336}},
+              100, 100, &dtmf);
+    ToneAudio(seconds, sample_frequency, {{440, 480}}, 2000, 4000, &ringback);
+
+    const std::pair<const char *, const Vector<BaseFloat> *> inputs[] = {
+        {"noise", &noise}, {"padded_speech", &padded}, {"dtmf", &dtmf}, {"ringback", &ringback}};
+    for (const auto &input : inputs) {
+        double input_seconds = input.second->Dim() / sample_frequency;
+
+        // How much of the input the gate lets through
+        int64 blocks, rejected, blocks_before, rejected_before;
+        model_->GetSpeechGateStats(&blocks_before, &rejected_before);
+        {
+            KaldiRecognizer recognizer(model_, sample_frequency);
+            recognizer.SetSpeechGate(true);
+            Vector<BaseFloat> wdata(*input.second);
+            recognizer.AcceptWaveform(wdata);
+            recognizer.LangResult();
+        }
+        model_->GetSpeechGateStats(&blocks, &rejected);
+        blocks -= blocks_before;
+        rejected -= rejected_before;
+        char line[256];
+        snprintf(line, sizeof(line),
+                 "{\"name\":\"speech_gate\",\"param\":\"%s_%gs\",\"blocks\":%lld,\"rejected\":%lld,"
+                 "\"rejected_ratio\":%.4f}",
+                 input.first, input_seconds, static_cast<long long>(blocks),
+                 static_cast<long long>(rejected), blocks > 0 ? static_cast<double>(rejected) / blocks : 0.0);
+        std::cout << line << std::endl;
+
+        for (bool gate : {false, true}) {
+            char param[64];
+            snprintf(param, sizeof(param), "%s_%gs_gate_%s", input.first, input_seconds,
+                     gate ? "on" : "off");
+            Measure("end_to_end", param, input_seconds, [&] {
+                KaldiRecognizer recognizer(model_, sample_frequency);
+                recognizer.SetSpeechGate(gate);
+                Vector<BaseFloat> wdata(*input.second);
+                recognizer.AcceptWaveform(wdata);
+                recognizer.LangResult();
+            });
+        }
+    }
+}
+
+void LidBench::BenchCascade(LidModel *large_model, const std::vector<BaseFloat> &margins,
+                            const std::vector<std::string> &paths)
+{
+    // Recorded speech is what makes the margins meaningful, synthetic audio
+    // only stands in when no files are given
+    std::vector<Vector<BaseFloat> > audio;
+    std::vector<BaseFloat> rates;
+    double audio_seconds = 0;
+    for (auto const &path : paths) {
+        WaveFile wave_file;
+        if (!wave_file.Open(path.c_str()))
+            continue;
+        audio.emplace_back();
+        wave_file.Decode(0, static_cast<int32>(wave_file.NumFrames()), 0, &audio.back());
+        rates.push_back(wave_file.SampleFrequency());
+        audio_seconds += wave_file.NumFrames() / wave_file.SampleFrequency();
+    }
+    if (audio.empty()) {
+        for (BaseFloat seconds : {3.0f, 10.0f, 30.0f}) {
+            audio.emplace_back();
+            SyntheticAudio(seconds, model_->SampleFrequency(), &audio.back());
+            rates.push_back(model_->SampleFrequency());
+            audio_seconds += seconds;
+        }
+    }
+
+    // margin < 0 is the small model alone, NaN the large model alone
+    std::vector<BaseFloat> configs(1, -1);
+    configs.push_back(NAN);
+    configs.insert(configs.end(), margins.begin(), margins.end());
+    for (BaseFloat margin : configs) {
+        int64 requests_before, escalations_before;
+        model_->GetCascadeStats(&requests_before, &escalations_before);
+
+        int32 num_requests = 0;
+        Timer timer;
+        std::clock_t cpu_start = std::clock();
+        while (num_requests < min_iterations_ * static_cast<int32>(audio.size()) || timer.Elapsed() < min_time_) {
+            for (size_t i = 0; i < audio.size(); i++) {
+                KaldiRecognizer recognizer(std::isnan(margin) ? large_model : model_, rates[i]);
+                if (margin >= 0)
+                    recognizer.SetCascade(large_model, margin);
+                Vector<BaseFloat> wdata(audio[i]);
+                recognizer.AcceptWaveform(wdata);
+                recognizer.LangResult();
+                num_requests++;
+            }
+        }
+        double cpu_time = static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+        double wall_time = timer.Elapsed();
+
+        int64 requests, escalations;
+        model_->GetCascadeStats(&requests, &escalations);
+        requests -= requests_before;
+        escalations -= escalations_before;
+
+        char param[32];
+        if (margin < 0)
+            snprintf(param, sizeof(param), "small");
+        else if (std::isnan(margin))
+            snprintf(param, sizeof(param), "large");
+        else
+            snprintf(param, sizeof(param), "margin_%g", margin);
+        char line[256];
+        snprintf(line, sizeof(line),
+                 "{\"name\":\"cascade\",\"param\":\"%s\",\"requests\":%d,\"escalation_rate\":%.4f,"
+                 "\"mean_ms\":%.4f,\"cpu_ms\":%.4f,\"audio_s\":%.3f}",
+                 param, num_requests, requests > 0 ? static_cast<double>(escalations) / requests : 0.0,
+                 wall_time * 1000 / num_requests, cpu_time * 1000 / num_requests,
+                 audio_seconds / audio.size());
+        std::cout << line << std::endl;
+    }
+}
+
+void LidBench::BenchScaling(LidAffinity affinity, const std::vector<int32> &thread_counts)
+{
+    static const char *affinity_names[] = {"none", "cores", "numa"};
+    const BaseFloat seconds = 10;
+    BaseFloat sample_frequency = model_->SampleFrequency();
+    Vector<BaseFloat> audio;
+    SyntheticAudio(seconds, sample_frequency, &audio);
+
+    for (int32 threads : thread_counts) {
+        model_->SetWorkers(threads, 0);
+        model_->SetWorkerAffinity(affinity);
+
+        // Two requests per thread keep every worker busy until the end
+        int32 num_requests = 2 * threads;
+        std::vector<KaldiRecognizer *> recognizers;
+        for (int32 i = 0; i < num_requests; i++) {
+            recognizers.push_back(new KaldiRecognizer(model_, sample_frequency));
+            Vector<BaseFloat> wdata(audio);
+            recognizers.back()->AcceptWaveform(wdata);
+        }
+
+        char param[64];
+        snprintf(param, sizeof(param), "%s_%dthreads", affinity_names[affinity], threads);
+        Measure("scaling", param, num_requests * seconds, [&] {
+            std::mutex mutex;
+            std::condition_variable finished;
+            int32 remaining = num_requests;
+            for (auto *recognizer : recognizers) {
+                model_->Submit([&, recognizer] {
+                    recognizer->LangResult();
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (--remaining == 0)
+                        finished.notify_one();
+                });
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            finished.wait(lock, [&] { return remaining == 0; });
+        });
+
+        for (auto *recognizer : recognizers)
+            delete recognizer;
+    }
+    model_->SetWorkers(0, 0);
+    model_->SetWorkerAffinity(kLidAffinityNone);
+}
+
+void LidBench::BenchFrameSubsampling(const std::string &model_dir, const std::vector<int32> &factors,
+                                     const std::vector<std::pair<std::string, std::string> > &references)
+{
+    std::vector<std::string> first_results;
+    double first_time = 0;
+    for (size_t f = 0; f < factors.size(); f++) {
+        LidModel *model = new LidModel(model_dir.c_str());
+        if (!model->SetFrameSubsampling(factors[f]))
+            KALDI_ERR << "Invalid frame subsampling factor " << factors[f];
+
+        std::vector<float> scores(model->NumLanguages());
+        std::vector<std::string> results;
+        int32 num_labeled = 0, num_correct = 0, num_agreed = 0;
+        double total_time = 0, audio_seconds = 0;
+        for (auto const &reference : references) {
+            WaveFile wave_file;
+            if (!wave_file.Open(reference.second.c_str()))
+                KALDI_ERR << "Can't read " << reference.second;
+            audio_seconds += wave_file.NumFrames() / wave_file.SampleFrequency();
+            wave_file.Close();
+
+            // Only the result is timed, the first run compiles the network
+            // computation for the length of the file
+            KaldiRecognizer recognizer(model, model->SampleFrequency());
+            recognizer.AcceptFile(reference.second.c_str());
+            recognizer.LangScores(scores.data(), scores.size());
+            Timer timer;
+            int num_scores = recognizer.LangScores(scores.data(), scores.size());
+            total_time += timer.Elapsed();
+
+            std::string best;
+            if (num_scores > 0)
+                best = model->languages[std::max_element(scores.begin(), scores.end()) - scores.begin()];
+            if (!reference.first.empty()) {
+                num_labeled++;
+                if (best == reference.first)
+                    num_correct++;
+            }
+            if (f > 0 && best == first_results[results.size()])
+                num_agreed++;
+            results.push_back(best);
+        }
+        if (f == 0) {
+            first_results = results;
+            first_time = total_time;
+        }
+
+        char param[32];
+        snprintf(param, sizeof(param), "factor_%d", factors[f]);
+        char stats[256];
+        snprintf(stats, sizeof(stats),
+                 ",\"mode\":\"%s\",\"files\":%d,\"agreement\":%.4f,\"mean_ms\":%.4f,\"speedup\":%.3f,\"audio_s\":%.3f",
+                 model->input_frame_skip == 1 ? "network" : "input", static_cast<int>(references.size()),
+                 references.empty() ? 0.0 : static_cast<double>(f > 0 ? num_agreed : references.size()) / references.size(),
+                 references.empty() ? 0.0 : total_time * 1000 / references.size(),
+                 total_time > 0 ? first_time / total_time : 0.0, audio_seconds);
+        std::cout << "{\"name\":\"frame_subsampling\",\"param\":\"" << param << "\"" << stats;
+        if (num_labeled > 0) {
+            char accuracy[64];
+            snprintf(accuracy, sizeof(accuracy), ",\"labeled\":%d,\"accuracy\":%.4f",
+                     num_labeled, static_cast<double>(num_correct) / num_labeled);
+            std::cout << accuracy;
+        }
+        std::cout << "}" << std::endl;
+        model->Unref();
+    }
+}
+
+// Reads "<language> <wav-file>" lines, a line with only the file has no
+// language
+static std::vector<std::pair<std::string, std::string> > ReadReferenceSet(const std::string &path)
+{
+    std::ifstream is(path);
+    if (!is)
+        KALDI_ERR << "Can't open the reference set " << path;
+    std::vector<std::pair<std::string, std::string> > references;
+    std::string line;
+    while (std::getline(is, line)) {
+        std::vector<std::string> fields;
+        SplitStringToVector(line, " \t", true, &fields);
+        if (fields.size() == 1)
+            references.push_back(std::make_pair(std::string(), fields[0]));
+        else if (fields.size() == 2)
+            references.push_back(std::make_pair(fields[0], fields[1]));
+        else if (!fields.empty())
+            KALDI_ERR << "Invalid line in " << path << ": " << line;
+    }
+    return references;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *usage =
+        "Benchmarks the stages of language identification and the whole recognizer.\n"
+        "Writes one JSON line per benchmark to the standard output.\n"
+        "\n"
+        "Usage: lid-bench [options] <model-dir> [<wav-file> ...]\n"
+        "e.g.: lid-bench lid-model test_ru.wav > bench.jsonl\n";
+
+    ParseOptions po(usage);
+    BaseFloat min_time = 1.0;
+    int32 min_iterations = 5;
+    std::string durations = "3,10,30,60";
+    po.Register("min-time", &min_time, "Minimum time in seconds spent on each benchmark");
+    po.Register("min-iterations", &min_iterations, "Minimum number of iterations of each benchmark");
+    po.Register("durations", &durations, "Comma separated audio durations in seconds for the stage benchmarks");
+    std::string cascade_model_dir;
+    std::string cascade_margins = "0.5,1,2,4";
+    po.Register("cascade-model", &cascade_model_dir, "Large model for the cascade benchmark, which is skipped if empty");
+    po.Register("cascade-margins", &cascade_margins, "Comma separated score margins below which the cascade escalates");
+    int32 blas_threads = 1;
+    std::string scaling_affinity = "none,cores,numa";
+    std::string scaling_threads;
+    std::string subsampling_factors = "1,2,3,4";
+    std::string reference_set;
+    po.Register("subsampling-factors", &subsampling_factors, "Comma separated frame subsampling factors for "
+                "the accuracy against speed report, the first one is the baseline");
+    po.Register("reference-set", &reference_set, "File with \"<language> <wav-file>\" lines for the "
+                "accuracy against speed report, which uses the given wav files without languages if empty");
+    po.Register("blas-threads", &blas_threads, "Threads of OpenBLAS for a single matrix operation");
+    po.Register("scaling-affinity", &scaling_affinity, "Comma separated worker placements (none, cores, numa) "
+                "for the scaling benchmark, which is skipped if empty");
+    po.Register("scaling-threads", &scaling_threads, "Comma separated worker thread counts for the scaling "
+                "benchmark, powers of two up to all usable CPUs if empty");
+
+    // Recognizers log every result, keep quiet unless --verbose is given
+    SetVerboseLevel(-1);
+    po.Read(argc, argv);
+
+    if (po.NumArgs() < 1) {
+        po.PrintUsage();
+        return 1;
+    }
+
+    std::vector<BaseFloat> seconds;
+    if (!SplitStringToFloats(durations, ",", true, &seconds) || seconds.empty())
+        KALDI_ERR << "Invalid --durations " << durations;
+
+    std::vector<std::string> affinity_names;
+    SplitStringToVector(scaling_affinity, ",", true, &affinity_names);
+    std::vector<LidAffinity> affinities;
+    for (auto const &name : affinity_names) {
+        if (name == "none")
+            affinities.push_back(kLidAffinityNone);
+        else if (name == "cores")
+            affinities.push_back(kLidAffinityCores);
+        else if (name == "numa")
+            affinities.push_back(kLidAffinityNuma);
+        else
+            KALDI_ERR << "Invalid --scaling-affinity " << scaling_affinity;
+    }
+    std::vector<int32> thread_counts;
+    if (!SplitStringToIntegers(scaling_threads, ",", true, &thread_counts))
+        KALDI_ERR << "Invalid --scaling-threads " << scaling_threads;
+    if (thread_counts.empty()) {
+        int32 num_cpus = CpuTopology::Get().NumCpus();
+        for (int32 threads = 1; threads < num_cpus; threads *= 2)
+            thread_counts.push_back(threads);
+        thread_counts.push_back(num_cpus);
+    }
+
+    std::vector<int32> factors;
+    if (!SplitStringToIntegers(subsampling_factors, ",", true, &factors))
+        KALDI_ERR << "Invalid --subsampling-factors " << subsampling_factors;
+
+    SetBlasThreads(blas_threads);
+    std::string model_dir = po.GetArg(1);
+    LidModel *model = new LidModel(model_dir.c_str());
+    LidBench bench(model, min_time, std::max(min_iterations, 1));
+
+    bench.WriteHeader(model_dir, blas_threads);
+    for (BaseFloat s : seconds)
+        bench.BenchFeatures(s);
+    for (BaseFloat s : seconds)
+        bench.BenchXvector(s);
+    for (BaseFloat s : seconds)
+        bench.BenchFeatureCopies(s);
+    bench.BenchScoring();
+    bench.BenchSynthetic(10, model->SampleFrequency());
+    bench.BenchSynthetic(10, 8000);
+    bench.BenchSpeechGate(10);
+    std::vector<std::string> paths;
+    for (int32 i = 2; i <= po.NumArgs(); i++) {
+        paths.push_back(po.GetArg(i));
+        bench.BenchFile(po.GetArg(i));
+    }
+
+    if (!cascade_model_dir.empty()) {
+        std::vector<BaseFloat> margins;
+        if (!SplitStringToFloats(cascade_margins, ",", true, &margins))
+            KALDI_ERR << "Invalid --cascade-margins " << cascade_margins;
+        LidModel *large_model = new LidModel(cascade_model_dir.c_str());
+        if (!model->CascadesWith(*large_model))
+            KALDI_ERR << "The models in " << model_dir << " and " << cascade_model_dir
+                      << " differ in features or languages";
+        bench.BenchCascade(large_model, margins, paths);
+        large_model->Unref();
+    }
+
+    for (LidAffinity affinity : affinities)
+        bench.BenchScaling(affinity, thread_counts);
+
+    std::vector<std::pair<std::string, std::string> > references;
+    if (!reference_set.empty())
+        references = ReadReferenceSet(reference_set);
+    else
+        for (auto const &path : paths)
+            references.push_back(std::make_pair(std::string(), path));
+    if (!factors.empty() && !references.empty())
+        bench.BenchFrameSubsampling(model_dir, factors, references);
+
+    model->Unref();
+    return 0;
+}
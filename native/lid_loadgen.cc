@@ -0,0 +1,436 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Load test of one model shared by many streaming recognizers. Every stream
+// replays a wav file in packets at real-time pace and asks for the language
+// result at a fixed interval, like a client of a live service would. The
+// latency of the results, the lag behind real time and the CPU use are
+// reported, and without --streams the largest number of streams that meets
+// the latency objective is searched for. With --reload-model the model is
+// replaced periodically during the runs to check that swapping it does not
+// disturb the streams. With --streams as well this is a test: a run without
+// reloads sets the baseline, and the program fails if the 99th percentile
+// of the latency around the reloads exceeds the bound derived from it.
+
+#include "kaldi_recognizer.h"
+#include "lid_model.h"
+#include "model_store.h"
+#include "wave_file.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+#include <sys/resource.h>
+
+typedef std::chrono::steady_clock Clock;
+
+struct LoadOptions {
+    int32 streams;
+    int32 threads;
+    BaseFloat duration;
+    int32 packet_ms;
+    int32 poll_ms;
+    BaseFloat utterance;
+    BaseFloat slo_ms;
+    BaseFloat max_lag_ms;
+    int32 max_streams;
+    std::string reload_model;
+    BaseFloat reload_interval;
+    BaseFloat reload_window;
+    BaseFloat reload_max_ratio;
+    BaseFloat reload_slack_ms;
+
+    LoadOptions() : streams(0), threads(0), duration(20), packet_ms(20), poll_ms(1000),
+                    utterance(10), slo_ms(500), max_lag_ms(200), max_streams(4096),
+                    reload_interval(5), reload_window(2), reload_max_ratio(1.5),
+                    reload_slack_ms(5) {}
+
+    void Register(ParseOptions *po) {
+        po->Register("streams", &streams, "Number of concurrent streams, 0 searches for the maximum sustainable number");
+        po->Register("threads", &threads, "Threads driving the streams, 0 for the number of cores");
+        po->Register("duration", &duration, "Length of each run in seconds");
+        po->Register("packet-ms", &packet_ms, "Audio packet length in milliseconds");
+        po->Register("poll-ms", &poll_ms, "Interval of audio in milliseconds between result requests");
+        po->Register("utterance", &utterance, "Seconds of audio after which a stream starts a new utterance");
+        po->Register("slo-ms", &slo_ms, "Objective for the 99th percentile of the result latency in milliseconds");
+        po->Register("max-lag-ms", &max_lag_ms, "Largest tolerated delay of a packet behind real time in milliseconds");
+        po->Register("max-streams", &max_streams, "Upper bound of the search");
+        po->Register("reload-model", &reload_model, "Model loaded and published every --reload-interval seconds during the runs");
+        po->Register("reload-interval", &reload_interval, "Seconds between model reloads");
+        po->Register("reload-window", &reload_window, "Seconds after a model swap that still count as reload time");
+        po->Register("reload-max-ratio", &reload_max_ratio, "Largest tolerated ratio of the reload p99 latency to the baseline p99");
+        po->Register("reload-slack-ms", &reload_slack_ms, "Milliseconds added to the reload latency bound against timer noise");
+    }
+};
+
+struct LoadStats {
+    std::vector<double> latencies;
+    // Latencies of the requests made while a new model was loading or
+    // within --reload-window after it was published
+    std::vector<double> reload_latencies;
+    double max_lag;
+    int64 packets;
+
+    LoadStats() : max_lag(0), packets(0) {}
+};
+
+struct LoadResult {
+    int32 streams;
+    int64 results;
+    double p50, p95, p99, p999;
+    double reload_p99, reload_p999;
+    int32 reloads;
+    double max_lag;
+    double cpu_load;
+    bool sustainable;
+};
+
+struct Stream {
+    KaldiRecognizer *recognizer;
+    int32 position;
+    int32 utterance_samples;
+    int32 since_poll;
+    Clock::time_point due;
+};
+
+static double Percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+static double CpuSeconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+static int64 Nanoseconds(Clock::time_point time)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+// Start and end of the reload time in nanoseconds of the steady clock, the
+// end is the largest value while a load is running
+struct ReloadWindow {
+    std::atomic<int64> begin;
+    std::atomic<int64> end;
+
+    ReloadWindow() : begin(0), end(0) {}
+
+    bool Overlaps(Clock::time_point from, Clock::time_point to) const {
+        return Nanoseconds(to) >= begin && Nanoseconds(from) <= end;
+    }
+};
+
+// Feeds the streams of one thread until the end of the run, always serving
+// the stream whose next packet is due first
+static void DriveStreams(ModelStore *store, const ReloadWindow *reload, const LoadOptions &opts,
+                         const Vector<BaseFloat> &audio, BaseFloat sample_frequency,
+                         int32 first_stream, int32 num_streams, int32 stride,
+                         Clock::time_point start, LoadStats *stats)
+{
+    int32 packet = static_cast<int32>(sample_frequency * opts.packet_ms / 1000);
+    int32 poll = static_cast<int32>(sample_frequency * opts.poll_ms / 1000);
+    int32 utterance = static_cast<int32>(sample_frequency * opts.utterance);
+    Clock::time_point end = start + std::chrono::milliseconds(static_cast<int64>(opts.duration * 1000));
+    Clock::duration period = std::chrono::milliseconds(opts.packet_ms);
+
+    // Streams start spread over one packet and at different places in the
+    // audio, so that they don't all ask for results at the same moment
+    std::vector<Stream> streams;
+    for (int32 s = first_stream; s < num_streams; s += stride) {
+        Stream stream;
+        LidModel *model = store->Acquire();
+        stream.recognizer = new KaldiRecognizer(model, sample_frequency);
+        model->Unref();
+        stream.position = static_cast<int32>((static_cast<int64>(s) * 7919 * packet) % audio.Dim());
+        stream.utterance_samples = 0;
+        stream.since_poll = (s * packet) % std::max(poll, 1);
+        stream.due = start + period * s / num_streams;
+        streams.push_back(stream);
+    }
+
+    Vector<BaseFloat> data(packet);
+    while (!streams.empty()) {
+        Stream *next = &streams[0];
+        for (auto &stream : streams)
+            if (stream.due < next->due)
+                next = &stream;
+        if (next->due >= end)
+            break;
+        std::this_thread::sleep_until(next->due);
+
+        Clock::time_point now = Clock::now();
+        stats->max_lag = std::max(stats->max_lag, std::chrono::duration<double>(now - next->due).count());
+        for (int32 i = 0; i < packet; i++) {
+            data(i) = audio(next->position);
+            next->position = (next->position + 1) % audio.Dim();
+        }
+        next->recognizer->AcceptWaveform(data);
+        next->utterance_samples += packet;
+        next->since_poll += packet;
+        stats->packets++;
+
+        if (next->since_poll >= poll) {
+            Clock::time_point request = Clock::now();
+            next->recognizer->LangResult();
+            Clock::time_point response = Clock::now();
+            double latency = std::chrono::duration<double>(response - request).count();
+            stats->latencies.push_back(latency);
+            if (reload->Overlaps(request, response))
+                stats->reload_latencies.push_back(latency);
+            next->since_poll = 0;
+        }
+        if (next->utterance_samples >= utterance) {
+            // While reloading, new utterances go to the latest model like
+            // new connections of a service would
+            if (opts.reload_model.empty()) {
+                next->recognizer->Reset();
+            } else {
+                delete next->recognizer;
+                LidModel *model = store->Acquire();
+                next->recognizer = new KaldiRecognizer(model, sample_frequency);
+                model->Unref();
+            }
+            next->utterance_samples = 0;
+        }
+        next->due += period;
+    }
+
+    for (auto &stream : streams)
+        delete stream.recognizer;
+}
+
+// One run with num_streams streams, with model reloads if reload is set
+static LoadResult RunLoad(ModelStore *store, const LoadOptions &opts, int32 num_threads,
+                          const Vector<BaseFloat> &audio, BaseFloat sample_frequency,
+                          int32 num_streams, bool reload)
+{
+    num_threads = std::min(num_threads, num_streams);
+    std::vector<LoadStats> stats(num_threads);
+    std::vector<std::thread> threads;
+
+    // Leave time to create the recognizers before the first packet
+    Clock::time_point start = Clock::now() + std::chrono::milliseconds(100);
+    double cpu_start = CpuSeconds();
+    ReloadWindow window;
+    bool running = true;
+    std::mutex running_mutex;
+    std::condition_variable stopped;
+    for (int32 t = 0; t < num_threads; t++)
+        threads.emplace_back(DriveStreams, store, &window, std::cref(opts), std::cref(audio), sample_frequency,
+                             t, num_streams, num_threads, start, &stats[t]);
+
+    // Loads run in the background like in a service, the window is closed
+    // --reload-window seconds after the swap
+    int32 reloads = 0;
+    bool load_running = false;
+    std::thread reloader;
+    if (reload) {
+        reloader = std::thread([&] {
+            Clock::duration interval = std::chrono::milliseconds(static_cast<int64>(opts.reload_interval * 1000));
+            Clock::duration after_swap = std::chrono::milliseconds(static_cast<int64>(opts.reload_window * 1000));
+            Clock::time_point next_reload = start + interval;
+            std::unique_lock<std::mutex> lock(running_mutex);
+            while (!stopped.wait_until(lock, next_reload, [&] { return !running; })) {
+                next_reload += interval;
+                if (load_running)
+                    continue;
+                load_running = true;
+                window.begin = Nanoseconds(Clock::now());
+                window.end = std::numeric_limits<int64>::max();
+                bool started = store->LoadAsync(opts.reload_model, [&, after_swap](bool loaded) {
+                    window.end = Nanoseconds(Clock::now() + after_swap);
+                    std::lock_guard<std::mutex> lock(running_mutex);
+                    if (loaded)
+                        reloads++;
+                    load_running = false;
+                    stopped.notify_all();
+                });
+                if (!started) {
+                    load_running = false;
+                    window.end = 0;
+                }
+            }
+            // The callback refers to this frame
+            stopped.wait(lock, [&] { return !load_running; });
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    {
+        std::lock_guard<std::mutex> lock(running_mutex);
+        running = false;
+    }
+    stopped.notify_all();
+    if (reloader.joinable())
+        reloader.join();
+    double wall = std::chrono::duration<double>(Clock::now() - start).count();
+    double cpu = CpuSeconds() - cpu_start;
+
+    std::vector<double> latencies, reload_latencies;
+    double max_lag = 0;
+    for (auto const &s : stats) {
+        latencies.insert(latencies.end(), s.latencies.begin(), s.latencies.end());
+        reload_latencies.insert(reload_latencies.end(), s.reload_latencies.begin(), s.reload_latencies.end());
+        max_lag = std::max(max_lag, s.max_lag);
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::sort(reload_latencies.begin(), reload_latencies.end());
+
+    LoadResult result;
+    result.streams = num_streams;
+    result.results = latencies.size();
+    result.p50 = Percentile(latencies, 0.5);
+    result.p95 = Percentile(latencies, 0.95);
+    result.p99 = Percentile(latencies, 0.99);
+    result.p999 = Percentile(latencies, 0.999);
+    result.reload_p99 = Percentile(reload_latencies, 0.99);
+    result.reload_p999 = Percentile(reload_latencies, 0.999);
+    result.reloads = reloads;
+    result.max_lag = max_lag;
+    result.cpu_load = cpu / wall;
+    result.sustainable = result.p99 * 1000 <= opts.slo_ms && max_lag * 1000 <= opts.max_lag_ms;
+
+    char line[512];
+    snprintf(line, sizeof(line),
+             "{\"streams\":%d,\"threads\":%d,\"results\":%lld,\"p50_ms\":%.3f,\"p95_ms\":%.3f,"
+             "\"p99_ms\":%.3f,\"p999_ms\":%.3f,\"max_lag_ms\":%.3f,\"cpu_cores\":%.3f,\"sustainable\":%s",
+             num_streams, num_threads, static_cast<long long>(result.results),
+             result.p50 * 1000, result.p95 * 1000, result.p99 * 1000, result.p999 * 1000,
+             max_lag * 1000, result.cpu_load, result.sustainable ? "true" : "false");
+    std::cout << line;
+    if (reload) {
+        snprintf(line, sizeof(line), ",\"reloads\":%d,\"reload_p99_ms\":%.3f,\"reload_p999_ms\":%.3f",
+                 reloads, result.reload_p99 * 1000, result.reload_p999 * 1000);
+        std::cout << line;
+    }
+    std::cout << "}" << std::endl;
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *usage =
+        "Load test of one model with many concurrent streaming recognizers.\n"
+        "Every stream replays the wav file at real-time pace and requests the\n"
+        "result periodically. Writes one JSON line per run with the latency\n"
+        "percentiles, and without --streams searches for the largest number of\n"
+        "streams meeting --slo-ms. With --streams and --reload-model it fails\n"
+        "if the latency around model reloads exceeds the bound derived from a\n"
+        "run without reloads.\n"
+        "\n"
+        "Usage: lid-loadgen [options] <model-dir> <wav-file>\n"
+        "e.g.: lid-loadgen --threads=4 lid-model test_ru.wav\n";
+
+    ParseOptions po(usage);
+    LoadOptions opts;
+    opts.Register(&po);
+    SetVerboseLevel(-1);
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+        po.PrintUsage();
+        return 1;
+    }
+
+    int32 cores = std::max<int32>(std::thread::hardware_concurrency(), 1);
+    int32 num_threads = opts.threads > 0 ? opts.threads : cores;
+    opts.packet_ms = std::max(opts.packet_ms, 1);
+
+    WaveFile wave_file;
+    if (!wave_file.Open(po.GetArg(2).c_str()))
+        return 1;
+    Vector<BaseFloat> audio;
+    wave_file.Decode(0, static_cast<int32>(wave_file.NumFrames()), 0, &audio);
+    BaseFloat sample_frequency = wave_file.SampleFrequency();
+    wave_file.Close();
+    if (audio.Dim() == 0)
+        KALDI_ERR << "No audio in " << po.GetArg(2);
+
+    // The store takes over the reference of the model
+    ModelStore *store = new ModelStore(new LidModel(po.GetArg(1).c_str()));
+
+    if (opts.streams > 0 && !opts.reload_model.empty()) {
+        // Same streams without and with reloads, the second may not be
+        // noticeably slower around the swaps
+        LoadResult baseline = RunLoad(store, opts, num_threads, audio, sample_frequency, opts.streams, false);
+        LoadResult result = RunLoad(store, opts, num_threads, audio, sample_frequency, opts.streams, true);
+        double bound = baseline.p99 * opts.reload_max_ratio + opts.reload_slack_ms / 1000;
+        bool passed = result.reloads > 0 && result.reload_p99 <= bound;
+        char line[256];
+        snprintf(line, sizeof(line),
+                 "{\"reload_test\":\"%s\",\"reloads\":%d,\"baseline_p99_ms\":%.3f,"
+                 "\"reload_p99_ms\":%.3f,\"bound_ms\":%.3f}",
+                 passed ? "passed" : "failed", result.reloads, baseline.p99 * 1000,
+                 result.reload_p99 * 1000, bound * 1000);
+        std::cout << line << std::endl;
+        delete store;
+        return passed ? 0 : 1;
+    }
+
+    if (opts.streams > 0) {
+        RunLoad(store, opts, num_threads, audio, sample_frequency, opts.streams, false);
+        delete store;
+        return 0;
+    }
+
+    // Double the streams until the objective is missed, then bisect
+    int32 good = 0, bad = 0;
+    LoadResult best;
+    best.cpu_load = 0;
+    for (int32 n = 1; n <= opts.max_streams; n *= 2) {
+        LoadResult result = RunLoad(store, opts, num_threads, audio, sample_frequency, n,
+                                    !opts.reload_model.empty());
+        if (!result.sustainable) {
+            bad = n;
+            break;
+        }
+        good = n;
+        best = result;
+    }
+    if (bad == 0)
+        bad = opts.max_streams + 1;
+    while (good > 0 && bad - good > std::max(1, good / 16)) {
+        int32 n = (good + bad) / 2;
+        LoadResult result = RunLoad(store, opts, num_threads, audio, sample_frequency, n,
+                                    !opts.reload_model.empty());
+        if (result.sustainable) {
+            good = n;
+            best = result;
+        } else {
+            bad = n;
+        }
+    }
+
+    char line[256];
+    snprintf(line, sizeof(line),
+             "{\"max_streams\":%d,\"threads\":%d,\"cores\":%d,\"streams_per_core\":%.2f,"
+             "\"cpu_cores_at_max\":%.3f}",
+             good, num_threads, cores, static_cast<double>(good) / std::min(num_threads, cores),
+             good > 0 ? best.cpu_load : 0.0);
+    std::cout << line << std::endl;
+
+    delete store;
+    return good > 0 ? 0 : 1;
+}
@@ -13,6 +13,23 @@
 // limitations under the License.
 
 #include "lid_model.h"
+#include "cpu_affinity.h"
+
+#include <sstream>
+
+// Most frames per network pass when a deadline is checked, a longer chunk
+// gets a pass of its own
+#define DEADLINE_PASS_FRAMES 1000
+#define COMPILER_CACHE_CAPACITY 64
+#define WARM_FRAMES 500
+
+struct LidModel::NnetReplica {
+    explicit NnetReplica(const Nnet &other) : nnet(other), compiler(NULL) {}
+    ~NnetReplica() { delete compiler; }
+
+    Nnet nnet;
+    CachingOptimizingCompiler *compiler;
+};
 
 LidModel::LidModel(const char *lid_path) {
     std::string language_path_str(lid_path);
@@ -21,7 +38,6 @@ LidModel::LidModel(const char *lid_path) {
 
     ReadConfigFromFile(language_path_str + "/mfcc.conf", &mfcc_opts);
     ReadConfigFromFile(language_path_str + "/vad.conf", &opts);
-    lidvector_mfcc_opts.frame_opts.allow_downsample = true; // It is safe to downsample
     plda_rxfilename = language_path_str + "/plda_adapt.smooth0.1";
     mean_rxfilename = language_path_str + "/mean.vec";
     transform_rxfilename = language_path_str + "/transform.mat";
@@ -75,13 +91,477 @@ LidModel::LidModel(const char *lid_path) {
 
     KALDI_LOG << "Read " << num_train_ivectors << " training iVectors, "
               << "errors on " << num_train_errs;
+
+    for (auto const &x : num_utts) {
+        if (train_ivectors.count(x.first) == 0) {
+            KALDI_WARN << "Key " << x.first << " not present in training iVectors.";
+            continue;
+        }
+        languages.push_back(x.first);
+        language_utts.push_back(x.second);
+        language_ivectors.push_back(Vector<double>(*train_ivectors[x.first]));
+    }
+    // Only the tables above are used for scoring
+    for (auto &x : train_ivectors)
+        delete x.second;
+    train_ivectors.clear();
+
     SetBatchnormTestMode(true, &lid_nnet);
     SetDropoutTestMode(true, &lid_nnet);
     CollapseModel(nnet3::CollapseModelConfig(), &lid_nnet);
 
+    // Compiled computations are shared by all recognizers of the model
+    opts_nnet3.acoustic_scale = 1.0;
+    compiler = NewCompiler(lid_nnet);
+
+    frame_budget = 0;
+    frame_subsampling = 1;
+    input_frame_skip = 1;
+    nnet_fixed = false;
+    speech_gate = false;
+    gate_blocks = 0;
+    gate_rejected = 0;
+    num_workers = 0;
+    worker_queue_size = 0;
+    worker_affinity = kLidAffinityNone;
+    replicas_ready = false;
+    cascade_requests = 0;
+    cascade_escalations = 0;
     ref_cnt_ = 1;
 }
 
+LidModel::~LidModel()
+{
+    worker_pool.reset();
+    for (auto *replica : nnet_replicas)
+        delete replica;
+    delete compiler;
+}
+
+void LidModel::SetWorkers(int32 num_threads, int32 queue_size)
+{
+    std::shared_ptr<WorkerPool> old_pool;
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        num_workers = num_threads;
+        worker_queue_size = queue_size;
+        old_pool.swap(worker_pool);
+    }
+    // Waits for the queued requests outside of the lock
+    old_pool.reset();
+}
+
+void LidModel::SetWorkerAffinity(LidAffinity affinity)
+{
+    std::shared_ptr<WorkerPool> old_pool;
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        worker_affinity = affinity;
+        old_pool.swap(worker_pool);
+    }
+    old_pool.reset();
+}
+
+std::shared_ptr<WorkerPool> LidModel::Workers()
+{
+    std::lock_guard<std::mutex> lock(worker_mutex);
+    if (!worker_pool) {
+        const CpuTopology &topology = CpuTopology::Get();
+        std::vector<std::vector<int> > cpu_sets;
+        if (worker_affinity == kLidAffinityCores) {
+            for (int cpu : topology.Cpus())
+                cpu_sets.push_back(std::vector<int>(1, cpu));
+        } else if (worker_affinity == kLidAffinityNuma) {
+            for (int node = 0; node < topology.NumNodes(); node++)
+                cpu_sets.push_back(topology.NodeCpus(node));
+            if (topology.NumNodes() > 1)
+                std::call_once(replicas_once, [this] { CreateReplicas(); });
+        }
+
+        int32 threads = num_workers > 0 ? num_workers
+                        : cpu_sets.empty() ? std::max<int32>(std::thread::hardware_concurrency(), 1)
+                        : topology.NumCpus();
+        int32 queue_size = worker_queue_size > 0 ? worker_queue_size : 4 * threads;
+        worker_pool = std::make_shared<WorkerPool>(threads, queue_size, cpu_sets);
+    }
+    return worker_pool;
+}
+
+CachingOptimizingCompiler *LidModel::NewCompiler(const Nnet &nnet) const
+{
+    CachingOptimizingCompilerOptions compiler_config;
+    compiler_config.cache_capacity = COMPILER_CACHE_CAPACITY;
+    return new CachingOptimizingCompiler(nnet, opts_nnet3.optimize_config, compiler_config);
+}
+
+void LidModel::CreateReplicas()
+{
+    nnet_fixed = true;
+    // Each copy is made by a thread on its node, so that the first touch
+    // puts the weights into the memory of that node
+    const CpuTopology &topology = CpuTopology::Get();
+    std::vector<NnetReplica *> replicas(topology.NumNodes(), NULL);
+    for (int node = 0; node < topology.NumNodes(); node++) {
+        std::thread([&, node] {
+            PinCurrentThread(topology.NodeCpus(node));
+            NnetReplica *replica = new NnetReplica(lid_nnet);
+            replica->compiler = NewCompiler(replica->nnet);
+            replicas[node] = replica;
+        }).join();
+    }
+    KALDI_LOG << "Copied the network to " << replicas.size() << " NUMA nodes";
+    nnet_replicas.swap(replicas);
+    replicas_ready.store(true, std::memory_order_release);
+}
+
+bool LidModel::TrySubmit(std::function<void()> task)
+{
+    return Workers()->TrySubmit(std::move(task));
+}
+
+void LidModel::Submit(std::function<void()> task)
+{
+    Workers()->Submit(std::move(task));
+}
+
+int32 LidModel::LanguageIndex(const std::string &language) const
+{
+    auto it = std::lower_bound(languages.begin(), languages.end(), language);
+    if (it == languages.end() || *it != language)
+        return -1;
+    return it - languages.begin();
+}
+
+int32 LidModel::XvectorDim() const
+{
+    return mean.Dim();
+}
+
+// Splits the text form of a component into its tokens and values
+static std::vector<std::string> ComponentTokens(const Component &component)
+{
+    std::ostringstream os;
+    component.Write(os, false);
+    std::istringstream is(os.str());
+    std::vector<std::string> tokens;
+    std::string token;
+    while (is >> token)
+        tokens.push_back(token);
+    return tokens;
+}
+
+// Position of the value that follows a token, -1 if there is none
+static int32 TokenValue(const std::vector<std::string> &tokens, const std::string &token)
+{
+    for (size_t i = 0; i + 1 < tokens.size(); i++)
+        if (tokens[i] == token)
+            return i + 1;
+    return -1;
+}
+
+static Component *ComponentFromTokens(const std::vector<std::string> &tokens)
+{
+    std::ostringstream os;
+    for (auto const &token : tokens)
+        os << token << " ";
+    std::istringstream is(os.str());
+    return Component::ReadNew(is, false);
+}
+
+// Makes the statistics pooling of an x-vector network read every period-th
+// frame. The network only computes what its output depends on, so the
+// frame-level layers right below the pooling are evaluated at those frames
+// only, and the lower layers at the frames their context needs. Returns
+// false and leaves the network alone if it has no statistics components or
+// they are not in the usual one frame per output layout.
+static bool SetStatisticsPeriod(Nnet *nnet, int32 period)
+{
+    std::vector<int32> indexes;
+    std::vector<Component *> components;
+    int32 current_period = -1;
+    for (int32 c = 0; c < nnet->NumComponents(); c++) {
+        const Component *component = nnet->GetComponent(c);
+        std::string type = component->Type();
+        if (type != "StatisticsExtractionComponent" && type != "StatisticsPoolingComponent")
+            continue;
+        std::vector<std::string> tokens = ComponentTokens(*component);
+        int32 input_period = TokenValue(tokens, "<InputPeriod>");
+        if (input_period < 0)
+            break;
+        // The extraction has one input frame per output, its output
+        // period is the input period of the pooling
+        int32 this_period = atoi(tokens[input_period].c_str());
+        if (current_period == -1)
+            current_period = this_period;
+        if (this_period != current_period)
+            break;
+        tokens[input_period] = std::to_string(period);
+        if (type == "StatisticsExtractionComponent") {
+            int32 output_period = TokenValue(tokens, "<OutputPeriod>");
+            if (output_period < 0 || atoi(tokens[output_period].c_str()) != this_period)
+                break;
+            tokens[output_period] = std::to_string(period);
+        } else {
+            int32 left_context = TokenValue(tokens, "<LeftContext>");
+            int32 right_context = TokenValue(tokens, "<RightContext>");
+            if (left_context < 0 || right_context < 0)
+                break;
+            tokens[left_context] = std::to_string(atoi(tokens[left_context].c_str()) / period * period);
+            tokens[right_context] = std::to_string(atoi(tokens[right_context].c_str()) / period * period);
+        }
+        indexes.push_back(c);
+        components.push_back(ComponentFromTokens(tokens));
+    }
+
+    int32 num_stats = 0;
+    for (int32 c = 0; c < nnet->NumComponents(); c++) {
+        std::string type = nnet->GetComponent(c)->Type();
+        if (type == "StatisticsExtractionComponent" || type == "StatisticsPoolingComponent")
+            num_stats++;
+    }
+    if (components.empty() || static_cast<int32>(components.size()) != num_stats) {
+        for (auto *component : components)
+            delete component;
+        return false;
+    }
+    for (size_t i = 0; i < indexes.size(); i++)
+        nnet->SetComponent(indexes[i], components[i]);
+    return true;
+}
+
+bool LidModel::SetFrameSubsampling(int32 factor)
+{
+    if (factor < 1 || nnet_fixed)
+        return false;
+    if (SetStatisticsPeriod(&lid_nnet, factor)) {
+        // Computations compiled for the old layout are useless now
+        delete compiler;
+        compiler = NewCompiler(lid_nnet);
+        input_frame_skip = 1;
+    } else {
+        KALDI_LOG << "The network has no statistics pooling to subsample, skipping input frames instead";
+        input_frame_skip = factor;
+    }
+    frame_subsampling = factor;
+    return true;
+}
+
+void LidModel::ScoreXvector(const VectorBase<BaseFloat> &xvector,
+                            const std::vector<int32> &subset,
+                            std::vector<std::pair<int32, BaseFloat> > *scores) const
+{
+    Vector <BaseFloat> vec(xvector);
+    vec.AddVec(-1.0, mean);
+    int32 transform_rows = transform.NumRows();
+    int32 transform_cols = transform.NumCols();
+    int32 vec_dim = vec.Dim();
+    Vector <BaseFloat> vec_out(transform_rows);
+    if (transform_cols == vec_dim) {
+        vec_out.AddMatVec(1.0, transform, kNoTrans, vec, 0.0);
+    } else {
+        if (transform_cols != vec_dim + 1) {
+            KALDI_ERR << "Dimension mismatch: input vector has dimension "
+                      << vec.Dim() << " and transform has " << transform_cols
+                      << " columns.";
+        }
+        vec_out.CopyColFromMat(transform, vec_dim);
+        vec_out.AddMatVec(1.0, transform.Range(0, transform.NumRows(),
+                                               0, vec_dim), kNoTrans, vec, 1.0);
+    }
+
+    int32 num_examples = 1;   // this value is always used for test (affects the
+                           // length normalization in the TransformIvector
+                           // function).
+
+    int32 plda_dim = plda.Dim();
+    Vector <BaseFloat> transformed_ivector(plda_dim);
+    plda.TransformIvector(plda_config, vec_out,
+                          num_examples, &transformed_ivector);
+    Vector<double> test_ivector_dbl(transformed_ivector);
+
+    // Only the selected languages are scored, all of them if none are given
+    int32 num_langs = subset.empty() ? NumLanguages() : subset.size();
+    scores->clear();
+    scores->reserve(num_langs);
+    for (int32 i = 0; i < num_langs; i++) {
+        int32 lang = subset.empty() ? i : subset[i];
+        BaseFloat score = plda.LogLikelihoodRatio(language_ivectors[lang],
+                                                  language_utts[lang],
+                                                  test_ivector_dbl);
+        scores->push_back(std::make_pair(lang, score));
+    }
+}
+
+bool LidModel::ComputeXvectors(std::vector<XvectorInput> *inputs,
+                               const Deadline *deadline) const
+{
+    // Inputs shorter than this are padded by repeating their edge frames
+    const int32 min_chunk_size = 25;
+
+    // num_rows of features starting at offset, of which every
+    // input_frame_skip-th goes to the network as one of net_rows frames
+    struct Chunk {
+        int32 input;
+        int32 offset;
+        int32 num_rows;
+        int32 net_rows;
+    };
+    nnet_fixed = true;
+    std::vector<Chunk> chunks;
+    for (size_t i = 0; i < inputs->size(); i++) {
+        const MatrixBase<BaseFloat> &features = *(*inputs)[i].features;
+        int32 num_rows = features.NumRows();
+        int32 this_chunk_size = (*inputs)[i].chunk_size;
+        if (this_chunk_size <= 0 || num_rows < this_chunk_size)
+            this_chunk_size = num_rows;
+        for (int32 offset = 0; offset < num_rows; offset += this_chunk_size) {
+            Chunk chunk;
+            chunk.input = i;
+            chunk.offset = offset;
+            chunk.num_rows = std::min(this_chunk_size, num_rows - offset);
+            chunk.net_rows = (chunk.num_rows + input_frame_skip - 1) / input_frame_skip;
+            chunks.push_back(chunk);
+        }
+    }
+
+    // With copies on several NUMA nodes the one of the node we run on is used
+    const Nnet *nnet = &lid_nnet;
+    CachingOptimizingCompiler *pass_compiler = compiler;
+    if (replicas_ready.load(std::memory_order_acquire)) {
+        const NnetReplica *replica = nnet_replicas[CpuTopology::Get().CurrentNode()];
+        nnet = &replica->nnet;
+        pass_compiler = replica->compiler;
+    }
+
+    // The x-vector of an input is the average of its chunks weighted by
+    // length. The original Nnet3XvectorCompute kept only the x-vector of the
+    // last chunk, so inputs longer than one chunk, and every recording cut
+    // into segments by the frame budget, score differently than it did.
+    std::vector<BaseFloat> tot_weight(inputs->size(), 0.0);
+    for (size_t i = 0; i < inputs->size(); i++) {
+        (*inputs)[i].xvector.Resize(0);
+        (*inputs)[i].bytes_copied = 0;
+    }
+    bool complete = true;
+    size_t pass_begin = 0;
+    while (pass_begin < chunks.size()) {
+        if (deadline != NULL && deadline->Expired()) {
+            complete = false;
+            break;
+        }
+
+        // Without a deadline everything goes in one pass
+        size_t pass_end = pass_begin;
+        int32 total_rows = 0;
+        while (pass_end < chunks.size() &&
+               (deadline == NULL || pass_end == pass_begin ||
+                total_rows + chunks[pass_end].net_rows <= DEADLINE_PASS_FRAMES)) {
+            total_rows += std::max(chunks[pass_end].net_rows, min_chunk_size);
+            pass_end++;
+        }
+
+        // A pass that holds a whole movable input without padding has the
+        // rows of the network input in the same order, so the matrix is
+        // taken as it is
+        XvectorInput &first = (*inputs)[chunks[pass_begin].input];
+        bool take = first.movable_features != NULL && chunks[pass_begin].offset == 0 &&
+                    input_frame_skip == 1;
+        int32 covered_rows = 0;
+        for (size_t c = pass_begin; c < pass_end && take; c++) {
+            take = chunks[c].input == chunks[pass_begin].input && chunks[c].num_rows >= min_chunk_size;
+            covered_rows += chunks[c].num_rows;
+        }
+        take = take && covered_rows == first.features->NumRows();
+
+        // Every chunk is a separate sequence n of the request, so a single
+        // pass produces one x-vector per chunk
+        int32 feat_dim = first.features->NumCols();
+        Matrix<BaseFloat> input_feats;
+        if (take)
+            input_feats.Swap(first.movable_features);
+        else
+            input_feats.Resize(total_rows, feat_dim, kUndefined);
+        nnet3::ComputationRequest request;
+        request.need_model_derivative = false;
+        request.store_component_stats = false;
+        request.inputs.resize(1);
+        request.inputs[0].name = "input";
+        request.inputs[0].indexes.reserve(total_rows);
+        request.outputs.resize(1);
+        request.outputs[0].name = "output";
+        request.outputs[0].has_deriv = false;
+        int32 row = 0;
+        for (size_t c = pass_begin; c < pass_end; c++) {
+            const Chunk &chunk = chunks[c];
+            int32 n = c - pass_begin;
+            int32 rows = std::max(chunk.net_rows, min_chunk_size);
+            if (!take) {
+                XvectorInput &input = (*inputs)[chunk.input];
+                SubMatrix<BaseFloat> sub_features(input.features->RowRange(chunk.offset, chunk.num_rows));
+                int32 left_context = (rows - chunk.net_rows) / 2;
+                int32 right_context = rows - chunk.net_rows - left_context;
+                int32 last_row = (chunk.net_rows - 1) * input_frame_skip;
+                for (int32 i = 0; i < left_context; i++)
+                    input_feats.Row(row + i).CopyFromVec(sub_features.Row(0));
+                if (input_frame_skip == 1) {
+                    input_feats.RowRange(row + left_context, chunk.num_rows).CopyFromMat(sub_features);
+                } else {
+                    for (int32 i = 0; i < chunk.net_rows; i++)
+                        input_feats.Row(row + left_context + i).CopyFromVec(sub_features.Row(i * input_frame_skip));
+                }
+                for (int32 i = 0; i < right_context; i++)
+                    input_feats.Row(row + rows - i - 1).CopyFromVec(sub_features.Row(last_row));
+                input.bytes_copied += static_cast<int64>(rows) * feat_dim * sizeof(BaseFloat);
+            }
+            for (int32 t = 0; t < rows; t++)
+                request.inputs[0].indexes.push_back(nnet3::Index(n, t, 0));
+            request.outputs[0].indexes.push_back(nnet3::Index(n, 0, 0));
+            row += rows;
+        }
+
+        std::shared_ptr<const nnet3::NnetComputation> computation = pass_compiler->Compile(request);
+        nnet3::Nnet *nnet_to_update = NULL;  // we're not doing any update.
+        nnet3::NnetComputer computer(nnet3::NnetComputeOptions(), *computation,
+                                     *nnet, nnet_to_update);
+        CuMatrix<BaseFloat> input_feats_cu;
+        input_feats_cu.Swap(&input_feats);
+        computer.AcceptInput("input", &input_feats_cu);
+        computer.Run();
+        CuMatrix<BaseFloat> cu_output;
+        computer.GetOutputDestructive("output", &cu_output);
+        Matrix<BaseFloat> output;
+        cu_output.Swap(&output);
+
+        for (size_t c = pass_begin; c < pass_end; c++) {
+            XvectorInput &input = (*inputs)[chunks[c].input];
+            if (input.xvector.Dim() != output.NumCols())
+                input.xvector.Resize(output.NumCols());
+            input.xvector.AddVec(chunks[c].num_rows, output.Row(c - pass_begin));
+            tot_weight[chunks[c].input] += chunks[c].num_rows;
+        }
+        pass_begin = pass_end;
+    }
+
+    for (size_t i = 0; i < inputs->size(); i++) {
+        XvectorInput &input = (*inputs)[i];
+        input.frames_used = static_cast<int32>(tot_weight[i]);
+        if (tot_weight[i] > 0)
+            input.xvector.Scale(1.0 / tot_weight[i]);
+        else
+            input.xvector.Resize(0);
+    }
+    return complete;
+}
+
+void LidModel::Warm() const
+{
+    Matrix<BaseFloat> features(WARM_FRAMES, lid_nnet.InputDim("input"));
+    std::vector<XvectorInput> inputs(1);
+    inputs[0].features = &features;
+    inputs[0].chunk_size = 0;
+    ComputeXvectors(&inputs);
+}
+
 void LidModel::Ref()
 {
     ref_cnt_++;
@@ -89,8 +569,59 @@ void LidModel::Ref()
 
 void LidModel::Unref()
 {
-    ref_cnt_--;
-    if (ref_cnt_ == 0) {
+    if (--ref_cnt_ == 0) {
+        // A worker can't join itself, so the pool is stopped from another
+        // thread when the last reference is dropped in a result callback
+        std::shared_ptr<WorkerPool> pool;
+        {
+            std::lock_guard<std::mutex> lock(worker_mutex);
+            pool = worker_pool;
+        }
+        if (pool && pool->IsWorkerThread()) {
+            pool.reset();
+            std::thread([this] { delete this; }).detach();
+            return;
+        }
+        pool.reset();
         delete this;
     }
 }
+
+void LidModel::CopySettings(const LidModel &other)
+{
+    frame_budget = other.frame_budget;
+    speech_gate = other.speech_gate;
+    if (other.frame_subsampling != frame_subsampling)
+        SetFrameSubsampling(other.frame_subsampling);
+    xvector_cache.SetMaxBytes(other.xvector_cache.MaxBytes());
+    int32 other_workers, other_queue_size;
+    LidAffinity other_affinity;
+    {
+        std::lock_guard<std::mutex> lock(other.worker_mutex);
+        other_workers = other.num_workers;
+        other_queue_size = other.worker_queue_size;
+        other_affinity = other.worker_affinity;
+    }
+    std::lock_guard<std::mutex> lock(worker_mutex);
+    num_workers = other_workers;
+    worker_queue_size = other_queue_size;
+    worker_affinity = other_affinity;
+}
+
+bool LidModel::CascadesWith(const LidModel &other) const
+{
+    const FrameExtractionOptions &frame = mfcc_opts.frame_opts;
+    const FrameExtractionOptions &other_frame = other.mfcc_opts.frame_opts;
+    bool same_mfcc = frame.samp_freq == other_frame.samp_freq &&
+                     frame.frame_shift_ms == other_frame.frame_shift_ms &&
+                     frame.frame_length_ms == other_frame.frame_length_ms &&
+                     mfcc_opts.num_ceps == other.mfcc_opts.num_ceps &&
+                     mfcc_opts.mel_opts.num_bins == other.mfcc_opts.mel_opts.num_bins &&
+                     mfcc_opts.use_energy == other.mfcc_opts.use_energy;
+    bool same_cmn_vad = sliding_opts.cmn_window == other.sliding_opts.cmn_window &&
+                        sliding_opts.center == other.sliding_opts.center &&
+                        sliding_opts.normalize_variance == other.sliding_opts.normalize_variance &&
+                        opts.vad_energy_threshold == other.opts.vad_energy_threshold &&
+                        opts.vad_energy_mean_scale == other.opts.vad_energy_mean_scale;
+    return same_mfcc && same_cmn_vad && languages == other.languages;
+}
@@ -27,6 +27,14 @@
 #include "nnet3/nnet-am-decodable-simple.h"
 #include "base/timer.h"
 #include "ivector/plda.h"
+#include "xvector_cache.h"
+#include "worker_pool.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 using namespace kaldi;
 using namespace kaldi::nnet3;
@@ -37,6 +45,56 @@ typedef unordered_map<string, Vector<BaseFloat>*, StringHasher> HashType;
 
 class KaldiRecognizer;
 
+// Voiced features of one utterance that are cut into chunks of chunk_size
+// frames for the network, and the x-vector computed from them, the average
+// of the chunk x-vectors weighted by chunk length.
+// frames_used is the number of frames the x-vector was computed from, less
+// than the number of rows if the computation was stopped early.
+// If movable_features is the matrix behind features and not needed
+// afterwards, a network pass over all of it without padding takes its
+// memory as the network input instead of copying it, leaving it empty.
+// bytes_copied counts the feature bytes copied into the network input.
+struct XvectorInput {
+    const MatrixBase<BaseFloat> *features;
+    int32 chunk_size;
+    Vector<BaseFloat> xvector;
+    int32 frames_used;
+    Matrix<BaseFloat> *movable_features = NULL;
+    int64 bytes_copied = 0;
+};
+
+// Keep in sync with L2mAffinity in lid_api.h
+enum LidAffinity {
+    kLidAffinityNone = 0,
+    kLidAffinityCores = 1,
+    kLidAffinityNuma = 2
+};
+
+// Keep in sync with L2mStatus in lid_api.h
+enum LidStatus {
+    kLidOk = 0,
+    kLidDeadlineExceeded = 1,
+    kLidCancelled = 2
+};
+
+// Limit on the time spent on a result. The timeout counts from construction
+// and is disabled if negative, the cancel flag may be set to non-zero by
+// another thread at any moment and is ignored if NULL.
+class Deadline {
+public:
+    Deadline(int32 timeout_ms, const int *cancel) : timeout_(timeout_ms / 1000.0), cancel_(cancel) {}
+
+    bool Cancelled() const { return cancel_ != NULL && *static_cast<const volatile int *>(cancel_) != 0; }
+    bool TimedOut() const { return timeout_ >= 0 && timer_.Elapsed() >= timeout_; }
+    bool Expired() const { return Cancelled() || TimedOut(); }
+    LidStatus Status() const { return Cancelled() ? kLidCancelled : kLidDeadlineExceeded; }
+
+private:
+    double timeout_;
+    const int *cancel_;
+    Timer timer_;
+};
+
 class LidModel {
 
 public:
@@ -44,8 +102,99 @@ public:
     void Ref();
     void Unref();
 
+    // Returns the index of the language in the scoring tables or -1
+    int32 LanguageIndex(const std::string &language) const;
+    int32 NumLanguages() const { return languages.size(); }
+    const std::string &Language(int32 index) const { return languages[index]; }
+
+    // Dimension of the raw x-vectors produced by the network
+    int32 XvectorDim() const;
+
+    // Rate of the audio the features are computed from
+    BaseFloat SampleFrequency() const { return mfcc_opts.frame_opts.samp_freq; }
+
+    // Computes PLDA scores of a raw x-vector against the languages in subset
+    // (all languages if it is empty) as (language index, score) pairs.
+    // Safe to call concurrently, the model is not modified.
+    void ScoreXvector(const VectorBase<BaseFloat> &xvector,
+                      const std::vector<int32> &subset,
+                      std::vector<std::pair<int32, BaseFloat> > *scores) const;
+
+    // Default frame budget of recognizers created afterwards, 0 is unlimited
+    void SetFrameBudget(int32 max_frames) { frame_budget = max_frames; }
+
+    // Runs the network at a frame rate reduced by factor, trading some
+    // accuracy for speed. The statistics pooling of the x-vector network
+    // then reads every factor-th frame, so the layers below it are evaluated
+    // at fewer frames. A network without statistics pooling gets every
+    // factor-th input frame instead. Must be called before the model
+    // computes anything, returns false afterwards or for a factor below 1.
+    bool SetFrameSubsampling(int32 factor);
+    int32 FrameSubsampling() const { return frame_subsampling; }
+
+    // Whether recognizers created afterwards drop blocks of raw audio that
+    // clearly hold no speech before computing features
+    void SetSpeechGate(bool enabled) { speech_gate = enabled; }
+    // Blocks seen by the speech gates of all recognizers and blocks dropped
+    void GetSpeechGateStats(int64 *blocks, int64 *rejected) const {
+        *blocks = gate_blocks;
+        *rejected = gate_rejected;
+    }
+
+    // Computes the x-vectors of all inputs. The chunks of all inputs are
+    // evaluated together in one network computation with one sequence per
+    // chunk. Safe to call concurrently, the compiler cache is thread-safe.
+    // With a deadline the chunks are evaluated in several smaller passes and
+    // the computation stops at the first expired check, leaving x-vectors of
+    // the chunks done so far; returns false in that case. The chunks are the
+    // same either way, so a complete x-vector doesn't depend on the deadline.
+    bool ComputeXvectors(std::vector<XvectorInput> *inputs,
+                         const Deadline *deadline = NULL) const;
+
+    // Runs the network once over a short dummy input, so that faulting in
+    // the weights and compiling a computation is not left to the first
+    // requests. Fixes the network like a computation does.
+    void Warm() const;
+
+    // Takes over the frame budget, frame subsampling, speech gate, cache
+    // size and worker settings of another model, for a model that replaces
+    // it before it is used
+    void CopySettings(const LidModel &other);
+
+    // True if the other model computes x-vectors from the same features
+    // and scores the same languages, so it can follow this one in a cascade
+    bool CascadesWith(const LidModel &other) const;
+    // Results of cascades with this model as the small one, and how many
+    // of them needed the large model
+    void GetCascadeStats(int64 *requests, int64 *escalations) const {
+        *requests = cascade_requests;
+        *escalations = cascade_escalations;
+    }
+
+    void SetCacheSize(size_t max_bytes) { xvector_cache.SetMaxBytes(max_bytes); }
+    void GetCacheStats(int64 *hits, int64 *misses, int64 *bytes) const {
+        xvector_cache.GetStats(hits, misses, bytes);
+    }
+
+    // Threads and queue length of the worker pool that runs asynchronous
+    // requests, 0 threads for one per core. Replaces the pool after the
+    // requests already queued are done.
+    void SetWorkers(int32 num_threads, int32 queue_size);
+    // Pins the worker threads to single CPUs, or spreads them over the NUMA
+    // nodes pinned to the CPUs of their node. With several nodes the latter
+    // also makes a copy of the network on each node that is used by the
+    // threads running there. With pinning, 0 threads means one per CPU the
+    // process may use. Replaces the pool like SetWorkers.
+    void SetWorkerAffinity(LidAffinity affinity);
+    // Runs the task on the worker pool, which is started on first use.
+    // TrySubmit returns false instead of waiting when the queue is full.
+    bool TrySubmit(std::function<void()> task);
+    void Submit(std::function<void()> task);
+
 protected:
     friend class KaldiRecognizer;
+    friend class LidBench;
+    ~LidModel();
 
     std::string plda_rxfilename;
     std::string train_ivector_rspecifier;
@@ -65,11 +214,50 @@ protected:
     NnetSimpleComputationOptions opts_nnet3;
 
     Nnet lid_nnet;
+    CachingOptimizingCompiler *compiler;
+    CachingOptimizingCompiler *NewCompiler(const Nnet &nnet) const;
     Plda plda;
     Vector<BaseFloat> mean;
     Matrix<BaseFloat> transform;
-    MfccOptions lidvector_mfcc_opts;
 
-    int ref_cnt_;
+    // Languages in scoring order with their PLDA-transformed training
+    // x-vectors, so that recognizers can score a subset by index
+    std::vector<std::string> languages;
+    std::vector<int32> language_utts;
+    std::vector<Vector<double> > language_ivectors;
+
+    int32 frame_budget;
+    // The factor of SetFrameSubsampling, and the part of it applied by
+    // skipping input frames when the network can't subsample itself
+    int32 frame_subsampling;
+    int32 input_frame_skip;
+    // Set once the network was used, it can't be changed anymore
+    mutable std::atomic<bool> nnet_fixed;
+    bool speech_gate;
+    std::atomic<int64> gate_blocks;
+    std::atomic<int64> gate_rejected;
+
+    // Results of recently seen audio, disabled until a size is set
+    XvectorCache xvector_cache;
+
+    std::shared_ptr<WorkerPool> Workers();
+    mutable std::mutex worker_mutex;
+    std::shared_ptr<WorkerPool> worker_pool;
+    int32 num_workers;
+    int32 worker_queue_size;
+    LidAffinity worker_affinity;
+
+    // Copies of lid_nnet indexed by NUMA node, made once when the workers
+    // are first spread over several nodes and kept until destruction
+    struct NnetReplica;
+    void CreateReplicas();
+    std::once_flag replicas_once;
+    std::atomic<bool> replicas_ready;
+    std::vector<NnetReplica *> nnet_replicas;
+
+    std::atomic<int64> cascade_requests;
+    std::atomic<int64> cascade_escalations;
+
+    std::atomic<int> ref_cnt_;
 };
 #endif /* LID_MODEL_H_ */
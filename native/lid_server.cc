@@ -0,0 +1,500 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Language identification daemon. The model is loaded once and shared by
+// all clients, which stream audio over a Unix domain socket. Every client
+// connection has a thread and a recognizer of its own; result requests of
+// all clients go to a queue, and the batch threads compute up to
+// --batch-size of them with one network pass.
+//
+// Messages in both directions are frames: a 4 byte little-endian length of
+// the rest of the frame, a 1 byte type and the payload.
+//
+//   client -> server
+//     'O' open    uint32 sample rate (4000 to 192000), int32 max results (0 for all), uint8
+//                 language names flag, then an optional comma separated list
+//                 of language codes. Starts a session, dropping the audio of
+//                 the previous one.
+//     'A' audio   16-bit little-endian PCM samples at the session rate
+//     'R' result  asks for the result of all audio of the session so far
+//     'Z' reset   drops the audio of the session
+//
+//   server -> client
+//     'L' languages  reply to 'O': uint32 count, then for every language of
+//                 the model in index order a uint8 length and the code, and
+//                 with the language names flag a uint8 length and the name
+//     'R' result  uint32 count, then count pairs of uint32 language index
+//                 and float32 score, best first. Empty for too little speech.
+//     'E' error   a message. The connection is closed after malformed frames
+//                 and failures of the recognizer, and stays usable otherwise.
+//
+// Every 'O' request gets one 'L' or 'E' reply and every 'R' request one 'R'
+// or 'E' reply, in order. All numbers are little-endian.
+
+#include "kaldi_recognizer.h"
+#include "language_names.h"
+#include "lid_model.h"
+#include "bounded_queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <future>
+#include <list>
+#include <thread>
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define FRAME_HEADER_SIZE 5
+#define FRAME_OPEN 'O'
+#define FRAME_AUDIO 'A'
+#define FRAME_RESULT 'R'
+#define FRAME_RESET 'Z'
+#define FRAME_ERROR 'E'
+#define FRAME_LANGUAGES 'L'
+#define OPEN_HEADER_SIZE 9
+#define ACCEPT_POLL_MS 500
+#define MIN_SAMPLE_RATE 4000
+#define MAX_SAMPLE_RATE 192000
+
+typedef std::chrono::steady_clock Clock;
+
+struct ServerOptions {
+    int32 batch_threads;
+    int32 batch_size;
+    int32 batch_wait_ms;
+    int32 queue_size;
+    int32 max_clients;
+    int32 max_frame_bytes;
+
+    ServerOptions() : batch_threads(0), batch_size(16), batch_wait_ms(2), queue_size(256),
+                      max_clients(256), max_frame_bytes(1 << 20) {}
+
+    void Register(ParseOptions *po) {
+        po->Register("batch-threads", &batch_threads, "Threads running the network for queued result requests, 0 for the number of cores");
+        po->Register("batch-size", &batch_size, "Maximum number of result requests in one network pass");
+        po->Register("batch-wait-ms", &batch_wait_ms, "Time in milliseconds a batch waits for more requests once it has one");
+        po->Register("queue-size", &queue_size, "Capacity of the queue of result requests, clients block while it is full");
+        po->Register("max-clients", &max_clients, "Maximum number of connected clients, more are refused");
+        po->Register("max-frame-bytes", &max_frame_bytes, "Largest accepted frame, larger frames close the connection");
+    }
+};
+
+struct ServerStats {
+    std::atomic<int64> connections;
+    std::atomic<int64> results;
+    std::atomic<int64> batches;
+
+    ServerStats() : connections(0), results(0), batches(0) {}
+};
+
+// A result request of one client, fulfilled by a batch thread with the
+// payload of the 'R' frame
+struct ResultRequest {
+    KaldiRecognizer *recognizer;
+    std::promise<std::string> result;
+};
+
+typedef BoundedQueue<ResultRequest *> RequestQueue;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void RequestStop(int)
+{
+    stop_requested = 1;
+}
+
+static uint32 DecodeUint32(const char *data)
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32>(p[3]) << 24);
+}
+
+static void EncodeUint32(uint32 value, char *data)
+{
+    for (int i = 0; i < 4; i++)
+        data[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+}
+
+static void AppendUint32(uint32 value, std::string *data)
+{
+    char bytes[4];
+    EncodeUint32(value, bytes);
+    data->append(bytes, 4);
+}
+
+static void AppendString(const std::string &value, std::string *data)
+{
+    size_t size = std::min<size_t>(value.size(), 255);
+    data->push_back(static_cast<char>(size));
+    data->append(value, 0, size);
+}
+
+static std::string EncodeScores(const std::vector<std::pair<int32, BaseFloat> > &scores)
+{
+    std::string payload;
+    payload.reserve(4 + 8 * scores.size());
+    AppendUint32(scores.size(), &payload);
+    for (auto const &score : scores) {
+        float value = score.second;
+        uint32 bits;
+        memcpy(&bits, &value, sizeof(bits));
+        AppendUint32(score.first, &payload);
+        AppendUint32(bits, &payload);
+    }
+    return payload;
+}
+
+static void BatchStage(const ServerOptions &opts, RequestQueue *requests, ServerStats *stats)
+{
+    ResultRequest *request;
+    while (requests->Pop(&request)) {
+        // Requests of other clients arriving within the wait join the pass
+        std::vector<ResultRequest *> batch(1, request);
+        Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(opts.batch_wait_ms);
+        while (batch.size() < static_cast<size_t>(opts.batch_size) && requests->PopUntil(&request, deadline))
+            batch.push_back(request);
+
+        std::vector<KaldiRecognizer *> recognizers;
+        for (auto *r : batch)
+            recognizers.push_back(r->recognizer);
+        std::vector<const char *> results(batch.size());
+        try {
+            KaldiRecognizer::LangResults(recognizers.data(), recognizers.size(), results.data());
+            for (size_t i = 0; i < batch.size(); i++)
+                batch[i]->result.set_value(EncodeScores(recognizers[i]->ResultScores()));
+        } catch (const std::exception &e) {
+            KALDI_WARN << "Failed to compute the results: " << e.what();
+            for (auto *r : batch)
+                r->result.set_exception(std::current_exception());
+        }
+        stats->batches++;
+        stats->results += batch.size();
+    }
+}
+
+class Connection {
+public:
+    Connection(int fd, LidModel *model, const ServerOptions &opts, RequestQueue *requests)
+        : fd_(fd), model_(model), opts_(opts), requests_(requests), recognizer_(NULL), finished_(false) {}
+    ~Connection() {
+        delete recognizer_;
+        close(fd_);
+    }
+
+    void Serve();
+    // Makes a blocked Serve return, for the server shutdown
+    void Shutdown() { shutdown(fd_, SHUT_RDWR); }
+    bool Finished() const { return finished_; }
+
+private:
+    bool ReadFully(char *data, size_t size);
+    bool WriteFrame(char type, const std::string &payload);
+    // Returns false if the connection has to be closed
+    bool HandleFrame(char type, const std::string &payload);
+    bool Open(const std::string &payload);
+    bool Result();
+
+    int fd_;
+    LidModel *model_;
+    const ServerOptions &opts_;
+    RequestQueue *requests_;
+    KaldiRecognizer *recognizer_;
+    std::atomic<bool> finished_;
+};
+
+bool Connection::ReadFully(char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = read(fd_, data, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool Connection::WriteFrame(char type, const std::string &payload)
+{
+    std::string frame(FRAME_HEADER_SIZE, '\0');
+    EncodeUint32(payload.size() + 1, &frame[0]);
+    frame[4] = type;
+    frame += payload;
+
+    const char *data = frame.data();
+    size_t size = frame.size();
+    while (size > 0) {
+        ssize_t n = send(fd_, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+void Connection::Serve()
+{
+    char header[FRAME_HEADER_SIZE];
+    std::string payload;
+    while (ReadFully(header, FRAME_HEADER_SIZE)) {
+        uint32 length = DecodeUint32(header);
+        if (length < 1 || length > static_cast<uint32>(opts_.max_frame_bytes)) {
+            WriteFrame(FRAME_ERROR, "invalid frame length");
+            break;
+        }
+        payload.resize(length - 1);
+        if (!payload.empty() && !ReadFully(&payload[0], payload.size()))
+            break;
+        // A recognizer failing on what one client sent ends that client only
+        bool keep;
+        try {
+            keep = HandleFrame(header[4], payload);
+        } catch (const std::exception &e) {
+            KALDI_WARN << "Closing a connection after an error: " << e.what();
+            WriteFrame(FRAME_ERROR, e.what());
+            keep = false;
+        }
+        if (!keep)
+            break;
+    }
+    finished_ = true;
+}
+
+bool Connection::HandleFrame(char type, const std::string &payload)
+{
+    switch (type) {
+    case FRAME_OPEN:
+        return Open(payload);
+    case FRAME_AUDIO:
+        if (!recognizer_)
+            return WriteFrame(FRAME_ERROR, "audio before open");
+        if (payload.size() % 2 != 0) {
+            WriteFrame(FRAME_ERROR, "audio frame with an odd number of bytes");
+            return false;
+        }
+        recognizer_->AcceptWaveform(payload.data(), payload.size());
+        return true;
+    case FRAME_RESULT:
+        if (!recognizer_)
+            return WriteFrame(FRAME_ERROR, "result before open");
+        return Result();
+    case FRAME_RESET:
+        if (recognizer_)
+            recognizer_->Reset();
+        return true;
+    default:
+        WriteFrame(FRAME_ERROR, "unknown frame type");
+        return false;
+    }
+}
+
+bool Connection::Open(const std::string &payload)
+{
+    if (payload.size() < OPEN_HEADER_SIZE) {
+        WriteFrame(FRAME_ERROR, "open frame too short");
+        return false;
+    }
+    uint32 sample_rate = DecodeUint32(payload.data());
+    int32 max_results = static_cast<int32>(DecodeUint32(payload.data() + 4));
+    bool language_names = payload[8] != 0;
+    std::string languages = payload.substr(OPEN_HEADER_SIZE);
+    if (sample_rate < MIN_SAMPLE_RATE || sample_rate > MAX_SAMPLE_RATE || max_results < 0)
+        return WriteFrame(FRAME_ERROR, "invalid open parameters");
+
+    delete recognizer_;
+    recognizer_ = NULL;
+    recognizer_ = new KaldiRecognizer(model_, sample_rate);
+    recognizer_->SetMaxResults(max_results);
+    if (!languages.empty() && !recognizer_->SetLanguages(languages.c_str())) {
+        delete recognizer_;
+        recognizer_ = NULL;
+        return WriteFrame(FRAME_ERROR, "no supported language in the list");
+    }
+
+    // Results refer to the languages by index in this table
+    std::string table;
+    AppendUint32(model_->NumLanguages(), &table);
+    for (int32 i = 0; i < model_->NumLanguages(); i++) {
+        const std::string &code = model_->Language(i);
+        AppendString(code, &table);
+        if (language_names) {
+            const char *name = GetLanguageName(code.c_str());
+            AppendString(name ? name : code, &table);
+        }
+    }
+    return WriteFrame(FRAME_LANGUAGES, table);
+}
+
+bool Connection::Result()
+{
+    // The recognizer is left alone until the batch thread is done with it
+    ResultRequest request;
+    request.recognizer = recognizer_;
+    std::future<std::string> result = request.result.get_future();
+    if (!requests_->Push(&request))
+        return WriteFrame(FRAME_ERROR, "server is shutting down");
+    try {
+        return WriteFrame(FRAME_RESULT, result.get());
+    } catch (const std::exception &e) {
+        return WriteFrame(FRAME_ERROR, e.what());
+    }
+}
+
+// Binds the socket, replacing the socket file of a server that is gone but
+// never a live server or another kind of file
+static int ListenUnix(const std::string &path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        KALDI_ERR << "Socket path too long: " << path;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        KALDI_ERR << "Can't create socket: " << strerror(errno);
+
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode))
+            KALDI_ERR << path << " exists and is not a socket";
+        if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0)
+            KALDI_ERR << "Another server is listening on " << path;
+        unlink(path.c_str());
+    }
+
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0)
+        KALDI_ERR << "Can't bind " << path << ": " << strerror(errno);
+    if (listen(fd, SOMAXCONN) != 0)
+        KALDI_ERR << "Can't listen on " << path << ": " << strerror(errno);
+    return fd;
+}
+
+typedef std::list<std::pair<Connection *, std::thread> > ConnectionList;
+
+static void ReapConnections(ConnectionList *connections, bool all)
+{
+    for (auto it = connections->begin(); it != connections->end();) {
+        if (all || it->first->Finished()) {
+            it->second.join();
+            delete it->first;
+            it = connections->erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *usage =
+        "Serves language identification over a Unix domain socket. The model is\n"
+        "loaded once, clients stream 16-bit PCM audio in binary frames and result\n"
+        "requests of all clients are batched into shared network passes. Stops on\n"
+        "SIGINT or SIGTERM. See lid_server.cc for the frame format.\n"
+        "\n"
+        "Usage: lid-server [options] <model-dir> <socket-path>\n"
+        "e.g.: lid-server --batch-size=32 lid-model /tmp/lid.sock\n";
+
+    ParseOptions po(usage);
+    ServerOptions opts;
+    opts.Register(&po);
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+        po.PrintUsage();
+        return 1;
+    }
+
+    opts.batch_size = std::max(opts.batch_size, 1);
+    opts.batch_wait_ms = std::max(opts.batch_wait_ms, 0);
+    opts.queue_size = std::max(opts.queue_size, 1);
+    opts.max_frame_bytes = std::max(opts.max_frame_bytes, OPEN_HEADER_SIZE + 1);
+    if (opts.batch_threads <= 0)
+        opts.batch_threads = std::max<int32>(std::thread::hardware_concurrency(), 1);
+
+    std::string socket_path = po.GetArg(2);
+    LidModel *model = new LidModel(po.GetArg(1).c_str());
+    int listen_fd = ListenUnix(socket_path);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = RequestStop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    ServerStats stats;
+    RequestQueue requests(opts.queue_size);
+    std::vector<std::thread> batchers;
+    for (int32 i = 0; i < opts.batch_threads; i++)
+        batchers.emplace_back(BatchStage, std::cref(opts), &requests, &stats);
+
+    KALDI_LOG << "Listening on " << socket_path << " with " << opts.batch_threads << " batch threads";
+
+    ConnectionList connections;
+    while (!stop_requested) {
+        struct pollfd pfd;
+        pfd.fd = listen_fd;
+        pfd.events = POLLIN;
+        int ready = poll(&pfd, 1, ACCEPT_POLL_MS);
+        ReapConnections(&connections, false);
+        if (ready <= 0)
+            continue;
+
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        Connection *connection = new Connection(fd, model, opts, &requests);
+        if (connections.size() >= static_cast<size_t>(opts.max_clients)) {
+            KALDI_WARN << "Refusing a client, " << connections.size() << " are connected";
+            delete connection;
+            continue;
+        }
+        stats.connections++;
+        connections.emplace_back(connection, std::thread(&Connection::Serve, connection));
+    }
+
+    // Clients waiting for a result get it before the batch threads stop
+    KALDI_LOG << "Shutting down";
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    for (auto &c : connections)
+        c.first->Shutdown();
+    ReapConnections(&connections, true);
+    requests.Close();
+    for (auto &thread : batchers)
+        thread.join();
+
+    int64 batches = stats.batches;
+    int64 results = stats.results;
+    KALDI_LOG << "Served " << stats.connections << " connections, " << results << " results in "
+              << batches << " batches (" << (batches > 0 ? static_cast<double>(results) / batches : 0.0)
+              << " per batch)";
+
+    model->Unref();
+    return 0;
+}
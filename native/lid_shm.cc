@@ -0,0 +1,143 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Consumer of a shared memory ring segment (see shm_ring.h). Every stream
+// of the segment gets a recognizer that reads the samples in place from the
+// mapping, and when producers end utterances the results of all streams
+// that ended in one sweep are computed with one network pass. Results are
+// written as JSON lines with the stream index.
+
+#include "kaldi_recognizer.h"
+#include "lid_model.h"
+#include "shm_ring.h"
+
+#include <csignal>
+
+#include <errno.h>
+#include <string.h>
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void RequestStop(int)
+{
+    stop_requested = 1;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *usage =
+        "Identifies the language of audio streams in a shared memory ring segment\n"
+        "filled by a capture process. Writes one JSON line per finished utterance.\n"
+        "Stops on SIGINT or SIGTERM.\n"
+        "\n"
+        "Usage: lid-shm [options] <model-dir> <segment-path>\n"
+        "e.g.: lid-shm --create --streams=64 lid-model /dev/shm/lid-ring\n";
+
+    ParseOptions po(usage);
+    bool create = false;
+    int32 num_streams = 64;
+    int32 capacity = 1 << 18;
+    int32 wait_ms = 100;
+    int32 max_results = 0;
+    bool language_names = false;
+    po.Register("create", &create, "Create the segment instead of opening one made by the producer");
+    po.Register("streams", &num_streams, "Number of streams of a created segment");
+    po.Register("capacity", &capacity, "Samples per stream of a created segment, rounded up to a power of two");
+    po.Register("wait-ms", &wait_ms, "Longest sleep in milliseconds between checks of the streams while idle");
+    po.Register("max-results", &max_results, "Number of languages in each result, 0 for all");
+    po.Register("language-names", &language_names, "Add the language names to the results");
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+        po.PrintUsage();
+        return 1;
+    }
+
+    std::string segment_path = po.GetArg(2);
+    ShmRing *ring = create ? ShmRing::Create(segment_path.c_str(), std::max(num_streams, 1), std::max(capacity, 1))
+                           : ShmRing::Open(segment_path.c_str());
+    if (!ring)
+        KALDI_ERR << "Can't map the segment " << segment_path << ": " << strerror(errno);
+
+    LidModel *model = new LidModel(po.GetArg(1).c_str());
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = RequestStop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    std::vector<KaldiRecognizer *> recognizers(ring->NumStreams(), NULL);
+    std::vector<uint32> sample_rates(ring->NumStreams(), 0);
+    std::vector<KaldiRecognizer *> ended;
+    std::vector<uint32> ended_streams;
+    std::vector<const char *> results;
+
+    while (!stop_requested) {
+        uint32 sequence = ring->Sequence();
+        bool busy = false;
+        ended.clear();
+        ended_streams.clear();
+
+        for (uint32 s = 0; s < ring->NumStreams(); s++) {
+            uint32 sample_rate = ring->SampleRate(s);
+            if (sample_rate == 0)
+                continue;
+            if (sample_rate != sample_rates[s]) {
+                delete recognizers[s];
+                recognizers[s] = new KaldiRecognizer(model, sample_rate);
+                recognizers[s]->SetMaxResults(max_results);
+                recognizers[s]->SetLanguageNames(language_names);
+                sample_rates[s] = sample_rate;
+            }
+
+            // The samples are converted straight from the mapping. At most
+            // two pieces (a full ring) per sweep so busy streams don't starve
+            // the others.
+            const int16_t *data;
+            bool at_end = false;
+            uint32 num_samples;
+            for (int piece = 0; piece < 2 && (num_samples = ring->Peek(s, &data, &at_end)) > 0; piece++) {
+                recognizers[s]->AcceptWaveform(reinterpret_cast<const short *>(data), num_samples);
+                ring->Consume(s, num_samples);
+                busy = true;
+            }
+            if (at_end) {
+                ended.push_back(recognizers[s]);
+                ended_streams.push_back(s);
+            }
+        }
+
+        if (!ended.empty()) {
+            results.resize(ended.size());
+            KaldiRecognizer::LangResults(ended.data(), ended.size(), results.data());
+            for (size_t i = 0; i < ended.size(); i++) {
+                std::cout << "{\"stream\":" << ended_streams[i] << ",\"result\":" << results[i] << "}\n";
+                ended[i]->Reset();
+                ring->PopEnd(ended_streams[i]);
+            }
+            std::cout.flush();
+            busy = true;
+        }
+
+        if (!busy)
+            ring->Wait(sequence, wait_ms);
+    }
+
+    for (auto *recognizer : recognizers)
+        delete recognizer;
+    delete ring;
+    model->Unref();
+    return 0;
+}
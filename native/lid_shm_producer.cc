@@ -0,0 +1,376 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Producer side of a shared memory ring segment (see shm_ring.h), the
+// counterpart of lid-shm. Writes wav files into the streams of a segment in
+// small packets, or with --self-test runs a producer process against a
+// consumer in this process and checks every sample that arrives. Like
+// shm_ring.cc it does not depend on Kaldi.
+
+#include "shm_ring.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct Options {
+    bool self_test = false;
+    bool realtime = false;
+    int first_stream = 0;
+    int packet_ms = 20;
+    int streams = 4;
+    int capacity = 4096;
+    int samples = 1 << 20;
+};
+
+// Accepts --name=value, and --name alone for booleans
+static bool ParseOption(const char *arg, Options *options)
+{
+    std::string name = arg + 2, value;
+    size_t equals = name.find('=');
+    if (equals != std::string::npos) {
+        value = name.substr(equals + 1);
+        name = name.substr(0, equals);
+    }
+    bool flag = value.empty() || value == "true";
+    int number = atoi(value.c_str());
+    if (name == "self-test")
+        options->self_test = flag;
+    else if (name == "realtime")
+        options->realtime = flag;
+    else if (name == "first-stream")
+        options->first_stream = std::max(number, 0);
+    else if (name == "packet-ms")
+        options->packet_ms = std::max(number, 1);
+    else if (name == "streams")
+        options->streams = std::max(number, 1);
+    else if (name == "capacity")
+        options->capacity = std::max(number, 1);
+    else if (name == "samples")
+        options->samples = std::max(number, 1);
+    else
+        return false;
+    return true;
+}
+
+struct WavAudio {
+    uint32_t sample_rate = 0;
+    std::vector<int16_t> samples;
+};
+
+// Only what capture processes produce, 16-bit mono PCM
+static bool ReadWav(const char *path, WavAudio *audio)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+    char riff[12];
+    bool ok = fread(riff, 1, 12, file) == 12 && memcmp(riff, "RIFF", 4) == 0 && memcmp(riff + 8, "WAVE", 4) == 0;
+    bool have_format = false;
+    while (ok) {
+        char id[4];
+        uint32_t size;
+        if (fread(id, 1, 4, file) != 4 || fread(&size, 4, 1, file) != 1) {
+            ok = false;
+            break;
+        }
+        if (memcmp(id, "fmt ", 4) == 0 && size >= 16) {
+            uint16_t format, channels, bits;
+            uint8_t rest[16];
+            ok = fread(rest, 1, 16, file) == 16 && fseek(file, size - 16 + (size & 1), SEEK_CUR) == 0;
+            memcpy(&format, rest, 2);
+            memcpy(&channels, rest + 2, 2);
+            memcpy(&audio->sample_rate, rest + 4, 4);
+            memcpy(&bits, rest + 14, 2);
+            ok = ok && format == 1 && channels == 1 && bits == 16 && audio->sample_rate > 0;
+            have_format = ok;
+        } else if (memcmp(id, "data", 4) == 0) {
+            audio->samples.resize(size / sizeof(int16_t));
+            audio->samples.resize(fread(audio->samples.data(), sizeof(int16_t), audio->samples.size(), file));
+            ok = have_format;
+            break;
+        } else {
+            ok = fseek(file, size + (size & 1), SEEK_CUR) == 0;
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+static int WriteFiles(const Options &options, const char *segment_path, int num_files, char **files)
+{
+    ShmRing *ring = ShmRing::Open(segment_path);
+    if (!ring) {
+        fprintf(stderr, "Can't map the segment %s: %s\n", segment_path, strerror(errno));
+        return 1;
+    }
+    if (num_files > static_cast<int>(ring->NumStreams())) {
+        fprintf(stderr, "%d files for %u streams\n", num_files, ring->NumStreams());
+        return 1;
+    }
+
+    std::vector<WavAudio> audio(num_files);
+    std::vector<size_t> positions(num_files, 0);
+    std::vector<bool> ended(num_files, false);
+    for (int i = 0; i < num_files; i++) {
+        if (!ReadWav(files[i], &audio[i])) {
+            fprintf(stderr, "Can't read %s, expected 16-bit mono PCM\n", files[i]);
+            return 1;
+        }
+        ring->OpenStream((options.first_stream + i) % ring->NumStreams(), audio[i].sample_rate);
+    }
+
+    // All files advance together, one packet each per round, like the
+    // capture of that many calls
+    int remaining = num_files;
+    while (remaining > 0) {
+        auto round_start = std::chrono::steady_clock::now();
+        bool progress = false;
+        for (int i = 0; i < num_files; i++) {
+            if (ended[i])
+                continue;
+            uint32_t stream = (options.first_stream + i) % ring->NumStreams();
+            size_t packet = static_cast<size_t>(audio[i].sample_rate) * options.packet_ms / 1000;
+            size_t n = std::min(std::max<size_t>(packet, 1), audio[i].samples.size() - positions[i]);
+            if (n > 0) {
+                uint32_t written = ring->Write(stream, audio[i].samples.data() + positions[i], n);
+                positions[i] += written;
+                progress |= written > 0;
+            }
+            if (positions[i] == audio[i].samples.size() && ring->EndUtterance(stream)) {
+                ended[i] = true;
+                remaining--;
+                progress = true;
+            }
+        }
+        if (options.realtime)
+            std::this_thread::sleep_until(round_start + std::chrono::milliseconds(options.packet_ms));
+        else if (!progress)
+            // The consumer is behind, the rings are full
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    delete ring;
+    return 0;
+}
+
+// Self-test sample at a position of a stream, so that every sample is
+// checked without the consumer keeping a copy
+static int16_t TestSample(uint32_t stream, uint64_t pos)
+{
+    return static_cast<int16_t>((pos * 2654435761u + stream * 40503u) >> 13);
+}
+
+// Utterances differ in length between streams, so that their ends fall at
+// different ring offsets
+static uint64_t TestUtteranceLength(uint32_t stream)
+{
+    return 3000 + 977 * stream;
+}
+
+static void RunTestProducer(const Options &options, const char *segment_path)
+{
+    ShmRing *ring = ShmRing::Open(segment_path);
+    if (!ring)
+        _exit(2);
+    uint32_t num_streams = ring->NumStreams();
+    uint64_t total = options.samples;
+    std::vector<uint64_t> positions(num_streams, 0), next_ends(num_streams);
+    std::vector<bool> done(num_streams, false);
+    for (uint32_t s = 0; s < num_streams; s++) {
+        ring->OpenStream(s, 16000);
+        next_ends[s] = std::min(TestUtteranceLength(s), total);
+    }
+
+    // Packets of varying size, up to half the ring, with pauses now and
+    // then so that the consumer goes to sleep on the futex
+    std::vector<int16_t> packet(ring->Capacity());
+    uint32_t random = 12345;
+    uint32_t remaining = num_streams;
+    for (int round = 0; remaining > 0; round++) {
+        bool progress = false;
+        for (uint32_t s = 0; s < num_streams; s++) {
+            if (done[s])
+                continue;
+            random = random * 1103515245u + 12345u;
+            uint64_t n = std::min<uint64_t>(1 + (random >> 8) % (ring->Capacity() / 2), next_ends[s] - positions[s]);
+            for (uint64_t i = 0; i < n; i++)
+                packet[i] = TestSample(s, positions[s] + i);
+            uint32_t written = n > 0 ? ring->Write(s, packet.data(), n) : 0;
+            positions[s] += written;
+            progress |= written > 0;
+            if (positions[s] == next_ends[s] && ring->EndUtterance(s)) {
+                progress = true;
+                if (next_ends[s] == total) {
+                    done[s] = true;
+                    remaining--;
+                } else {
+                    next_ends[s] = std::min(next_ends[s] + TestUtteranceLength(s), total);
+                }
+            }
+        }
+        if (round % 64 == 63)
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        else if (!progress)
+            std::this_thread::yield();
+    }
+    delete ring;
+    _exit(0);
+}
+
+static int SelfTest(const Options &options, const char *segment_path)
+{
+    ShmRing *ring = ShmRing::Create(segment_path, options.streams, options.capacity);
+    if (!ring) {
+        fprintf(stderr, "Can't create the segment %s: %s\n", segment_path, strerror(errno));
+        return 1;
+    }
+
+    // The producer is a separate process with a mapping of its own
+    pid_t producer = fork();
+    if (producer < 0) {
+        fprintf(stderr, "Can't start the producer: %s\n", strerror(errno));
+        return 1;
+    }
+    if (producer == 0)
+        RunTestProducer(options, segment_path);
+
+    uint32_t num_streams = ring->NumStreams();
+    uint64_t total = options.samples;
+    std::vector<uint64_t> positions(num_streams, 0), next_ends(num_streams);
+    std::vector<bool> done(num_streams, false);
+    for (uint32_t s = 0; s < num_streams; s++)
+        next_ends[s] = std::min(TestUtteranceLength(s), total);
+
+    std::string error;
+    uint32_t remaining = num_streams;
+    uint64_t utterances = 0, waits = 0;
+    auto last_progress = std::chrono::steady_clock::now();
+    while (remaining > 0 && error.empty()) {
+        uint32_t sequence = ring->Sequence();
+        bool progress = false;
+        for (uint32_t s = 0; s < num_streams && error.empty(); s++) {
+            const int16_t *data;
+            bool at_end;
+            uint32_t n = done[s] ? 0 : ring->Peek(s, &data, &at_end);
+            if (done[s]) {
+                continue;
+            } else if (at_end) {
+                if (positions[s] != next_ends[s]) {
+                    error = "utterance of stream " + std::to_string(s) + " ended at " +
+                            std::to_string(positions[s]) + " instead of " + std::to_string(next_ends[s]);
+                    break;
+                }
+                ring->PopEnd(s);
+                utterances++;
+                progress = true;
+                if (next_ends[s] == total) {
+                    done[s] = true;
+                    remaining--;
+                } else {
+                    next_ends[s] = std::min(next_ends[s] + TestUtteranceLength(s), total);
+                }
+            } else if (n > 0) {
+                if (positions[s] + n > next_ends[s])
+                    error = "stream " + std::to_string(s) + " read past the end of an utterance";
+                for (uint32_t i = 0; i < n && error.empty(); i++)
+                    if (data[i] != TestSample(s, positions[s] + i))
+                        error = "stream " + std::to_string(s) + " has a wrong sample at " +
+                                std::to_string(positions[s] + i);
+                ring->Consume(s, n);
+                positions[s] += n;
+                progress = true;
+            }
+        }
+        if (progress) {
+            last_progress = std::chrono::steady_clock::now();
+        } else if (std::chrono::steady_clock::now() - last_progress > std::chrono::seconds(10)) {
+            error = "no samples arrived for 10 seconds";
+        } else {
+            ring->Wait(sequence, 100);
+            waits++;
+        }
+    }
+
+    int status = 0;
+    if (!error.empty())
+        kill(producer, SIGKILL);
+    waitpid(producer, &status, 0);
+    if (error.empty() && (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
+        error = "the producer failed";
+    if (error.empty() && waits == 0)
+        error = "the consumer never waited for the producer";
+
+    uint64_t wraps = total / ring->Capacity();
+    delete ring;
+    unlink(segment_path);
+    if (!error.empty()) {
+        fprintf(stderr, "Self-test failed: %s\n", error.c_str());
+        return 1;
+    }
+    printf("{\"shm_self_test\": \"passed\", \"streams\": %u, \"samples\": %llu, \"utterances\": %llu, "
+           "\"wraps\": %llu, \"waits\": %llu}\n",
+           num_streams, static_cast<unsigned long long>(total), static_cast<unsigned long long>(utterances),
+           static_cast<unsigned long long>(wraps), static_cast<unsigned long long>(waits));
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *usage =
+        "Writes 16-bit mono wav files into the streams of a shared memory ring\n"
+        "segment read by lid-shm, one file per stream, each ending an utterance.\n"
+        "With --self-test creates the segment, writes a test pattern from a second\n"
+        "process and checks every sample, utterance end and the wrap of the rings.\n"
+        "\n"
+        "Usage: lid-shm-producer [options] <segment-path> <wav-file>...\n"
+        "       lid-shm-producer --self-test [options] <segment-path>\n"
+        "e.g.: lid-shm-producer --realtime /dev/shm/lid-ring a.wav b.wav\n"
+        "\n"
+        "Options:\n"
+        "  --realtime        Write the packets at the pace of the audio\n"
+        "  --packet-ms=N     Milliseconds of audio per write (default 20)\n"
+        "  --first-stream=N  Stream of the first file (default 0)\n"
+        "  --self-test       Check the ring instead of writing files\n"
+        "  --streams=N       Streams of the self-test segment (default 4)\n"
+        "  --capacity=N      Samples per stream of the self-test segment (default 4096)\n"
+        "  --samples=N       Samples per stream written by the self-test (default 1048576)\n";
+
+    Options options;
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (!ParseOption(argv[arg], &options)) {
+            fprintf(stderr, "Unknown option %s\n\n%s", argv[arg], usage);
+            return 1;
+        }
+    }
+
+    int num_args = argc - arg;
+    if (options.self_test ? num_args != 1 : num_args < 2) {
+        fprintf(stderr, "%s", usage);
+        return 1;
+    }
+    if (options.self_test)
+        return SelfTest(options, argv[arg]);
+    return WriteFiles(options, argv[arg], num_args - 1, argv + arg + 1);
+}
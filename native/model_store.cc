@@ -0,0 +1,107 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "model_store.h"
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+ModelStore::ModelStore(LidModel *model) : model_(model), generation_(1), loading_(false)
+{
+}
+
+ModelStore::~ModelStore()
+{
+    std::thread loader;
+    {
+        std::lock_guard<std::mutex> lock(load_mutex_);
+        loader.swap(loader_);
+    }
+    if (loader.joinable())
+        loader.join();
+    model_->Unref();
+}
+
+LidModel *ModelStore::Acquire()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    model_->Ref();
+    return model_;
+}
+
+int64 ModelStore::Generation()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return generation_;
+}
+
+void ModelStore::Publish(LidModel *model)
+{
+    // Settings first, frame subsampling can't change after the warm up
+    LidModel *current = Acquire();
+    model->CopySettings(*current);
+    current->Unref();
+    model->Warm();
+
+    LidModel *old_model;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        old_model = model_;
+        model_ = model;
+        generation_++;
+    }
+    // Freed now or when its last recognizer goes away, outside of the lock
+    old_model->Unref();
+}
+
+bool ModelStore::Load(const std::string &path)
+{
+    LidModel *model;
+    try {
+        model = new LidModel(path.c_str());
+    } catch (const std::exception &e) {
+        KALDI_WARN << "Failed to load the model from " << path << ": " << e.what();
+        return false;
+    }
+    Publish(model);
+    KALDI_LOG << "Published model " << path << " as generation " << Generation();
+    return true;
+}
+
+bool ModelStore::LoadAsync(const std::string &path, std::function<void(bool)> done)
+{
+    std::lock_guard<std::mutex> lock(load_mutex_);
+    if (loading_)
+        return false;
+    if (loader_.joinable())
+        loader_.join();
+    loading_ = true;
+    loader_ = std::thread([this, path, done] {
+#ifdef __linux__
+        // Reading and preparing the model must not take CPU from serving
+        setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+#endif
+        bool loaded = Load(path);
+        {
+            std::lock_guard<std::mutex> lock(load_mutex_);
+            loading_ = false;
+        }
+        if (done)
+            done(loaded);
+    });
+    return true;
+}
@@ -0,0 +1,61 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MODEL_STORE_H_
+#define MODEL_STORE_H_
+
+#include "lid_model.h"
+
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Holds the current model for new recognizers and replaces it with a newly
+// loaded one without stopping traffic. Recognizers keep a reference to the
+// model they were created with, so an old model is freed only after its
+// last recognizer is gone.
+class ModelStore {
+public:
+    // Takes over one reference of the model
+    explicit ModelStore(LidModel *model);
+    // Waits for a background load to finish
+    ~ModelStore();
+
+    // Current model with a reference that the caller must Unref
+    LidModel *Acquire();
+    // Number of models published so far, starting with 1
+    int64 Generation();
+
+    // Publishes a model in place of the current one, taking over one
+    // reference and the settings of the current model. The model is warmed
+    // up first, so that the requests right after the swap are not slower.
+    void Publish(LidModel *model);
+    // Loads the model at path on the calling thread and publishes it,
+    // returns false and keeps the current model if loading fails
+    bool Load(const std::string &path);
+    // Loads on a background thread with a lower priority and calls done
+    // with the outcome. Returns false if a load is already running.
+    bool LoadAsync(const std::string &path, std::function<void(bool)> done);
+
+private:
+    std::mutex mutex_;
+    LidModel *model_;
+    int64 generation_;
+
+    std::mutex load_mutex_;
+    std::thread loader_;
+    bool loading_;
+};
+
+#endif /* MODEL_STORE_H_ */
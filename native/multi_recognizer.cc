@@ -0,0 +1,165 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "multi_recognizer.h"
+#include "wave_file.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define WAVE_BLOCK_SIZE 4096
+
+// Splits interleaved samples into one float vector per channel
+template <typename T>
+static void Deinterleave(const T *data, int num_frames, std::vector<Vector<BaseFloat> > *channel_data) {
+    int num_channels = channel_data->size();
+    for (int c = 0; c < num_channels; c++) {
+        (*channel_data)[c].Resize(num_frames, kUndefined);
+        BaseFloat *out = (*channel_data)[c].Data();
+        for (int i = 0; i < num_frames; i++)
+            out[i] = data[i * num_channels + c];
+    }
+}
+
+// Stereo 16-bit audio, the common call recording layout, four frames at a
+// time: the low half of every 32-bit lane is the left sample, the high half
+// the right one
+static void DeinterleaveStereo(const short *data, int num_frames, std::vector<Vector<BaseFloat> > *channel_data) {
+    (*channel_data)[0].Resize(num_frames, kUndefined);
+    (*channel_data)[1].Resize(num_frames, kUndefined);
+    BaseFloat *left = (*channel_data)[0].Data();
+    BaseFloat *right = (*channel_data)[1].Data();
+    int i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= num_frames; i += 4) {
+        __m128i frames = _mm_loadu_si128((const __m128i *)(data + 2 * i));
+        __m128i l = _mm_srai_epi32(_mm_slli_epi32(frames, 16), 16);
+        __m128i r = _mm_srai_epi32(frames, 16);
+        _mm_storeu_ps(left + i, _mm_cvtepi32_ps(l));
+        _mm_storeu_ps(right + i, _mm_cvtepi32_ps(r));
+    }
+#endif
+    for (; i < num_frames; i++) {
+        left[i] = data[2 * i];
+        right[i] = data[2 * i + 1];
+    }
+}
+
+MultiChannelRecognizer::MultiChannelRecognizer(LidModel *lid_model, float sample_frequency, int num_channels)
+    : lid_model_(lid_model), channel_data_(std::max(num_channels, 0)) {
+    KALDI_ASSERT(num_channels > 0);
+    for (int c = 0; c < num_channels; c++)
+        channels_.push_back(new KaldiRecognizer(lid_model_, sample_frequency));
+}
+
+MultiChannelRecognizer::~MultiChannelRecognizer() {
+    for (auto channel : channels_)
+        delete channel;
+}
+
+// Buffers that don't end on a frame boundary leave the samples of the last
+// frame for the next call, which completes the frame from its first samples
+// so that the channels stay aligned. Returns the number of samples taken,
+// all of them if the frame is still incomplete.
+template <typename T>
+int MultiChannelRecognizer::CompletePartialFrame(const T *data, int len)
+{
+    if (partial_frame_.empty())
+        return 0;
+    int num_channels = channels_.size();
+    int taken = std::min<int>(len, num_channels - partial_frame_.size());
+    partial_frame_.insert(partial_frame_.end(), data, data + taken);
+    if (partial_frame_.size() == static_cast<size_t>(num_channels)) {
+        Deinterleave(partial_frame_.data(), 1, &channel_data_);
+        AcceptChannels();
+        partial_frame_.clear();
+    }
+    return taken;
+}
+
+void MultiChannelRecognizer::AcceptWaveform(const char *data, int len)
+{
+    AcceptWaveform((const short *)data, len / 2);
+}
+
+void MultiChannelRecognizer::AcceptWaveform(const short *sdata, int len)
+{
+    int skip = CompletePartialFrame(sdata, len);
+    if (!partial_frame_.empty())
+        return;
+    int num_frames = (len - skip) / channels_.size();
+    if (channels_.size() == 2)
+        DeinterleaveStereo(sdata + skip, num_frames, &channel_data_);
+    else
+        Deinterleave(sdata + skip, num_frames, &channel_data_);
+    AcceptChannels();
+    skip += num_frames * channels_.size();
+    partial_frame_.assign(sdata + skip, sdata + len);
+}
+
+void MultiChannelRecognizer::AcceptWaveform(const float *fdata, int len)
+{
+    int skip = CompletePartialFrame(fdata, len);
+    if (!partial_frame_.empty())
+        return;
+    int num_frames = (len - skip) / channels_.size();
+    Deinterleave(fdata + skip, num_frames, &channel_data_);
+    AcceptChannels();
+    skip += num_frames * channels_.size();
+    partial_frame_.assign(fdata + skip, fdata + len);
+}
+
+bool MultiChannelRecognizer::AcceptFile(const char *path)
+{
+    WaveFile wave_file;
+    if (!wave_file.Open(path))
+        return false;
+    if (wave_file.NumChannels() != NumChannels()) {
+        KALDI_WARN << path << " has " << wave_file.NumChannels() << " channels, expected "
+                   << NumChannels();
+        return false;
+    }
+
+    for (int64 frame = 0; frame < wave_file.NumFrames(); frame += WAVE_BLOCK_SIZE) {
+        for (int c = 0; c < NumChannels(); c++) {
+            wave_file.Decode(frame, WAVE_BLOCK_SIZE, c, &channel_data_[c]);
+            if (!channels_[c]->AcceptWaveform(wave_file.SampleFrequency(), channel_data_[c]))
+                return false;
+        }
+    }
+    return true;
+}
+
+void MultiChannelRecognizer::AcceptChannels()
+{
+    for (size_t c = 0; c < channels_.size(); c++)
+        channels_[c]->AcceptWaveform(channel_data_[c]);
+}
+
+const char *MultiChannelRecognizer::LangResult()
+{
+    int num_channels = channels_.size();
+    std::vector<const char *> results(num_channels);
+    KaldiRecognizer::LangResults(channels_.data(), num_channels, results.data());
+
+    lang_result_ = "[";
+    for (int c = 0; c < num_channels; c++) {
+        if (c > 0)
+            lang_result_ += ",";
+        lang_result_ += results[c];
+    }
+    lang_result_ += "]";
+    return lang_result_.c_str();
+}
@@ -0,0 +1,47 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef MULTI_RECOGNIZER_H_
+#define MULTI_RECOGNIZER_H_
+
+#include "kaldi_recognizer.h"
+
+// Recognizes every channel of interleaved multi-channel audio, for example
+// the agent and customer sides of a stereo call. Each channel keeps its own
+// feature state, the x-vectors of all channels are computed in one pass.
+class MultiChannelRecognizer {
+    public:
+        MultiChannelRecognizer(LidModel *lid_model, float sample_frequency, int num_channels);
+        ~MultiChannelRecognizer();
+        void AcceptWaveform(const char *data, int len);
+        void AcceptWaveform(const short *sdata, int len);
+        void AcceptWaveform(const float *fdata, int len);
+        bool AcceptFile(const char *path);
+        int NumChannels() const { return channels_.size(); }
+        KaldiRecognizer *Channel(int channel) { return channels_[channel]; }
+        const char* LangResult();
+
+    private:
+        void AcceptChannels();
+        template <typename T>
+        int CompletePartialFrame(const T *data, int len);
+        LidModel *lid_model_;
+        std::vector<KaldiRecognizer *> channels_;
+        std::vector<Vector<BaseFloat> > channel_data_;
+        // Samples of a frame that the last buffer ended in the middle of
+        std::vector<BaseFloat> partial_frame_;
+        string lang_result_;
+};
+
+#endif /* MULTI_RECOGNIZER_H_ */
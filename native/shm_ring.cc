@@ -0,0 +1,266 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "shm_ring.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+// The futex works on the plain 32-bit word behind the atomic, and both
+// processes must agree on the layout
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "atomic has extra state");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "32-bit atomics must be lock free");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "64-bit atomics must be lock free");
+
+static void FutexWait(std::atomic<uint32_t> *word, uint32_t value, int timeout_ms)
+{
+#ifdef __linux__
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, value,
+            timeout_ms >= 0 ? &timeout : NULL, NULL, 0);
+#else
+    // No futex, poll the word instead
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (word->load() == value && (timeout_ms < 0 || std::chrono::steady_clock::now() < end))
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+}
+
+static void FutexWake(std::atomic<uint32_t> *word)
+{
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, 1, NULL, NULL, 0);
+#else
+    (void)word;
+#endif
+}
+
+ShmRing::ShmRing(void *map, size_t map_size)
+    : map_(map), map_size_(map_size)
+{
+    char *base = static_cast<char *>(map);
+    header_ = reinterpret_cast<ShmRingHeader *>(base);
+    streams_ = reinterpret_cast<ShmRingStream *>(base + sizeof(ShmRingHeader));
+    data_ = reinterpret_cast<int16_t *>(base + sizeof(ShmRingHeader) +
+                                        header_->num_streams * sizeof(ShmRingStream));
+}
+
+ShmRing::~ShmRing()
+{
+    munmap(map_, map_size_);
+}
+
+size_t ShmRing::SegmentSize(uint32_t num_streams, uint32_t capacity)
+{
+    return sizeof(ShmRingHeader) + num_streams * (sizeof(ShmRingStream) + capacity * sizeof(int16_t));
+}
+
+ShmRing *ShmRing::Create(const char *path, uint32_t num_streams, uint32_t capacity)
+{
+    uint32_t rounded = 1;
+    while (rounded < capacity && rounded < (1u << 30))
+        rounded <<= 1;
+    if (num_streams == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // Truncating a segment that others still map would make their accesses
+    // fault with SIGBUS. A new file leaves them the old one until they unmap.
+    size_t size = SegmentSize(num_streams, rounded);
+    if (unlink(path) != 0 && errno != ENOENT)
+        return NULL;
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return NULL;
+    if (ftruncate(fd, size) != 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return NULL;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    // A fresh file reads as zeros, which is the initial state of all
+    // positions and counters. The magic goes last so that a process
+    // opening the segment early sees it incomplete.
+    ShmRingHeader *header = static_cast<ShmRingHeader *>(map);
+    header->version = SHM_RING_VERSION;
+    header->num_streams = num_streams;
+    header->capacity = rounded;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = SHM_RING_MAGIC;
+    return new ShmRing(map, size);
+}
+
+ShmRing *ShmRing::Open(const char *path)
+{
+    int fd = open(path, O_RDWR);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ShmRingHeader)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    size_t size = st.st_size;
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    const ShmRingHeader *header = static_cast<const ShmRingHeader *>(map);
+    bool valid = header->magic == SHM_RING_MAGIC && header->version == SHM_RING_VERSION;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!valid || header->num_streams == 0 || (header->capacity & (header->capacity - 1)) != 0 ||
+        size < SegmentSize(header->num_streams, header->capacity)) {
+        munmap(map, size);
+        errno = EINVAL;
+        return NULL;
+    }
+    return new ShmRing(map, size);
+}
+
+void ShmRing::Notify()
+{
+    // Either the consumer sees the new sequence before it sleeps or we see
+    // it waiting, so the system call is only made for a sleeping consumer
+    header_->sequence.fetch_add(1, std::memory_order_seq_cst);
+    if (header_->consumer_waiting.load(std::memory_order_seq_cst))
+        FutexWake(&header_->sequence);
+}
+
+void ShmRing::OpenStream(uint32_t stream, uint32_t sample_rate)
+{
+    streams_[stream].sample_rate.store(sample_rate, std::memory_order_release);
+    Notify();
+}
+
+uint32_t ShmRing::Reserve(uint32_t stream, int16_t **data)
+{
+    ShmRingStream &s = streams_[stream];
+    uint64_t write = s.write_pos.load(std::memory_order_relaxed);
+    uint64_t read = s.read_pos.load(std::memory_order_acquire);
+    uint32_t capacity = header_->capacity;
+    uint32_t offset = write & (capacity - 1);
+    *data = data_ + static_cast<size_t>(stream) * capacity + offset;
+    return std::min<uint64_t>(capacity - (write - read), capacity - offset);
+}
+
+void ShmRing::Commit(uint32_t stream, uint32_t num_samples)
+{
+    ShmRingStream &s = streams_[stream];
+    s.write_pos.store(s.write_pos.load(std::memory_order_relaxed) + num_samples,
+                      std::memory_order_release);
+    Notify();
+}
+
+uint32_t ShmRing::Write(uint32_t stream, const int16_t *samples, uint32_t num_samples)
+{
+    // At most two pieces, before and after the end of the ring
+    uint32_t written = 0;
+    for (int piece = 0; piece < 2 && written < num_samples; piece++) {
+        int16_t *data;
+        uint32_t n = std::min(Reserve(stream, &data), num_samples - written);
+        if (n == 0)
+            break;
+        memcpy(data, samples + written, n * sizeof(int16_t));
+        ShmRingStream &s = streams_[stream];
+        s.write_pos.store(s.write_pos.load(std::memory_order_relaxed) + n, std::memory_order_release);
+        written += n;
+    }
+    if (written > 0)
+        Notify();
+    return written;
+}
+
+bool ShmRing::EndUtterance(uint32_t stream)
+{
+    ShmRingStream &s = streams_[stream];
+    uint32_t written = s.ends_written.load(std::memory_order_relaxed);
+    if (written - s.ends_read.load(std::memory_order_acquire) >= SHM_RING_MAX_ENDS)
+        return false;
+    s.ends[written % SHM_RING_MAX_ENDS] = s.write_pos.load(std::memory_order_relaxed);
+    s.ends_written.store(written + 1, std::memory_order_release);
+    Notify();
+    return true;
+}
+
+uint32_t ShmRing::SampleRate(uint32_t stream) const
+{
+    return streams_[stream].sample_rate.load(std::memory_order_acquire);
+}
+
+uint32_t ShmRing::Peek(uint32_t stream, const int16_t **data, bool *at_end) const
+{
+    const ShmRingStream &s = streams_[stream];
+    uint64_t read = s.read_pos.load(std::memory_order_relaxed);
+    uint64_t limit = s.write_pos.load(std::memory_order_acquire);
+    uint32_t ends_read = s.ends_read.load(std::memory_order_relaxed);
+    *at_end = false;
+    if (s.ends_written.load(std::memory_order_acquire) != ends_read) {
+        uint64_t end = s.ends[ends_read % SHM_RING_MAX_ENDS];
+        if (end <= read) {
+            *at_end = true;
+            return 0;
+        }
+        limit = std::min(limit, end);
+    }
+
+    uint32_t capacity = header_->capacity;
+    uint32_t offset = read & (capacity - 1);
+    *data = data_ + static_cast<size_t>(stream) * capacity + offset;
+    return std::min<uint64_t>(limit - read, capacity - offset);
+}
+
+void ShmRing::Consume(uint32_t stream, uint32_t num_samples)
+{
+    ShmRingStream &s = streams_[stream];
+    s.read_pos.store(s.read_pos.load(std::memory_order_relaxed) + num_samples,
+                     std::memory_order_release);
+}
+
+void ShmRing::PopEnd(uint32_t stream)
+{
+    ShmRingStream &s = streams_[stream];
+    s.ends_read.store(s.ends_read.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void ShmRing::Wait(uint32_t sequence, int timeout_ms)
+{
+    header_->consumer_waiting.store(1, std::memory_order_seq_cst);
+    if (header_->sequence.load(std::memory_order_seq_cst) == sequence)
+        FutexWait(&header_->sequence, sequence, timeout_ms);
+    header_->consumer_waiting.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,119 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SHM_RING_H_
+#define SHM_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Shared memory segment for passing 16-bit PCM audio from a capture process
+// to a recognizing process without pipes. The segment holds a fixed number
+// of streams, each a lock-free ring with exactly one producer and one
+// consumer, so no locks are shared between the processes. The consumer
+// sleeps on a futex in the segment when all rings are empty, and producers
+// only make the wake-up system call while it sleeps.
+//
+// The segment is a file mapped by both processes, best placed on a tmpfs
+// like /dev/shm. Its layout is ShmRingHeader, num_streams ShmRingStream
+// entries and then capacity samples for every stream. This file does not
+// depend on Kaldi, so that capture processes can build it on its own.
+
+#define SHM_RING_MAGIC 0x5244494c
+#define SHM_RING_VERSION 1
+#define SHM_RING_CACHE_LINE 64
+#define SHM_RING_MAX_ENDS 16
+
+struct ShmRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_streams;
+    // Samples per stream, a power of two
+    uint32_t capacity;
+    // Bumped by the producers after every change, the consumer futex word
+    alignas(SHM_RING_CACHE_LINE) std::atomic<uint32_t> sequence;
+    std::atomic<uint32_t> consumer_waiting;
+};
+
+// Positions count samples since the segment was created and never wrap.
+// The producer and consumer fields are on separate cache lines.
+struct ShmRingStream {
+    alignas(SHM_RING_CACHE_LINE) std::atomic<uint64_t> write_pos;
+    // 0 until the producer opens the stream
+    std::atomic<uint32_t> sample_rate;
+    std::atomic<uint32_t> ends_written;
+    // Write positions at which utterances end, a ring of its own
+    uint64_t ends[SHM_RING_MAX_ENDS];
+    alignas(SHM_RING_CACHE_LINE) std::atomic<uint64_t> read_pos;
+    std::atomic<uint32_t> ends_read;
+};
+
+class ShmRing {
+public:
+    // Creates the segment file. An existing one is unlinked, not reused,
+    // processes still mapping it keep it until they unmap. The capacity is
+    // rounded up to a power of two. Returns NULL with errno set on failure.
+    static ShmRing *Create(const char *path, uint32_t num_streams, uint32_t capacity);
+    // Maps an existing segment, NULL if it can not be mapped or is not a
+    // segment of this version
+    static ShmRing *Open(const char *path);
+    ~ShmRing();
+
+    uint32_t NumStreams() const { return header_->num_streams; }
+    uint32_t Capacity() const { return header_->capacity; }
+
+    // Producer side, one thread or process per stream
+
+    // Sets the sample rate of the audio that follows
+    void OpenStream(uint32_t stream, uint32_t sample_rate);
+    // Contiguous free space for writing in place, for example by a codec,
+    // followed by Commit. Returns the number of samples that fit.
+    uint32_t Reserve(uint32_t stream, int16_t **data);
+    void Commit(uint32_t stream, uint32_t num_samples);
+    // Copies as many samples as fit and returns their number
+    uint32_t Write(uint32_t stream, const int16_t *samples, uint32_t num_samples);
+    // Ends the utterance after the samples written so far, so the consumer
+    // reports its result. Fails while the consumer is SHM_RING_MAX_ENDS
+    // utterances behind.
+    bool EndUtterance(uint32_t stream);
+
+    // Consumer side, one thread for all streams
+
+    uint32_t SampleRate(uint32_t stream) const;
+    // Contiguous samples ready for reading in place, up to the ring end or
+    // the next utterance end. at_end is set if the next utterance end has
+    // been reached, then 0 is returned until PopEnd.
+    uint32_t Peek(uint32_t stream, const int16_t **data, bool *at_end) const;
+    // Releases samples returned by Peek to the producer
+    void Consume(uint32_t stream, uint32_t num_samples);
+    void PopEnd(uint32_t stream);
+    // Sleeps until the sequence differs from the given one, which should be
+    // read before checking the streams, or until timeout_ms passes
+    uint32_t Sequence() const { return header_->sequence.load(std::memory_order_acquire); }
+    void Wait(uint32_t sequence, int timeout_ms);
+
+private:
+    ShmRing(void *map, size_t map_size);
+    static size_t SegmentSize(uint32_t num_streams, uint32_t capacity);
+    void Notify();
+
+    void *map_;
+    size_t map_size_;
+    ShmRingHeader *header_;
+    ShmRingStream *streams_;
+    int16_t *data_;
+};
+
+#endif /* SHM_RING_H_ */
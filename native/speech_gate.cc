@@ -0,0 +1,186 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "speech_gate.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <string.h>
+
+// DTMF rows and columns and the dial, ringback and busy tones of North
+// America (350, 440, 480, 620 Hz), Europe (425 Hz) and the UK (400, 450 Hz)
+static const BaseFloat kSignallingTones[] = {
+    350, 400, 425, 440, 450, 480, 620, 697, 770, 852, 941, 1209, 1336, 1477, 1633
+};
+
+SpeechGate::SpeechGate(const SpeechGateOptions &opts)
+    : opts_(opts), pending_size_(0), tone_window_size_(0), hangover_(0), blocks_(0), rejected_(0)
+{
+}
+
+void SpeechGate::Reset()
+{
+    pending_size_ = 0;
+    tone_window_size_ = 0;
+    hangover_ = 0;
+}
+
+void SpeechGate::TakeCounts(int64 *blocks, int64 *rejected)
+{
+    *blocks = blocks_;
+    *rejected = rejected_;
+    blocks_ = 0;
+    rejected_ = 0;
+}
+
+BaseFloat SpeechGate::ToneFraction(BaseFloat sample_frequency) const
+{
+    const BaseFloat *window = tone_window_.Data();
+    int32 size = tone_window_size_;
+    double energy = 0;
+    for (int32 i = 0; i < size; i++)
+        energy += window[i] * window[i];
+    if (energy <= 0)
+        return 0;
+
+    // Goertzel filters, the power of a tone of amplitude a is (size a / 2)^2
+    int32 num_tones = sizeof(kSignallingTones) / sizeof(kSignallingTones[0]);
+    std::vector<double> powers(num_tones, 0.0);
+    for (int32 t = 0; t < num_tones; t++) {
+        if (kSignallingTones[t] >= sample_frequency / 2)
+            continue;
+        double coeff = 2 * cos(2 * M_PI * kSignallingTones[t] / sample_frequency);
+        double s1 = 0, s2 = 0;
+        for (int32 i = 0; i < size; i++) {
+            double s = window[i] + coeff * s1 - s2;
+            s2 = s1;
+            s1 = s;
+        }
+        powers[t] = s1 * s1 + s2 * s2 - coeff * s1 * s2;
+    }
+    std::sort(powers.begin(), powers.end());
+    double tone_energy = 2 * (powers[num_tones - 1] + powers[num_tones - 2]) / size;
+    return tone_energy / energy;
+}
+
+bool SpeechGate::IsSpeech(const BaseFloat *block, int32 size, BaseFloat sample_frequency) const
+{
+    double energy = 0;
+    int32 crossings = 0;
+    for (int32 i = 0; i < size; i++) {
+        energy += block[i] * block[i];
+        if (i > 0 && (block[i] < 0) != (block[i - 1] < 0))
+            crossings++;
+    }
+    BaseFloat level_db = 10 * log10(energy / size + 1e-10);
+    if (level_db < opts_.min_level_db)
+        return false;
+    BaseFloat zero_crossing_rate = size > 1 ? static_cast<BaseFloat>(crossings) / (size - 1) : 0;
+    if (zero_crossing_rate > opts_.max_zero_crossing_rate && level_db < opts_.loud_level_db)
+        return false;
+    return ToneFraction(sample_frequency) <= opts_.max_tone_fraction;
+}
+
+bool SpeechGate::Accept(const BaseFloat *block, int32 size, BaseFloat sample_frequency)
+{
+    // The window slides by one block, with the current block at its end
+    int32 window_size = std::max(static_cast<int32>(sample_frequency * opts_.tone_window_ms / 1000), size);
+    if (tone_window_.Dim() != window_size) {
+        tone_window_.Resize(window_size, kUndefined);
+        tone_window_size_ = 0;
+    }
+    int32 keep = std::min(tone_window_size_, window_size - size);
+    memmove(tone_window_.Data(), tone_window_.Data() + tone_window_size_ - keep, keep * sizeof(BaseFloat));
+    memcpy(tone_window_.Data() + keep, block, size * sizeof(BaseFloat));
+    tone_window_size_ = keep + size;
+
+    blocks_++;
+    if (IsSpeech(block, size, sample_frequency)) {
+        hangover_ = opts_.hangover_blocks;
+        return true;
+    }
+    if (hangover_ > 0) {
+        hangover_--;
+        return true;
+    }
+    rejected_++;
+    return false;
+}
+
+int32 SpeechGate::Process(BaseFloat sample_frequency, const VectorBase<BaseFloat> &samples,
+                          Vector<BaseFloat> *speech)
+{
+    int32 block_size = std::max(static_cast<int32>(sample_frequency * opts_.block_ms / 1000), 1);
+    if (pending_.Dim() != block_size) {
+        // First call or a new sample rate, a partial block of the old rate is dropped
+        pending_.Resize(block_size, kUndefined);
+        pending_size_ = 0;
+    }
+    int32 num_samples = samples.Dim();
+    if (speech->Dim() < pending_size_ + num_samples)
+        speech->Resize(pending_size_ + num_samples, kUndefined);
+
+    const BaseFloat *data = samples.Data();
+    BaseFloat *out = speech->Data();
+    int32 num_out = 0, pos = 0;
+    if (pending_size_ > 0) {
+        pos = std::min(block_size - pending_size_, num_samples);
+        memcpy(pending_.Data() + pending_size_, data, pos * sizeof(BaseFloat));
+        pending_size_ += pos;
+        if (pending_size_ < block_size)
+            return 0;
+        if (Accept(pending_.Data(), block_size, sample_frequency)) {
+            memcpy(out, pending_.Data(), block_size * sizeof(BaseFloat));
+            num_out = block_size;
+        }
+        pending_size_ = 0;
+    }
+
+    for (; pos + block_size <= num_samples; pos += block_size) {
+        if (Accept(data + pos, block_size, sample_frequency)) {
+            memcpy(out + num_out, data + pos, block_size * sizeof(BaseFloat));
+            num_out += block_size;
+        }
+    }
+
+    pending_size_ = num_samples - pos;
+    memcpy(pending_.Data(), data + pos, pending_size_ * sizeof(BaseFloat));
+    return num_out;
+}
+
+void SpeechGate::Write(std::ostream &os, bool binary) const
+{
+    WriteBasicType(os, binary, hangover_);
+    WriteBasicType(os, binary, pending_.Dim());
+    Vector<BaseFloat> pending(pending_size_);
+    if (pending_size_ > 0)
+        pending.CopyFromVec(pending_.Range(0, pending_size_));
+    pending.Write(os, binary);
+}
+
+void SpeechGate::Read(std::istream &is, bool binary)
+{
+    int32 block_size;
+    Vector<BaseFloat> pending;
+    ReadBasicType(is, binary, &hangover_);
+    ReadBasicType(is, binary, &block_size);
+    pending.Read(is, binary);
+    if (block_size < 0 || pending.Dim() >= std::max(block_size, 1))
+        KALDI_ERR << "Invalid speech gate state";
+    pending_.Resize(block_size, kUndefined);
+    pending_size_ = pending.Dim();
+    if (pending_size_ > 0)
+        pending_.Range(0, pending_size_).CopyFromVec(pending);
+}
@@ -0,0 +1,91 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SPEECH_GATE_H_
+#define SPEECH_GATE_H_
+
+#include "base/kaldi-common.h"
+#include "matrix/kaldi-matrix.h"
+
+using namespace kaldi;
+
+// Levels are for audio at the scale of 16-bit PCM, like the recognizer gets
+struct SpeechGateOptions {
+    BaseFloat block_ms;
+    // Blocks below this RMS level in dB are silence
+    BaseFloat min_level_db;
+    // Blocks above min_level_db with more zero crossings per sample than
+    // this are noise, unless they are louder than loud_level_db
+    BaseFloat max_zero_crossing_rate;
+    BaseFloat loud_level_db;
+    // Blocks whose last tone_window_ms of audio have more than this part of
+    // their energy in one or two telephone signalling tones (DTMF, dial,
+    // ringback and busy tones) are tones, however loud they are. Speech
+    // spreads its energy too widely for that.
+    BaseFloat max_tone_fraction;
+    BaseFloat tone_window_ms;
+    // Blocks kept after the last speech block, for speech onsets and
+    // trailing consonants that are quieter than the rest
+    int32 hangover_blocks;
+
+    SpeechGateOptions() : block_ms(10), min_level_db(40), max_zero_crossing_rate(0.35),
+                          loud_level_db(55), max_tone_fraction(0.7), tone_window_ms(30),
+                          hangover_blocks(20) {}
+};
+
+// Streaming gate on raw audio that drops blocks which clearly hold no
+// speech before any features are computed. It only looks at the level, the
+// zero-crossing rate and the energy at a few tone frequencies of each
+// block, so it is much cheaper than the MFCC and the energy VAD that decide
+// about the remaining audio.
+class SpeechGate {
+public:
+    explicit SpeechGate(const SpeechGateOptions &opts);
+
+    // Copies the blocks of samples that may hold speech to the start of
+    // speech, which is grown as needed, and returns their number of
+    // samples. A partial block at the end waits for the next call.
+    int32 Process(BaseFloat sample_frequency, const VectorBase<BaseFloat> &samples,
+                  Vector<BaseFloat> *speech);
+    void Reset();
+
+    // Blocks seen and blocks dropped since the last call, for statistics
+    void TakeCounts(int64 *blocks, int64 *rejected);
+
+    // State for snapshots of the recognizer. The tone window starts over
+    // after Read.
+    void Write(std::ostream &os, bool binary) const;
+    void Read(std::istream &is, bool binary);
+
+private:
+    bool IsSpeech(const BaseFloat *block, int32 size, BaseFloat sample_frequency) const;
+    // Part of the energy of the tone window in its strongest one or two
+    // signalling tones
+    BaseFloat ToneFraction(BaseFloat sample_frequency) const;
+    // Updates the tone window, the hangover and the counts, true if the
+    // block is kept
+    bool Accept(const BaseFloat *block, int32 size, BaseFloat sample_frequency);
+
+    SpeechGateOptions opts_;
+    Vector<BaseFloat> pending_;
+    int32 pending_size_;
+    // The last samples up to the current block, oldest first
+    Vector<BaseFloat> tone_window_;
+    int32 tone_window_size_;
+    int32 hangover_;
+    int64 blocks_;
+    int64 rejected_;
+};
+
+#endif /* SPEECH_GATE_H_ */
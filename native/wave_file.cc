@@ -0,0 +1,225 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wave_file.h"
+#include "g711.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_ALAW 0x0006
+#define WAVE_FORMAT_MULAW 0x0007
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+// RIFF fields are little-endian
+static uint32 ReadLe32(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32)p[3] << 24);
+}
+
+static uint32 ReadLe16(const unsigned char *p) {
+    return p[0] | (p[1] << 8);
+}
+
+WaveFile::WaveFile() : map_(NULL), map_size_(0),
+#ifdef _WIN32
+                       file_handle_(NULL), mapping_handle_(NULL),
+#endif
+                       data_(NULL), data_size_(0), format_(kPcm16), sample_frequency_(0),
+                       num_channels_(0), bytes_per_sample_(0), num_frames_(0) {
+}
+
+WaveFile::~WaveFile() {
+    Close();
+}
+
+bool WaveFile::Open(const char *path) {
+    Close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        KALDI_WARN << "Failed to open " << path;
+        return false;
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    HANDLE mapping = size.QuadPart > 0 ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+    file_handle_ = file;
+    mapping_handle_ = mapping;
+    if (mapping == NULL) {
+        KALDI_WARN << "Failed to map " << path;
+        Close();
+        return false;
+    }
+    map_ = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    map_size_ = size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        KALDI_WARN << "Failed to open " << path;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        KALDI_WARN << "Failed to read " << path;
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        KALDI_WARN << "Failed to map " << path;
+        return false;
+    }
+    // The data is read once from start to end
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    map_ = (const unsigned char *)map;
+    map_size_ = st.st_size;
+#endif
+    if (map_ == NULL || !Parse(path)) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void WaveFile::Close() {
+#ifdef _WIN32
+    if (map_)
+        UnmapViewOfFile(map_);
+    if (mapping_handle_)
+        CloseHandle(mapping_handle_);
+    if (file_handle_)
+        CloseHandle(file_handle_);
+    file_handle_ = NULL;
+    mapping_handle_ = NULL;
+#else
+    if (map_)
+        munmap((void *)map_, map_size_);
+#endif
+    map_ = NULL;
+    map_size_ = 0;
+    data_ = NULL;
+    data_size_ = 0;
+    num_frames_ = 0;
+}
+
+bool WaveFile::Parse(const char *path) {
+    if (map_size_ < 12 || memcmp(map_, "RIFF", 4) != 0 || memcmp(map_ + 8, "WAVE", 4) != 0) {
+        KALDI_WARN << path << " is not a RIFF/WAVE file";
+        return false;
+    }
+
+    bool have_format = false;
+    uint32 format_tag = 0, bits_per_sample = 0;
+    size_t pos = 12;
+    while (pos + 8 <= map_size_) {
+        const unsigned char *chunk = map_ + pos;
+        size_t chunk_size = ReadLe32(chunk + 4);
+        size_t available = map_size_ - pos - 8;
+
+        if (memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16 && chunk_size <= available) {
+            format_tag = ReadLe16(chunk + 8);
+            num_channels_ = ReadLe16(chunk + 10);
+            sample_frequency_ = ReadLe32(chunk + 12);
+            bits_per_sample = ReadLe16(chunk + 22);
+            // The real format of extensible files is the start of the subformat GUID
+            if (format_tag == WAVE_FORMAT_EXTENSIBLE && chunk_size >= 40)
+                format_tag = ReadLe16(chunk + 32);
+            have_format = true;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!have_format) {
+                KALDI_WARN << path << " has no format chunk before the data";
+                return false;
+            }
+            // Files that were still being written may have a bogus size
+            data_ = chunk + 8;
+            data_size_ = std::min(chunk_size, available);
+            break;
+        }
+        pos += 8 + chunk_size + (chunk_size & 1);
+    }
+
+    if (data_ == NULL) {
+        KALDI_WARN << path << " has no data chunk";
+        return false;
+    }
+
+    if (format_tag == WAVE_FORMAT_PCM && bits_per_sample == 16) {
+        format_ = kPcm16;
+    } else if (format_tag == WAVE_FORMAT_IEEE_FLOAT && bits_per_sample == 32) {
+        format_ = kFloat32;
+    } else if (format_tag == WAVE_FORMAT_ALAW && bits_per_sample == 8) {
+        format_ = kAlaw;
+    } else if (format_tag == WAVE_FORMAT_MULAW && bits_per_sample == 8) {
+        format_ = kUlaw;
+    } else {
+        KALDI_WARN << path << " has unsupported format " << format_tag
+                   << " with " << bits_per_sample << " bits per sample";
+        return false;
+    }
+    if (num_channels_ <= 0 || sample_frequency_ <= 0) {
+        KALDI_WARN << path << " has an invalid format chunk";
+        return false;
+    }
+
+    bytes_per_sample_ = bits_per_sample / 8;
+    num_frames_ = data_size_ / (bytes_per_sample_ * num_channels_);
+    return true;
+}
+
+void WaveFile::Decode(int64 first_frame, int32 num_frames, int32 channel,
+                      Vector<BaseFloat> *samples) const {
+    num_frames = std::max<int64>(0, std::min<int64>(num_frames, num_frames_ - first_frame));
+    samples->Resize(num_frames, kUndefined);
+    BaseFloat *out = samples->Data();
+    int32 stride = bytes_per_sample_ * num_channels_;
+    const unsigned char *in = data_ + first_frame * stride + channel * bytes_per_sample_;
+
+    switch (format_) {
+        case kPcm16:
+            for (int32 i = 0; i < num_frames; i++, in += stride) {
+                int16 sample;
+                memcpy(&sample, in, sizeof(sample));
+                out[i] = sample;
+            }
+            break;
+        case kFloat32:
+            // Float files hold samples in [-1, 1], the models expect the 16-bit range
+            for (int32 i = 0; i < num_frames; i++, in += stride) {
+                float sample;
+                memcpy(&sample, in, sizeof(sample));
+                out[i] = sample * 32768.0f;
+            }
+            break;
+        case kAlaw:
+            for (int32 i = 0; i < num_frames; i++, in += stride)
+                out[i] = kAlawTable[*in];
+            break;
+        case kUlaw:
+            for (int32 i = 0; i < num_frames; i++, in += stride)
+                out[i] = kUlawTable[*in];
+            break;
+    }
+}
@@ -0,0 +1,71 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef WAVE_FILE_H_
+#define WAVE_FILE_H_
+
+#include "base/kaldi-common.h"
+#include "matrix/kaldi-matrix.h"
+
+using namespace kaldi;
+
+// Memory-mapped RIFF/WAVE file. The chunks are parsed to find the format and
+// the audio data, which is decoded in blocks straight from the mapping
+// without reading the whole file into memory.
+class WaveFile {
+public:
+    enum Format {
+        kPcm16,
+        kFloat32,
+        kAlaw,
+        kUlaw
+    };
+
+    WaveFile();
+    ~WaveFile();
+
+    // Maps and parses the file, returns false with a warning if it can not
+    // be read or the format is not supported
+    bool Open(const char *path);
+    void Close();
+
+    BaseFloat SampleFrequency() const { return sample_frequency_; }
+    int32 NumChannels() const { return num_channels_; }
+    int64 NumFrames() const { return num_frames_; }
+    Format SampleFormat() const { return format_; }
+
+    // Decodes num_frames frames of one channel starting at first_frame
+    void Decode(int64 first_frame, int32 num_frames, int32 channel,
+                Vector<BaseFloat> *samples) const;
+
+private:
+    bool Parse(const char *path);
+
+    const unsigned char *map_;
+    size_t map_size_;
+#ifdef _WIN32
+    void *file_handle_;
+    void *mapping_handle_;
+#endif
+    // The data chunk, which need not be the last one of the mapping
+    const unsigned char *data_;
+    size_t data_size_;
+    Format format_;
+    BaseFloat sample_frequency_;
+    int32 num_channels_;
+    int32 bytes_per_sample_;
+    int64 num_frames_;
+};
+
+#endif /* WAVE_FILE_H_ */
@@ -0,0 +1,65 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "worker_pool.h"
+#include "cpu_affinity.h"
+
+WorkerPool::WorkerPool(int num_threads, size_t queue_size,
+                       const std::vector<std::vector<int> > &cpu_sets) : queue_(queue_size)
+{
+    for (int i = 0; i < num_threads; i++) {
+        std::vector<int> cpus;
+        if (!cpu_sets.empty())
+            cpus = cpu_sets[i % cpu_sets.size()];
+        threads_.emplace_back(&WorkerPool::Run, this, cpus);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    queue_.Close();
+    for (auto &thread : threads_)
+        thread.join();
+}
+
+bool WorkerPool::TrySubmit(std::function<void()> task)
+{
+    return queue_.TryPush(std::move(task));
+}
+
+void WorkerPool::Submit(std::function<void()> task)
+{
+    queue_.Push(std::move(task));
+}
+
+bool WorkerPool::IsWorkerThread() const
+{
+    std::thread::id id = std::this_thread::get_id();
+    for (auto const &thread : threads_)
+        if (thread.get_id() == id)
+            return true;
+    return false;
+}
+
+void WorkerPool::Run(std::vector<int> cpus)
+{
+    // Pinned before the first task so that its memory is node local
+    if (!cpus.empty())
+        PinCurrentThread(cpus);
+    std::function<void()> task;
+    while (queue_.Pop(&task)) {
+        task();
+        task = nullptr;
+    }
+}
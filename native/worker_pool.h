@@ -0,0 +1,49 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef WORKER_POOL_H_
+#define WORKER_POOL_H_
+
+#include "bounded_queue.h"
+
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads running tasks from a bounded queue. The destructor
+// runs the tasks that are still queued before joining the threads.
+class WorkerPool {
+public:
+    // Thread i is pinned to the CPUs of cpu_sets[i % cpu_sets.size()],
+    // threads aren't pinned if cpu_sets is empty
+    WorkerPool(int num_threads, size_t queue_size,
+               const std::vector<std::vector<int> > &cpu_sets = std::vector<std::vector<int> >());
+    ~WorkerPool();
+
+    // Queues the task, false if the queue is full
+    bool TrySubmit(std::function<void()> task);
+    // Queues the task, waiting for room in the queue
+    void Submit(std::function<void()> task);
+
+    int NumThreads() const { return threads_.size(); }
+    bool IsWorkerThread() const;
+
+private:
+    void Run(std::vector<int> cpus);
+
+    BoundedQueue<std::function<void()> > queue_;
+    std::vector<std::thread> threads_;
+};
+
+#endif /* WORKER_POOL_H_ */
@@ -0,0 +1,131 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "xvector_cache.h"
+
+#include <string.h>
+
+static const uint64 kHashPrime = 1099511628211ULL;
+
+void AudioHasher::Update(const VectorBase<BaseFloat> &samples)
+{
+    const BaseFloat *data = samples.Data();
+    uint64 hash = hash_;
+    for (int32 i = 0; i < samples.Dim(); i++) {
+        uint32 bits;
+        memcpy(&bits, data + i, sizeof(bits));
+        hash = (hash ^ bits) * kHashPrime;
+    }
+    hash_ = hash;
+    num_samples_ += samples.Dim();
+}
+
+uint64 AudioHasher::Key(uint64 seed) const
+{
+    // Finalizer from MurmurHash3 so that similar inputs spread over the table
+    uint64 key = hash_ ^ (seed * kHashPrime) ^ (num_samples_ << 1);
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+void AudioHasher::Write(std::ostream &os, bool binary) const
+{
+    WriteBasicType(os, binary, hash_);
+    WriteBasicType(os, binary, num_samples_);
+}
+
+void AudioHasher::Read(std::istream &is, bool binary)
+{
+    ReadBasicType(is, binary, &hash_);
+    ReadBasicType(is, binary, &num_samples_);
+}
+
+XvectorCache::XvectorCache() : max_bytes_(0), bytes_(0), hits_(0), misses_(0)
+{
+}
+
+void XvectorCache::SetMaxBytes(size_t max_bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_bytes_ = max_bytes;
+    Evict(max_bytes_);
+}
+
+bool XvectorCache::Enabled() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_bytes_ > 0;
+}
+
+size_t XvectorCache::MaxBytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_bytes_;
+}
+
+bool XvectorCache::Lookup(uint64 key, Vector<BaseFloat> *xvector)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        misses_++;
+        return false;
+    }
+    entries_.splice(entries_.begin(), entries_, it->second);
+    *xvector = it->second->xvector;
+    hits_++;
+    return true;
+}
+
+void XvectorCache::Insert(uint64 key, const VectorBase<BaseFloat> &xvector)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (max_bytes_ == 0 || index_.count(key) != 0)
+        return;
+
+    entries_.push_front(Entry());
+    entries_.front().key = key;
+    entries_.front().xvector = xvector;
+    index_[key] = entries_.begin();
+    bytes_ += EntryBytes(entries_.front());
+    Evict(max_bytes_);
+}
+
+void XvectorCache::GetStats(int64 *hits, int64 *misses, int64 *bytes) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    *hits = hits_;
+    *misses = misses_;
+    *bytes = bytes_;
+}
+
+size_t XvectorCache::EntryBytes(const Entry &entry)
+{
+    // List node, index node and the x-vector data
+    return sizeof(Entry) + 2 * sizeof(void *) + sizeof(uint64) + 4 * sizeof(void *)
+           + entry.xvector.Dim() * sizeof(BaseFloat);
+}
+
+void XvectorCache::Evict(size_t max_bytes)
+{
+    while (bytes_ > max_bytes && !entries_.empty()) {
+        bytes_ -= EntryBytes(entries_.back());
+        index_.erase(entries_.back().key);
+        entries_.pop_back();
+    }
+}
@@ -0,0 +1,80 @@
+// Copyright 2020 Alpha Cephei Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef XVECTOR_CACHE_H_
+#define XVECTOR_CACHE_H_
+
+#include "base/kaldi-common.h"
+#include "matrix/kaldi-matrix.h"
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+using namespace kaldi;
+
+// Streaming hash of the accepted audio. Samples are mixed one by one so the
+// result does not depend on how the audio was split between calls.
+class AudioHasher {
+public:
+    AudioHasher() { Reset(); }
+    void Reset() { hash_ = 14695981039346656037ULL; num_samples_ = 0; }
+    void Update(const VectorBase<BaseFloat> &samples);
+    // Key of the audio so far, seed mixes in settings that change the result
+    uint64 Key(uint64 seed) const;
+    int64 NumSamples() const { return num_samples_; }
+    void Write(std::ostream &os, bool binary) const;
+    void Read(std::istream &is, bool binary);
+
+private:
+    uint64 hash_;
+    int64 num_samples_;
+};
+
+// Bounded LRU cache of x-vectors keyed by AudioHasher::Key. An empty
+// x-vector records audio with too little speech to compute one.
+// All methods are thread-safe.
+class XvectorCache {
+public:
+    XvectorCache();
+
+    // A limit of 0 disables the cache and drops all entries
+    void SetMaxBytes(size_t max_bytes);
+    bool Enabled() const;
+    size_t MaxBytes() const;
+
+    bool Lookup(uint64 key, Vector<BaseFloat> *xvector);
+    void Insert(uint64 key, const VectorBase<BaseFloat> &xvector);
+    void GetStats(int64 *hits, int64 *misses, int64 *bytes) const;
+
+private:
+    struct Entry {
+        uint64 key;
+        Vector<BaseFloat> xvector;
+    };
+    typedef std::list<Entry> EntryList;
+
+    static size_t EntryBytes(const Entry &entry);
+    void Evict(size_t max_bytes);
+
+    EntryList entries_;  // most recently used first
+    std::unordered_map<uint64, EntryList::iterator> index_;
+    size_t max_bytes_;
+    size_t bytes_;
+    int64 hits_;
+    int64 misses_;
+    mutable std::mutex mutex_;
+};
+
+#endif /* XVECTOR_CACHE_H_ */
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+
+# Client of the lid-server daemon, which keeps the model loaded between
+# runs. Start it with
+#   native/lid-server lid-model /tmp/lid.sock
+# and run this script with a wav file and the socket path.
+
+import socket
+import struct
+import sys
+import wave
+
+wf = wave.open(sys.argv[1], "rb")
+if wf.getnchannels() != 1 or wf.getsampwidth() != 2 or wf.getcomptype() != "NONE":
+    print ("Audio file must be WAV format mono PCM.")
+    exit (1)
+
+
+def send_frame(sock, kind, payload=b""):
+    sock.sendall(struct.pack("<Ic", len(payload) + 1, kind) + payload)
+
+
+def read_exactly(sock, size):
+    data = b""
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise ConnectionError("server closed the connection")
+        data += chunk
+    return data
+
+
+def read_frame(sock):
+    length, kind = struct.unpack("<Ic", read_exactly(sock, 5))
+    return kind, read_exactly(sock, length - 1)
+
+
+sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+sock.connect(sys.argv[2] if len(sys.argv) > 2 else "/tmp/lid.sock")
+
+def read_string(payload, offset):
+    size = payload[offset]
+    return payload[offset + 1:offset + 1 + size].decode(), offset + 1 + size
+
+
+# Sample rate, up to 3 results, with language names, all languages
+send_frame(sock, b"O", struct.pack("<IiB", wf.getframerate(), 3, 1))
+kind, payload = read_frame(sock)
+if kind == b"E":
+    print("error:", payload.decode())
+    exit (1)
+# The languages of the model as (code, name), results refer to them by index
+languages = []
+offset = 4
+for i in range(struct.unpack_from("<I", payload)[0]):
+    code, offset = read_string(payload, offset)
+    name, offset = read_string(payload, offset)
+    languages.append((code, name))
+
+while True:
+    data = wf.readframes(4000)
+    if len(data) == 0:
+        break
+    send_frame(sock, b"A", data)
+send_frame(sock, b"R")
+
+kind, payload = read_frame(sock)
+if kind == b"E":
+    print("error:", payload.decode())
+    exit (1)
+results = []
+for i in range(struct.unpack_from("<I", payload)[0]):
+    index, score = struct.unpack_from("<If", payload, 4 + 8 * i)
+    code, name = languages[index]
+    results.append({"language": code, "name": name, "score": score})
+print(results)
+if results:
+    print("identified language: ", results[0]['language'])
+sock.close()
@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+
+# Measures how the recognition throughput scales with Python threads and
+# with the native batch API. The native calls release the GIL, so threads
+# run the recognizers in parallel.
+
+from lid import Model, KaldiRecognizer, ResultBatch, SetLogLevel
+from concurrent.futures import ThreadPoolExecutor
+import sys
+import os
+import time
+import wave
+
+wf = wave.open(sys.argv[1] if len(sys.argv) > 1 else "test_ru.wav", "rb")
+if wf.getnchannels() != 1 or wf.getsampwidth() != 2 or wf.getcomptype() != "NONE":
+    print ("Audio file must be WAV format mono PCM.")
+    exit (1)
+rate = wf.getframerate()
+# 16-bit samples, passed to the recognizer without a copy
+samples = memoryview(wf.readframes(-1)).cast('h')
+duration = len(samples) / rate
+
+SetLogLevel(-1)
+model = Model("lid-model")
+num_files = 4 * (os.cpu_count() or 1)
+
+
+def recognize(_):
+    rec = KaldiRecognizer(model, rate)
+    rec.AcceptWaveform(samples)
+    return rec.Result()
+
+
+def report(name, threads, elapsed):
+    print("%-8s threads %3d  %6.2f files/s  RTF %.4f" %
+          (name, threads, num_files / elapsed, elapsed / (num_files * duration)))
+
+
+threads = 1
+while threads <= (os.cpu_count() or 1):
+    start = time.time()
+    with ThreadPoolExecutor(threads) as pool:
+        list(pool.map(recognize, range(num_files)))
+    report("threads", threads, time.time() - start)
+    threads *= 2
+
+start = time.time()
+recognizers = []
+for _ in range(num_files):
+    rec = KaldiRecognizer(model, rate)
+    rec.AcceptWaveform(samples)
+    recognizers.append(rec)
+ResultBatch(recognizers)
+report("batch", os.cpu_count() or 1, time.time() - start)
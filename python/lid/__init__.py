@@ -1,5 +1,7 @@
 import os
 import sys
+import itertools
+from concurrent.futures import Future
 
 from .lid_cffi import ffi as _ffi
 
@@ -20,14 +22,146 @@ def open_dll():
 
 _c = open_dll()
 
+STATUS_OK = _c.L2M_STATUS_OK
+STATUS_DEADLINE_EXCEEDED = _c.L2M_STATUS_DEADLINE_EXCEEDED
+STATUS_CANCELLED = _c.L2M_STATUS_CANCELLED
+STATUS_BUSY = _c.L2M_STATUS_BUSY
+
+AFFINITY_NONE = _c.L2M_AFFINITY_NONE
+AFFINITY_CORES = _c.L2M_AFFINITY_CORES
+AFFINITY_NUMA = _c.L2M_AFFINITY_NUMA
+
+
+# (future, object used by the native call) by request id, which keeps the
+# object alive until the callback
+_pending = {}
+_request_ids = itertools.count(1)
+
+
+@_ffi.callback("L2mLoadCallback")
+def _load_callback(user_data, success):
+    future, _ = _pending.pop(int(_ffi.cast("intptr_t", user_data)), (None, None))
+    if future is not None:
+        future.set_result(success != 0)
+
+
+@_ffi.callback("L2mResultCallback")
+def _result_callback(user_data, result):
+    # The recognizer next to the future is released only after the result
+    # was copied, it may be freed right here
+    future, _ = _pending.pop(int(_ffi.cast("intptr_t", user_data)), (None, None))
+    if future is None:
+        return
+    if result == _ffi.NULL:
+        future.set_exception(RuntimeError("Failed to compute the result"))
+    else:
+        future.set_result(_ffi.string(result).decode('utf-8'))
+
+
+def _samples(data):
+    """Returns (kind, pointer, length) for a waveform without copying it.
+
+    Accepts bytes and any C-contiguous buffer such as bytearray, memoryview,
+    array.array or a NumPy array. 16-bit integer buffers are passed as short
+    samples, 32-bit float buffers as float samples and byte buffers as raw
+    16-bit little-endian PCM bytes. The length is in units of the kind.
+    """
+    if isinstance(data, bytes):
+        return 'b', data, len(data)
+    view = memoryview(data)
+    if not view.c_contiguous:
+        raise TypeError("Audio buffer must be contiguous")
+    fmt = view.format.lstrip('@=<')
+    if fmt == 'h':
+        return 's', _ffi.from_buffer("short[]", data), view.nbytes // 2
+    if fmt == 'f':
+        return 'f', _ffi.from_buffer("float[]", data), view.nbytes // 4
+    if fmt in ('B', 'b', 'c'):
+        return 'b', _ffi.from_buffer("char[]", data), view.nbytes
+    raise TypeError("Unsupported audio format '%s', use int16 or float32 samples or bytes" % view.format)
+
+
+def _bytes(data):
+    return _ffi.from_buffer("unsigned char[]", data)
+
+
+class CancelToken(object):
+    """Stops a running KaldiRecognizer.ResultWithDeadline when cancelled from another thread"""
+
+    def __init__(self):
+        self._flag = _ffi.new("int *", 0)
+
+    def cancel(self):
+        self._flag[0] = 1
+
+    def cancelled(self):
+        return self._flag[0] != 0
+
 class Model(object):
 
     def __init__(self, model_path):
         self._handle = _c.l2m_lid_model_new(model_path.encode('utf-8'))
 
+    @classmethod
+    def _from_handle(cls, handle):
+        model = cls.__new__(cls)
+        model._handle = handle
+        return model
+
     def __del__(self):
         _c.l2m_lid_model_free(self._handle)
 
+    def Languages(self):
+        return [_ffi.string(_c.l2m_lid_model_language(self._handle, i)).decode('utf-8')
+                for i in range(_c.l2m_lid_model_num_languages(self._handle))]
+
+    def XvectorDim(self):
+        return _c.l2m_lid_model_xvector_dim(self._handle)
+
+    def SetFrameBudget(self, max_frames):
+        return _c.l2m_lid_model_set_frame_budget(self._handle, max_frames)
+
+    def SetFrameSubsampling(self, factor):
+        """Runs the network at the frame rate divided by factor, before the first result"""
+        if _c.l2m_lid_model_set_frame_subsampling(self._handle, factor) != 0:
+            raise ValueError("The model was already used or the factor is below 1")
+
+    def SetWorkers(self, num_threads, queue_size=0):
+        return _c.l2m_lid_model_set_workers(self._handle, num_threads, queue_size)
+
+    def SetWorkerAffinity(self, affinity):
+        """Pins the worker threads to CPUs (AFFINITY_CORES) or NUMA nodes (AFFINITY_NUMA)"""
+        return _c.l2m_lid_model_set_worker_affinity(self._handle, affinity)
+
+    def SetCacheSize(self, max_bytes):
+        return _c.l2m_lid_model_set_cache_size(self._handle, max_bytes)
+
+    def CacheStats(self):
+        stats = _ffi.new("long long[3]")
+        _c.l2m_lid_model_get_cache_stats(self._handle, stats, stats + 1, stats + 2)
+        return {'hits': stats[0], 'misses': stats[1], 'bytes': stats[2]}
+
+    def CascadeStats(self):
+        stats = _ffi.new("long long[2]")
+        _c.l2m_lid_model_get_cascade_stats(self._handle, stats, stats + 1)
+        return {'requests': stats[0], 'escalations': stats[1]}
+
+    def SetSpeechGate(self, enabled):
+        """Drops silent and noise-only audio of new recognizers before feature extraction"""
+        return _c.l2m_lid_model_set_speech_gate(self._handle, 1 if enabled else 0)
+
+    def SpeechGateStats(self):
+        stats = _ffi.new("long long[2]")
+        _c.l2m_lid_model_get_speech_gate_stats(self._handle, stats, stats + 1)
+        return {'blocks': stats[0], 'rejected': stats[1]}
+
+    def ScoreXvector(self, xvector):
+        num_scores = _c.l2m_lid_model_num_languages(self._handle)
+        scores = _ffi.new("float[]", num_scores)
+        if _c.l2m_lid_model_score_xvector(self._handle, xvector, len(xvector), scores, num_scores) < 0:
+            raise ValueError("x-vector dimension does not match the model")
+        return list(scores)
+
 class KaldiRecognizer(object):
 
     def __init__(self, *args):
@@ -40,11 +174,192 @@ class KaldiRecognizer(object):
         _c.l2m_recognizer_free(self._handle)
 
     def AcceptWaveform(self, data):
-        return _c.l2m_recognizer_accept_waveform(self._handle, data, len(data))
+        """Accepts bytes of 16-bit PCM or a buffer of int16 or float32 samples, without copying"""
+        kind, samples, length = _samples(data)
+        if kind == 's':
+            return _c.l2m_recognizer_accept_waveform_s(self._handle, samples, length)
+        if kind == 'f':
+            return _c.l2m_recognizer_accept_waveform_f(self._handle, samples, length)
+        return _c.l2m_recognizer_accept_waveform(self._handle, samples, length)
+
+    def AcceptFile(self, path):
+        if _c.l2m_recognizer_accept_file(self._handle, path.encode('utf-8')) != 0:
+            raise IOError("Failed to read " + path)
+
+    def RecognizeFiles(self, paths):
+        c_paths = [_ffi.new("char[]", path.encode('utf-8')) for path in paths]
+        return _ffi.string(_c.l2m_recognizer_recognize_files(self._handle, c_paths, len(c_paths))).decode('utf-8')
+
+    def Reset(self):
+        return _c.l2m_recognizer_reset(self._handle)
+
+    def AcceptWaveformUlaw(self, data):
+        return _c.l2m_recognizer_accept_waveform_ulaw(self._handle, _bytes(data), memoryview(data).nbytes)
+
+    def AcceptWaveformAlaw(self, data):
+        return _c.l2m_recognizer_accept_waveform_alaw(self._handle, _bytes(data), memoryview(data).nbytes)
+
+    def SetLanguages(self, languages):
+        if not isinstance(languages, str):
+            languages = ",".join(languages)
+        if _c.l2m_recognizer_set_languages(self._handle, languages.encode('utf-8')) != 0:
+            raise ValueError("None of the languages is supported by the model: " + languages)
+
+    def SetMaxResults(self, max_results):
+        return _c.l2m_recognizer_set_max_results(self._handle, max_results)
+
+    def SetFrameBudget(self, max_frames):
+        return _c.l2m_recognizer_set_frame_budget(self._handle, max_frames)
+
+    def SetCascade(self, large_model, margin):
+        """Runs large_model only when the score margin of the two best languages is below margin"""
+        if _c.l2m_recognizer_set_cascade(self._handle, large_model._handle if large_model else _ffi.NULL, margin) != 0:
+            raise ValueError("The models differ in features or languages")
+
+    def SetSpeechGate(self, enabled):
+        return _c.l2m_recognizer_set_speech_gate(self._handle, 1 if enabled else 0)
+
+    def SetLanguageNames(self, enabled):
+        return _c.l2m_recognizer_set_language_names(self._handle, 1 if enabled else 0)
+
+    def Xvector(self):
+        dim = _c.l2m_recognizer_get_xvector(self._handle, _ffi.NULL, 0)
+        xvector = _ffi.new("float[]", dim)
+        _c.l2m_recognizer_get_xvector(self._handle, xvector, dim)
+        return list(xvector)
+
+    def Snapshot(self):
+        """Returns the stream state as bytes, to continue the stream with Restore
+        in another recognizer of the same model, also in another process"""
+        length = _ffi.new("int *")
+        data = _c.l2m_recognizer_snapshot(self._handle, length)
+        if data == _ffi.NULL:
+            raise RuntimeError("The model features do not support snapshots")
+        return _ffi.buffer(data, length[0])[:]
+
+    def Restore(self, snapshot):
+        if _c.l2m_recognizer_restore(self._handle, snapshot, len(snapshot)) != 0:
+            raise ValueError("Invalid snapshot")
 
     def Result(self):
         return _ffi.string(_c.l2m_recognizer_lang_result(self._handle)).decode('utf-8')
 
+    def ResultAsync(self):
+        """Computes the result on the model worker pool, returns a concurrent.futures.Future
+        completed from a worker thread (use asyncio.wrap_future in event loops). Raises
+        RuntimeError if the worker queue is full."""
+        future = Future()
+        request_id = next(_request_ids)
+        # The native request uses the recognizer until the callback
+        _pending[request_id] = (future, self)
+        status = _c.l2m_recognizer_lang_result_async(self._handle, _result_callback,
+                                                     _ffi.cast("void *", request_id))
+        if status != STATUS_OK:
+            del _pending[request_id]
+            raise RuntimeError("Worker queue is full")
+        return future
+
+    def ResultWithDeadline(self, timeout_ms=-1, cancel=None):
+        """Returns (result, status), the result covers only part of the audio unless status is STATUS_OK"""
+        status = _ffi.new("L2mStatus *")
+        flag = cancel._flag if cancel is not None else _ffi.NULL
+        result = _c.l2m_recognizer_lang_result_deadline(self._handle, timeout_ms, flag, status)
+        return _ffi.string(result).decode('utf-8'), status[0]
+
+
+class MultiChannelRecognizer(object):
+
+    def __init__(self, model, sample_rate, num_channels):
+        self._handle = _c.l2m_multi_recognizer_new(model._handle, sample_rate, num_channels)
+        if self._handle == _ffi.NULL:
+            raise ValueError("At least one channel is needed, got %d" % num_channels)
+        self._num_channels = num_channels
+
+    def __del__(self):
+        _c.l2m_multi_recognizer_free(self._handle)
+
+    def AcceptWaveform(self, data):
+        kind, samples, length = _samples(data)
+        if kind == 's':
+            return _c.l2m_multi_recognizer_accept_waveform_s(self._handle, samples, length)
+        if kind == 'f':
+            return _c.l2m_multi_recognizer_accept_waveform_f(self._handle, samples, length)
+        return _c.l2m_multi_recognizer_accept_waveform(self._handle, samples, length)
+
+    def AcceptFile(self, path):
+        if _c.l2m_multi_recognizer_accept_file(self._handle, path.encode('utf-8')) != 0:
+            raise IOError("Failed to read " + path)
+
+    def SetLanguages(self, languages):
+        if not isinstance(languages, str):
+            languages = ",".join(languages)
+        for c in range(self._num_channels):
+            if _c.l2m_recognizer_set_languages(_c.l2m_multi_recognizer_channel(self._handle, c),
+                                               languages.encode('utf-8')) != 0:
+                raise ValueError("None of the languages is supported by the model: " + languages)
+
+    def SetMaxResults(self, max_results):
+        for c in range(self._num_channels):
+            _c.l2m_recognizer_set_max_results(_c.l2m_multi_recognizer_channel(self._handle, c), max_results)
+
+    def Result(self):
+        return _ffi.string(_c.l2m_multi_recognizer_lang_result(self._handle)).decode('utf-8')
+
+
+class ModelStore(object):
+    """Serves a model to new recognizers and replaces it with a retrained one
+    without a restart. Running recognizers keep the model they were created with."""
+
+    def __init__(self, model_path):
+        self._handle = _c.l2m_model_store_new(_c.l2m_lid_model_new(model_path.encode('utf-8')))
+
+    def __del__(self):
+        _c.l2m_model_store_free(self._handle)
+
+    def Acquire(self):
+        return Model._from_handle(_c.l2m_model_store_acquire(self._handle))
+
+    def NewRecognizer(self, sample_rate):
+        return KaldiRecognizer(self.Acquire(), sample_rate)
+
+    def Load(self, model_path):
+        if _c.l2m_model_store_load(self._handle, model_path.encode('utf-8')) != 0:
+            raise IOError("Failed to load the model from " + model_path)
+
+    def LoadAsync(self, model_path):
+        """Loads in the background, returns a Future of whether the model was published.
+        Raises RuntimeError if another load is running."""
+        future = Future()
+        request_id = next(_request_ids)
+        _pending[request_id] = (future, self)
+        status = _c.l2m_model_store_load_async(self._handle, model_path.encode('utf-8'),
+                                               _load_callback, _ffi.cast("void *", request_id))
+        if status != STATUS_OK:
+            del _pending[request_id]
+            raise RuntimeError("A model is already loading")
+        return future
+
+    def Generation(self):
+        return _c.l2m_model_store_generation(self._handle)
+
+
+def ResultBatch(recognizers):
+    """Computes the results of recognizers sharing one model in parallel on the
+    model worker pool, with one network pass per worker. Returns the results in
+    order, None where the computation failed."""
+    handles = _ffi.new("L2mRecognizer *[]", [rec._handle for rec in recognizers])
+    results = _ffi.new("const char *[]", len(recognizers))
+    _c.l2m_recognizer_lang_result_batch(handles, len(recognizers), results)
+    return [_ffi.string(r).decode('utf-8') if r != _ffi.NULL else None for r in results]
+
 
 def SetLogLevel(level):
-    return _c.lid_set_log_level(level)
\ No newline at end of file
+    return _c.lid_set_log_level(level)
+
+def SetBlasThreads(num_threads):
+    """Threads of one BLAS operation in the whole process, returns the previous count"""
+    return _c.l2m_set_blas_threads(num_threads)
+
+def LanguageName(code):
+    name = _c.l2m_language_name(code.encode('utf-8'))
+    return _ffi.string(name).decode('utf-8') if name != _ffi.NULL else None
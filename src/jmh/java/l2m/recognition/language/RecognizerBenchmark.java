@@ -0,0 +1,132 @@
+package l2m.recognition.language;
+
+import com.fasterxml.jackson.databind.ObjectMapper;
+import org.openjdk.jmh.annotations.Benchmark;
+import org.openjdk.jmh.annotations.BenchmarkMode;
+import org.openjdk.jmh.annotations.Fork;
+import org.openjdk.jmh.annotations.Level;
+import org.openjdk.jmh.annotations.Measurement;
+import org.openjdk.jmh.annotations.Mode;
+import org.openjdk.jmh.annotations.OutputTimeUnit;
+import org.openjdk.jmh.annotations.Param;
+import org.openjdk.jmh.annotations.Scope;
+import org.openjdk.jmh.annotations.Setup;
+import org.openjdk.jmh.annotations.State;
+import org.openjdk.jmh.annotations.TearDown;
+import org.openjdk.jmh.annotations.Warmup;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.file.Files;
+import java.nio.file.Paths;
+import java.util.concurrent.TimeUnit;
+
+/**
+ * Per-call overhead of the Java binding: array versus direct buffer input and JSON versus
+ * structured scores output. Run with the model in lid-model and test_ru.wav in the working
+ * directory, or set -Dlid.model and -Dlid.audio.
+ */
+@State(Scope.Thread)
+@BenchmarkMode(Mode.AverageTime)
+@OutputTimeUnit(TimeUnit.MICROSECONDS)
+@Warmup(iterations = 3, time = 2)
+@Measurement(iterations = 5, time = 2)
+@Fork(1)
+public class RecognizerBenchmark {
+
+    // Bytes of 16-bit audio per call, 20 ms and 1 s at 8 kHz
+    @Param({"320", "16000"})
+    public int packetBytes;
+
+    private Model model;
+    private Recognizer recognizer;
+    private byte[] audio;
+    private byte[] packet;
+    private ByteBuffer directPacket;
+    private int position;
+    private final ObjectMapper mapper = new ObjectMapper();
+
+    @Setup(Level.Trial)
+    public void setUp() throws Exception {
+        LibLid.lid_set_log_level(-1);
+        model = new Model(System.getProperty("lid.model", "lid-model"));
+        final byte[] wav = Files.readAllBytes(Paths.get(System.getProperty("lid.audio", "test_ru.wav")));
+        // Skips the canonical 44 byte header, good enough for timing
+        audio = new byte[wav.length - 44];
+        System.arraycopy(wav, 44, audio, 0, audio.length);
+        packet = new byte[packetBytes];
+        directPacket = ByteBuffer.allocateDirect(packetBytes).order(ByteOrder.nativeOrder());
+    }
+
+    @Setup(Level.Iteration)
+    public void newRecognizer() {
+        recognizer = new Recognizer(model, 8000);
+        position = 0;
+    }
+
+    @TearDown(Level.Iteration)
+    public void closeRecognizer() {
+        recognizer.close();
+    }
+
+    @TearDown(Level.Trial)
+    public void tearDown() {
+        model.close();
+    }
+
+    private int nextOffset() {
+        if (position + packetBytes > audio.length) {
+            position = 0;
+        }
+        final int offset = position;
+        position += packetBytes;
+        return offset;
+    }
+
+    @Benchmark
+    public void acceptArray() {
+        System.arraycopy(audio, nextOffset(), packet, 0, packetBytes);
+        recognizer.acceptWaveForm(packet);
+    }
+
+    @Benchmark
+    public void acceptDirectBuffer() {
+        directPacket.clear();
+        directPacket.put(audio, nextOffset(), packetBytes);
+        directPacket.flip();
+        recognizer.acceptWaveForm(directPacket);
+    }
+
+    /**
+     * Result overhead on a short utterance, where the JSON round trip is a visible share.
+     */
+    @State(Scope.Thread)
+    public static class ResultState {
+        Model model;
+        Recognizer recognizer;
+
+        @Setup(Level.Trial)
+        public void setUp() throws Exception {
+            LibLid.lid_set_log_level(-1);
+            model = new Model(System.getProperty("lid.model", "lid-model"));
+            recognizer = new Recognizer(model, 8000);
+            recognizer.acceptFile(System.getProperty("lid.audio", "test_ru.wav"));
+        }
+
+        @TearDown(Level.Trial)
+        public void tearDown() {
+            recognizer.close();
+            model.close();
+        }
+    }
+
+    @Benchmark
+    public LangScore[] resultJson(ResultState state) throws Exception {
+        return mapper.readValue(state.recognizer.getResult(), LangScore[].class);
+    }
+
+    @Benchmark
+    public float[] resultScores(ResultState state) {
+        return state.recognizer.getScores();
+    }
+}
@@ -0,0 +1,27 @@
+package l2m.recognition.language;
+
+import com.sun.jna.Memory;
+
+/**
+ * Flag in native memory that stops a running {@link Recognizer#getResult(int, CancelToken)}
+ * when set from another thread.
+ */
+public class CancelToken {
+    private final Memory flag = new Memory(4);
+
+    public CancelToken() {
+        flag.setInt(0, 0);
+    }
+
+    public void cancel() {
+        flag.setInt(0, 1);
+    }
+
+    public boolean isCancelled() {
+        return flag.getInt(0) != 0;
+    }
+
+    Memory getPointer() {
+        return flag;
+    }
+}
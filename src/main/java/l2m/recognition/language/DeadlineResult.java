@@ -0,0 +1,20 @@
+package l2m.recognition.language;
+
+import lombok.Data;
+
+/**
+ * Result of {@link Recognizer#getResult(int, CancelToken)}. Unless the status is OK the
+ * result only covers the part of the audio processed before the deadline or cancellation.
+ */
+@Data
+public class DeadlineResult {
+
+    public enum Status {
+        OK,
+        DEADLINE_EXCEEDED,
+        CANCELLED
+    }
+
+    private final String result;
+    private final Status status;
+}
@@ -1,9 +1,14 @@
 package l2m.recognition.language;
 
+import com.sun.jna.Callback;
 import com.sun.jna.Native;
 import com.sun.jna.Platform;
 import com.sun.jna.Pointer;
 
+import java.nio.ByteBuffer;
+import java.nio.FloatBuffer;
+import java.nio.ShortBuffer;
+
 public class LibLid {
 
     static {
@@ -11,10 +16,44 @@ public class LibLid {
         Native.register(LibLid.class, Platform.isWindows() ? "liblid" : "lid");
     }
 
+    public interface ResultCallback extends Callback {
+        void invoke(Pointer userData, String result);
+    }
+
+    public interface LoadCallback extends Callback {
+        void invoke(Pointer userData, int success);
+    }
+
     public static native Pointer l2m_lid_model_new(String path);
 
     public static native void l2m_lid_model_free(Pointer model);
 
+    public static native int l2m_lid_model_num_languages(Pointer model);
+
+    public static native String l2m_lid_model_language(Pointer model, int index);
+
+    public static native int l2m_lid_model_xvector_dim(Pointer model);
+
+    public static native int l2m_lid_model_score_xvector(Pointer model, float[] xvector, int dim, float[] scores, int num_scores);
+
+    public static native void l2m_lid_model_set_cache_size(Pointer model, long max_bytes);
+
+    public static native void l2m_lid_model_get_cache_stats(Pointer model, long[] hits, long[] misses, long[] bytes);
+
+    public static native void l2m_lid_model_get_cascade_stats(Pointer model, long[] requests, long[] escalations);
+
+    public static native void l2m_lid_model_set_worker_affinity(Pointer model, int affinity);
+
+    public static native void l2m_lid_model_set_speech_gate(Pointer model, boolean enabled);
+
+    public static native void l2m_lid_model_get_speech_gate_stats(Pointer model, long[] blocks, long[] rejected);
+
+    public static native void l2m_lid_model_set_workers(Pointer model, int num_threads, int queue_size);
+
+    public static native void l2m_lid_model_set_frame_budget(Pointer model, int max_frames);
+
+    public static native int l2m_lid_model_set_frame_subsampling(Pointer model, int factor);
+
     public static native Pointer l2m_recognizer_new_lid(Model model, float sample_rate);
 
     public static native void l2m_recognizer_accept_waveform(Pointer recognizer, byte[] data, int length);
@@ -23,9 +62,83 @@ public class LibLid {
 
     public static native void l2m_recognizer_accept_waveform_f(Pointer recognizer, float[] data, int length);
 
+    public static native void l2m_recognizer_accept_waveform(Pointer recognizer, ByteBuffer data, int length);
+
+    public static native void l2m_recognizer_accept_waveform_s(Pointer recognizer, ShortBuffer data, int length);
+
+    public static native void l2m_recognizer_accept_waveform_f(Pointer recognizer, FloatBuffer data, int length);
+
+    public static native void l2m_recognizer_accept_waveform_ulaw(Pointer recognizer, byte[] data, int length);
+
+    public static native void l2m_recognizer_accept_waveform_alaw(Pointer recognizer, byte[] data, int length);
+
+    public static native int l2m_recognizer_accept_file(Pointer recognizer, String path);
+
+    public static native String l2m_recognizer_recognize_files(Pointer recognizer, String[] paths, int num_paths);
+
+    public static native void l2m_recognizer_reset(Pointer recognizer);
+
+    public static native int l2m_recognizer_set_languages(Pointer recognizer, String languages);
+
+    public static native void l2m_recognizer_set_max_results(Pointer recognizer, int max_results);
+
+    public static native void l2m_recognizer_set_frame_budget(Pointer recognizer, int max_frames);
+
+    public static native void l2m_recognizer_set_language_names(Pointer recognizer, boolean language_names);
+
+    public static native void l2m_recognizer_set_speech_gate(Pointer recognizer, boolean enabled);
+
+    public static native int l2m_recognizer_set_cascade(Pointer recognizer, Pointer large_model, float margin);
+
     public static native String l2m_recognizer_lang_result(Pointer recognizer);
 
+    public static native String l2m_recognizer_lang_result_deadline(Pointer recognizer, int timeout_ms, Pointer cancel, int[] status);
+
+    public static native int l2m_recognizer_lang_scores(Pointer recognizer, float[] scores, int max_scores);
+
+    public static native void l2m_recognizer_lang_result_batch(Pointer recognizers, int num_recognizers, Pointer results);
+
+    public static native int l2m_recognizer_lang_result_async(Pointer recognizer, ResultCallback callback, Pointer user_data);
+
+    public static native int l2m_recognizer_get_xvector(Pointer recognizer, float[] xvector, int max_dim);
+
+    public static native Pointer l2m_recognizer_snapshot(Pointer recognizer, int[] length);
+
+    public static native int l2m_recognizer_restore(Pointer recognizer, byte[] data, int length);
+
     public static native void l2m_recognizer_free(Pointer recognizer);
 
+    public static native Pointer l2m_multi_recognizer_new(Model model, float sample_rate, int num_channels);
+
+    public static native void l2m_multi_recognizer_accept_waveform(Pointer recognizer, byte[] data, int length);
+
+    public static native void l2m_multi_recognizer_accept_waveform_s(Pointer recognizer, short[] data, int length);
+
+    public static native void l2m_multi_recognizer_accept_waveform_f(Pointer recognizer, float[] data, int length);
+
+    public static native int l2m_multi_recognizer_accept_file(Pointer recognizer, String path);
+
+    public static native Pointer l2m_multi_recognizer_channel(Pointer recognizer, int channel);
+
+    public static native String l2m_multi_recognizer_lang_result(Pointer recognizer);
+
+    public static native void l2m_multi_recognizer_free(Pointer recognizer);
+
+    public static native Pointer l2m_model_store_new(Pointer model);
+
+    public static native Pointer l2m_model_store_acquire(Pointer store);
+
+    public static native int l2m_model_store_load(Pointer store, String path);
+
+    public static native int l2m_model_store_load_async(Pointer store, String path, LoadCallback callback, Pointer user_data);
+
+    public static native long l2m_model_store_generation(Pointer store);
+
+    public static native void l2m_model_store_free(Pointer store);
+
     public static native void lid_set_log_level(int log_level);
+
+    public static native int l2m_set_blas_threads(int num_threads);
+
+    public static native String l2m_language_name(String code);
 }
@@ -1,14 +1,11 @@
 package l2m.recognition.language;
 
-import com.fasterxml.jackson.databind.ObjectMapper;
 import lombok.SneakyThrows;
 
-import java.io.File;
-import java.nio.file.Files;
-import java.util.Arrays;
 import java.util.Comparator;
 import java.util.List;
 import java.util.stream.Collectors;
+import java.util.stream.IntStream;
 
 public class Main {
 
@@ -16,21 +13,19 @@ public class Main {
 
     @SneakyThrows
     public static void main(String[] args) {
-        final File file = new File("test_ru.wav");
         final Model lidModel = new Model("lid-model");
-        final byte[] array = Files.readAllBytes(file.toPath());
-
-        final byte[] data = new byte[array.length - 44];
-        if (array.length - 44 >= 0) {
-            System.arraycopy(array, 44, data, 0, array.length - 44);
-        }
+        final String[] languages = lidModel.getLanguages();
         final Recognizer recognizer = new Recognizer(lidModel, 8000);
-        recognizer.acceptWaveForm(data);
-        final String result = recognizer.getResult()
-            .replaceAll("(\\d+),(\\d+)", "$1.$2");
+        recognizer.acceptFile("test_ru.wav");
+        final float[] scores = recognizer.getScores();
 
-        final List<LangScore> langScoreList = Arrays
-            .stream(new ObjectMapper().readValue(result, LangScore[].class))
+        final List<LangScore> langScoreList = IntStream.range(0, scores.length)
+            .mapToObj(i -> {
+                final LangScore langScore = new LangScore();
+                langScore.setLanguage(languages[i]);
+                langScore.setScore((double) scores[i]);
+                return langScore;
+            })
             .sorted(Comparator.comparing(LangScore::getScore).reversed())
             .limit(TOP)
             .collect(Collectors.toList());
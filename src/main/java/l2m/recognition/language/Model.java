@@ -1,5 +1,6 @@
 package l2m.recognition.language;
 
+import com.sun.jna.Pointer;
 import com.sun.jna.PointerType;
 
 public class Model extends PointerType implements AutoCloseable {
@@ -10,6 +11,119 @@ public class Model extends PointerType implements AutoCloseable {
         super(LibLid.l2m_lid_model_new(path));
     }
 
+    Model(Pointer model) {
+        super(model);
+    }
+
+    public String[] getLanguages() {
+        final String[] languages = new String[LibLid.l2m_lid_model_num_languages(this.getPointer())];
+        for (int i = 0; i < languages.length; i++) {
+            languages[i] = LibLid.l2m_lid_model_language(this.getPointer(), i);
+        }
+        return languages;
+    }
+
+    public int getXvectorDim() {
+        return LibLid.l2m_lid_model_xvector_dim(this.getPointer());
+    }
+
+    /**
+     * Scores a stored x-vector, the result is indexed like {@link #getLanguages()}.
+     */
+    public float[] scoreXvector(float[] xvector) {
+        final float[] scores = new float[LibLid.l2m_lid_model_num_languages(this.getPointer())];
+        if (LibLid.l2m_lid_model_score_xvector(this.getPointer(), xvector, xvector.length, scores, scores.length) < 0) {
+            throw new IllegalArgumentException("x-vector dimension does not match the model");
+        }
+        return scores;
+    }
+
+    public void setFrameBudget(int maxFrames) {
+        LibLid.l2m_lid_model_set_frame_budget(this.getPointer(), maxFrames);
+    }
+
+    /**
+     * Runs the network at the frame rate divided by the factor, faster but less accurate. Must
+     * be called before the first result of the model.
+     */
+    public void setFrameSubsampling(int factor) {
+        if (LibLid.l2m_lid_model_set_frame_subsampling(this.getPointer(), factor) != 0) {
+            throw new IllegalStateException("The model was already used or the factor is below 1");
+        }
+    }
+
+    /**
+     * Sets the worker threads (0 for one per core) and queue length (0 for four per thread)
+     * used by {@link Recognizer#getResultAsync()}.
+     */
+    public void setWorkers(int numThreads, int queueSize) {
+        LibLid.l2m_lid_model_set_workers(this.getPointer(), numThreads, queueSize);
+    }
+
+    /**
+     * Placement of the worker threads, in the order of L2mAffinity in lid_api.h.
+     */
+    public enum Affinity {
+        /** Threads run wherever the system puts them */
+        NONE,
+        /** Every thread is pinned to one CPU */
+        CORES,
+        /** Threads are pinned to NUMA nodes, each with its own copy of the network */
+        NUMA
+    }
+
+    /**
+     * Pins the worker threads, with pinning 0 threads in {@link #setWorkers(int, int)} means one
+     * per usable CPU.
+     */
+    public void setWorkerAffinity(Affinity affinity) {
+        LibLid.l2m_lid_model_set_worker_affinity(this.getPointer(), affinity.ordinal());
+    }
+
+    public void setCacheSize(long maxBytes) {
+        LibLid.l2m_lid_model_set_cache_size(this.getPointer(), maxBytes);
+    }
+
+    /**
+     * Returns cache hits, misses and the memory used in bytes.
+     */
+    public long[] getCacheStats() {
+        final long[] hits = new long[1];
+        final long[] misses = new long[1];
+        final long[] bytes = new long[1];
+        LibLid.l2m_lid_model_get_cache_stats(this.getPointer(), hits, misses, bytes);
+        return new long[]{hits[0], misses[0], bytes[0]};
+    }
+
+    /**
+     * Returns the number of cascade results with this model as the small one and how many of
+     * them needed the large model.
+     */
+    public long[] getCascadeStats() {
+        final long[] requests = new long[1];
+        final long[] escalations = new long[1];
+        LibLid.l2m_lid_model_get_cascade_stats(this.getPointer(), requests, escalations);
+        return new long[]{requests[0], escalations[0]};
+    }
+
+    /**
+     * Drops silent and noise-only audio of recognizers created afterwards before any features
+     * are computed.
+     */
+    public void setSpeechGate(boolean enabled) {
+        LibLid.l2m_lid_model_set_speech_gate(this.getPointer(), enabled);
+    }
+
+    /**
+     * Returns the number of 10 ms blocks seen by the speech gates and how many were dropped.
+     */
+    public long[] getSpeechGateStats() {
+        final long[] blocks = new long[1];
+        final long[] rejected = new long[1];
+        LibLid.l2m_lid_model_get_speech_gate_stats(this.getPointer(), blocks, rejected);
+        return new long[]{blocks[0], rejected[0]};
+    }
+
     @Override
     public void close() {
         LibLid.l2m_lid_model_free(this.getPointer());
@@ -0,0 +1,80 @@
+package l2m.recognition.language;
+
+import com.sun.jna.Pointer;
+import com.sun.jna.PointerType;
+
+import java.io.IOException;
+import java.util.Map;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.RejectedExecutionException;
+import java.util.concurrent.atomic.AtomicLong;
+
+/**
+ * Serves a model to new recognizers and replaces it with a retrained one without a restart.
+ * Running recognizers keep the model they were created with, which is freed after the last
+ * of them is closed.
+ */
+public class ModelStore extends PointerType implements AutoCloseable {
+    private static final AtomicLong NEXT_REQUEST = new AtomicLong(1);
+    private static final Map<Long, CompletableFuture<Boolean>> PENDING = new ConcurrentHashMap<>();
+    private static final LibLid.LoadCallback LOAD_CALLBACK = (userData, success) -> {
+        final CompletableFuture<Boolean> future = PENDING.remove(Pointer.nativeValue(userData));
+        if (future != null) {
+            future.complete(success != 0);
+        }
+    };
+
+    /**
+     * Takes over the model, which must not be closed by the caller afterwards.
+     */
+    public ModelStore(Model model) {
+        super(LibLid.l2m_model_store_new(model.getPointer()));
+    }
+
+    /**
+     * Returns the current model, to be closed by the caller.
+     */
+    public Model acquire() {
+        return new Model(LibLid.l2m_model_store_acquire(this.getPointer()));
+    }
+
+    public Recognizer newRecognizer(float sampleRate) {
+        try (Model model = acquire()) {
+            return new Recognizer(model, sampleRate);
+        }
+    }
+
+    /**
+     * Loads a model on the calling thread and publishes it for new recognizers.
+     */
+    public void load(String path) throws IOException {
+        if (LibLid.l2m_model_store_load(this.getPointer(), path) != 0) {
+            throw new IOException("Failed to load the model from " + path);
+        }
+    }
+
+    /**
+     * Loads a model in the background. The future tells whether the model was published and
+     * fails with {@link RejectedExecutionException} if another load is running.
+     */
+    public CompletableFuture<Boolean> loadAsync(String path) {
+        final long id = NEXT_REQUEST.getAndIncrement();
+        final CompletableFuture<Boolean> future = new CompletableFuture<>();
+        PENDING.put(id, future);
+        if (LibLid.l2m_model_store_load_async(this.getPointer(), path, LOAD_CALLBACK, new Pointer(id)) != 0) {
+            PENDING.remove(id);
+            future.completeExceptionally(new RejectedExecutionException("A model is already loading"));
+        }
+        return future;
+    }
+
+    public long getGeneration() {
+        return LibLid.l2m_model_store_generation(this.getPointer());
+    }
+
+    @Override
+    public void close() {
+        LibLid.l2m_model_store_free(this.getPointer());
+    }
+}
@@ -0,0 +1,71 @@
+package l2m.recognition.language;
+
+import com.sun.jna.Pointer;
+import com.sun.jna.PointerType;
+
+import java.io.IOException;
+
+/**
+ * Recognizes every channel of interleaved audio, for example stereo calls.
+ * The result is a JSON array with one result per channel.
+ */
+public class MultiChannelRecognizer extends PointerType implements AutoCloseable {
+    private final int numChannels;
+
+    public MultiChannelRecognizer(Model model, float sampleRate, int numChannels) {
+        super(create(model, sampleRate, numChannels));
+        this.numChannels = numChannels;
+    }
+
+    private static Pointer create(Model model, float sampleRate, int numChannels) {
+        final Pointer pointer = LibLid.l2m_multi_recognizer_new(model, sampleRate, numChannels);
+        if (pointer == null) {
+            throw new IllegalArgumentException("At least one channel is needed, got " + numChannels);
+        }
+        return pointer;
+    }
+
+    public void acceptWaveForm(byte[] data) {
+        LibLid.l2m_multi_recognizer_accept_waveform(this.getPointer(), data, data.length);
+    }
+
+    public void acceptWaveForm(short[] data) {
+        LibLid.l2m_multi_recognizer_accept_waveform_s(this.getPointer(), data, data.length);
+    }
+
+    public void acceptWaveForm(float[] data) {
+        LibLid.l2m_multi_recognizer_accept_waveform_f(this.getPointer(), data, data.length);
+    }
+
+    public void acceptFile(String path) throws IOException {
+        if (LibLid.l2m_multi_recognizer_accept_file(this.getPointer(), path) != 0) {
+            throw new IOException("Failed to read " + path);
+        }
+    }
+
+    public void setLanguages(String... languages) {
+        final String list = String.join(",", languages);
+        for (int c = 0; c < numChannels; c++) {
+            if (LibLid.l2m_recognizer_set_languages(LibLid.l2m_multi_recognizer_channel(this.getPointer(), c),
+                list) != 0) {
+                throw new IllegalArgumentException("None of the languages is supported by the model: " + list);
+            }
+        }
+    }
+
+    public void setMaxResults(int maxResults) {
+        for (int c = 0; c < numChannels; c++) {
+            LibLid.l2m_recognizer_set_max_results(LibLid.l2m_multi_recognizer_channel(this.getPointer(), c),
+                maxResults);
+        }
+    }
+
+    public String getResult() {
+        return LibLid.l2m_multi_recognizer_lang_result(this.getPointer());
+    }
+
+    @Override
+    public void close() {
+        LibLid.l2m_multi_recognizer_free(this.getPointer());
+    }
+}
@@ -1,10 +1,56 @@
 package l2m.recognition.language;
 
+import com.sun.jna.Memory;
+import com.sun.jna.Native;
+import com.sun.jna.Pointer;
 import com.sun.jna.PointerType;
 
+import java.io.IOException;
+import java.nio.Buffer;
+import java.nio.ByteBuffer;
+import java.nio.FloatBuffer;
+import java.nio.ShortBuffer;
+import java.util.Map;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.RejectedExecutionException;
+import java.util.concurrent.atomic.AtomicLong;
+
 public class Recognizer extends PointerType implements AutoCloseable {
+    private static final AtomicLong NEXT_REQUEST = new AtomicLong(1);
+    private static final Map<Long, PendingResult> PENDING = new ConcurrentHashMap<>();
+    // A single callback for all requests, so it is never garbage collected while native code holds it
+    private static final LibLid.ResultCallback RESULT_CALLBACK = (userData, result) -> {
+        final PendingResult pending = PENDING.remove(Pointer.nativeValue(userData));
+        if (pending == null) {
+            return;
+        }
+        if (result != null) {
+            pending.future.complete(result);
+        } else {
+            pending.future.completeExceptionally(new IllegalStateException("Failed to compute the result"));
+        }
+        pending.recognizer.resultDone();
+    };
+
+    // The native request uses the recognizer until the callback, so it stays referenced
+    private static final class PendingResult {
+        final CompletableFuture<String> future = new CompletableFuture<>();
+        final Recognizer recognizer;
+
+        PendingResult(Recognizer recognizer) {
+            this.recognizer = recognizer;
+        }
+    }
+
+    private final int numLanguages;
+    // Asynchronous results in progress, close() frees the recognizer after the last one
+    private int pendingResults;
+    private boolean closed;
+
     public Recognizer(Model model, float sampleRate) {
         super(LibLid.l2m_recognizer_new_lid(model, sampleRate));
+        this.numLanguages = LibLid.l2m_lid_model_num_languages(model.getPointer());
     }
 
 
@@ -20,12 +66,224 @@ public class Recognizer extends PointerType implements AutoCloseable {
         LibLid.l2m_recognizer_accept_waveform_f(this.getPointer(), data, data.length);
     }
 
+    /**
+     * Accepts 16-bit PCM bytes from position to limit of a direct buffer without copying them,
+     * and moves the position to the limit.
+     */
+    public void acceptWaveForm(ByteBuffer data) {
+        final ByteBuffer slice = requireDirect(data).slice();
+        LibLid.l2m_recognizer_accept_waveform(this.getPointer(), slice, slice.remaining());
+        data.position(data.limit());
+    }
+
+    /**
+     * Accepts samples from position to limit of a direct buffer in native byte order without
+     * copying them, and moves the position to the limit.
+     */
+    public void acceptWaveForm(ShortBuffer data) {
+        final ShortBuffer slice = requireDirect(data).slice();
+        LibLid.l2m_recognizer_accept_waveform_s(this.getPointer(), slice, slice.remaining());
+        data.position(data.limit());
+    }
+
+    /**
+     * Accepts samples from position to limit of a direct buffer in native byte order without
+     * copying them, and moves the position to the limit.
+     */
+    public void acceptWaveForm(FloatBuffer data) {
+        final FloatBuffer slice = requireDirect(data).slice();
+        LibLid.l2m_recognizer_accept_waveform_f(this.getPointer(), slice, slice.remaining());
+        data.position(data.limit());
+    }
+
+    private static <T extends Buffer> T requireDirect(T buffer) {
+        if (!buffer.isDirect()) {
+            throw new IllegalArgumentException("Audio buffer must be direct, use the array methods otherwise");
+        }
+        return buffer;
+    }
+
+    public void acceptWaveFormUlaw(byte[] data) {
+        LibLid.l2m_recognizer_accept_waveform_ulaw(this.getPointer(), data, data.length);
+    }
+
+    public void acceptWaveFormAlaw(byte[] data) {
+        LibLid.l2m_recognizer_accept_waveform_alaw(this.getPointer(), data, data.length);
+    }
+
+    /**
+     * Streams a WAV file into the recognizer without loading it into memory.
+     */
+    public void acceptFile(String path) throws IOException {
+        if (LibLid.l2m_recognizer_accept_file(this.getPointer(), path) != 0) {
+            throw new IOException("Failed to read " + path);
+        }
+    }
+
+    /**
+     * Recognizes every file separately, returns a JSON array of file results.
+     */
+    public String recognizeFiles(String... paths) {
+        return LibLid.l2m_recognizer_recognize_files(this.getPointer(), paths, paths.length);
+    }
+
+    public void reset() {
+        LibLid.l2m_recognizer_reset(this.getPointer());
+    }
+
+    /**
+     * Restricts scoring to the given language codes, none for all languages of the model.
+     * Fails with an IllegalArgumentException if none of the codes is supported by the model.
+     */
+    public void setLanguages(String... languages) {
+        final String list = String.join(",", languages);
+        if (LibLid.l2m_recognizer_set_languages(this.getPointer(), list) != 0) {
+            throw new IllegalArgumentException("None of the languages is supported by the model: " + list);
+        }
+    }
+
+    public void setMaxResults(int maxResults) {
+        LibLid.l2m_recognizer_set_max_results(this.getPointer(), maxResults);
+    }
+
+    public void setFrameBudget(int maxFrames) {
+        LibLid.l2m_recognizer_set_frame_budget(this.getPointer(), maxFrames);
+    }
+
+    public void setSpeechGate(boolean enabled) {
+        LibLid.l2m_recognizer_set_speech_gate(this.getPointer(), enabled);
+    }
+
+    /**
+     * Runs the large model only when the score margin between the two best languages of the
+     * recognizer model is below the margin, null removes it.
+     */
+    public void setCascade(Model largeModel, float margin) {
+        if (LibLid.l2m_recognizer_set_cascade(this.getPointer(),
+                largeModel != null ? largeModel.getPointer() : null, margin) != 0) {
+            throw new IllegalArgumentException("The models differ in features or languages");
+        }
+    }
+
+    public void setLanguageNames(boolean languageNames) {
+        LibLid.l2m_recognizer_set_language_names(this.getPointer(), languageNames);
+    }
+
     public String getResult() {
         return LibLid.l2m_recognizer_lang_result(this.getPointer());
     }
 
+    /**
+     * Computes the result as scores indexed like {@link Model#getLanguages()}, without going
+     * through JSON. Languages excluded by {@link #setLanguages(String...)} score negative
+     * infinity. Returns an empty array if there was too little speech.
+     */
+    public float[] getScores() {
+        final float[] scores = new float[numLanguages];
+        final int count = LibLid.l2m_recognizer_lang_scores(this.getPointer(), scores, scores.length);
+        return count > 0 ? scores : new float[0];
+    }
+
+    /**
+     * Computes the results of several recognizers of the same model in parallel on the model
+     * worker pool, with one network pass per worker. Must not be called from an async callback.
+     */
+    public static String[] getResults(Recognizer... recognizers) {
+        final String[] results = new String[recognizers.length];
+        if (recognizers.length == 0) {
+            return results;
+        }
+        final Memory handles = new Memory((long) Native.POINTER_SIZE * recognizers.length);
+        final Memory resultPointers = new Memory((long) Native.POINTER_SIZE * recognizers.length);
+        for (int i = 0; i < recognizers.length; i++) {
+            handles.setPointer((long) Native.POINTER_SIZE * i, recognizers[i].getPointer());
+        }
+        LibLid.l2m_recognizer_lang_result_batch(handles, recognizers.length, resultPointers);
+        for (int i = 0; i < recognizers.length; i++) {
+            final Pointer result = resultPointers.getPointer((long) Native.POINTER_SIZE * i);
+            results[i] = result != null ? result.getString(0) : null;
+        }
+        return results;
+    }
+
+    /**
+     * Computes the result on the worker pool of the model. The future completes on a native
+     * worker thread, so chain blocking work with the *Async methods. Fails with
+     * {@link RejectedExecutionException} if the worker queue is full. The recognizer must not
+     * be used until the future completes, but may be closed, which then frees it afterwards.
+     */
+    public CompletableFuture<String> getResultAsync() {
+        synchronized (this) {
+            if (closed) {
+                throw new IllegalStateException("The recognizer is closed");
+            }
+            pendingResults++;
+        }
+        final long id = NEXT_REQUEST.getAndIncrement();
+        final PendingResult pending = new PendingResult(this);
+        PENDING.put(id, pending);
+        if (LibLid.l2m_recognizer_lang_result_async(this.getPointer(), RESULT_CALLBACK, new Pointer(id)) != 0) {
+            PENDING.remove(id);
+            resultDone();
+            pending.future.completeExceptionally(new RejectedExecutionException("Worker queue is full"));
+        }
+        return pending.future;
+    }
+
+    private synchronized void resultDone() {
+        pendingResults--;
+        if (closed && pendingResults == 0) {
+            LibLid.l2m_recognizer_free(this.getPointer());
+        }
+    }
+
+    /**
+     * Computes the result but stops after timeoutMs milliseconds (no limit if negative) or
+     * when the token is cancelled (may be null), with the result of the audio processed so far.
+     */
+    public DeadlineResult getResult(int timeoutMs, CancelToken cancel) {
+        final int[] status = new int[1];
+        final String result = LibLid.l2m_recognizer_lang_result_deadline(this.getPointer(), timeoutMs,
+            cancel != null ? cancel.getPointer() : null, status);
+        return new DeadlineResult(result, DeadlineResult.Status.values()[status[0]]);
+    }
+
+    /**
+     * Returns the x-vector of the last result, empty if there was too little speech.
+     */
+    public float[] getXvector() {
+        final float[] xvector = new float[LibLid.l2m_recognizer_get_xvector(this.getPointer(), null, 0)];
+        LibLid.l2m_recognizer_get_xvector(this.getPointer(), xvector, xvector.length);
+        return xvector;
+    }
+
+    /**
+     * Returns the stream state, to continue the stream with {@link #restore(byte[])} in another
+     * recognizer of the same model, also in another process.
+     */
+    public byte[] snapshot() {
+        final int[] length = new int[1];
+        final Pointer data = LibLid.l2m_recognizer_snapshot(this.getPointer(), length);
+        if (data == null) {
+            throw new IllegalStateException("The model features do not support snapshots");
+        }
+        return data.getByteArray(0, length[0]);
+    }
+
+    public void restore(byte[] snapshot) {
+        if (LibLid.l2m_recognizer_restore(this.getPointer(), snapshot, snapshot.length) != 0) {
+            throw new IllegalArgumentException("Invalid snapshot");
+        }
+    }
+
     @Override
-    public void close() {
-        LibLid.l2m_recognizer_free(this.getPointer());
+    public synchronized void close() {
+        if (closed) {
+            return;
+        }
+        closed = true;
+        if (pendingResults == 0) {
+            LibLid.l2m_recognizer_free(this.getPointer());
+        }
     }
 }
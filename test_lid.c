@@ -7,7 +7,7 @@
 
 int main() {
 
-    char ch_arr[3][29] = {
+    const char *files[3] = {
         "test_ru.wav",
         "test_ru.wav",
         "test_ru.wav"
@@ -17,27 +17,17 @@ int main() {
 
     for(int i = 0; i < 3; i++) {
         L2mRecognizer *recognizer = l2m_recognizer_new_lid(lid_model, 8000.0);
-        FILE *wavin;
-        int nread, final;
-        if (fopen((const  char *)(ch_arr + i), "rb") != NULL) {
-            wavin = fopen((const  char *)(ch_arr + i), "rb");
-            fseek(wavin, 0L, SEEK_END);
-            long sz = ftell(wavin);
-            fseek(wavin, 0L, SEEK_SET);
-            char buf[sz - 44];
-            fseek(wavin, 44, SEEK_SET);
-
-            nread = fread(buf, 1, sizeof(buf), wavin);
-            l2m_recognizer_accept_waveform(recognizer, buf, nread);
+        if (l2m_recognizer_accept_file(recognizer, files[i]) == 0) {
             printf("%s\n", l2m_recognizer_lang_result(recognizer));
-
-            l2m_recognizer_free(recognizer);
-
-            fclose(wavin);
         }
+        l2m_recognizer_free(recognizer);
     }
 
+    L2mRecognizer *recognizer = l2m_recognizer_new_lid(lid_model, 8000.0);
+    printf("%s\n", l2m_recognizer_recognize_files(recognizer, files, 3));
+    l2m_recognizer_free(recognizer);
+
     l2m_lid_model_free(lid_model);
 
     return 0;
-}
\ No newline at end of file
+}